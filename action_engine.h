@@ -0,0 +1,528 @@
+#ifndef ACTION_ENGINE_H
+#define ACTION_ENGINE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "client_protocol_packets.h"
+#include "bd_addr.h"
+#include "event_loop.h"
+#include "latency_histogram.h"
+#include "profile_table.h"
+
+extern char** environ;
+
+// Runs work in response to button events, off the event loop thread.
+//
+// A rule file maps (button, trigger) to an action. load() resolves groups
+// and wildcards into one row of action slots per configured address plus a
+// default row, so submit() is a hash lookup and an array index. Matching
+// events become fixed-size jobs in a bounded queue that a pool of worker
+// threads drains; submit() only takes the queue lock to add one, and when
+// the queue is full the job is dropped and counted rather than waiting, so
+// the caller's loop never blocks on a slow action. A rule may give its
+// jobs a deadline (max_age_ms after the button event happened): workers
+// take jobs earliest deadline first, in submit order among jobs without
+// one, and skip jobs whose deadline has passed. Queue wait, run time,
+// backlog, drops and expiries are recorded for stats().
+class ActionEngine {
+public:
+    // What a rule reacts to. Down and Up come from ButtonUpOrDown, Click
+    // from ButtonClickOrHold (no double click wait), SingleClick,
+    // DoubleClick and Hold from ButtonSingleOrDoubleClickOrHold; see
+    // triggerFor(). EarlyClick and EarlyHold are a ClickRecognizer's
+    // guesses, submitted by the caller; a later retraction does not undo
+    // the action.
+    enum Trigger {
+        Down,
+        Up,
+        Click,
+        SingleClick,
+        DoubleClick,
+        Hold,
+        EarlyClick,
+        EarlyHold,
+        kTriggerCount
+    };
+
+    enum ActionKind {
+        Exec,       // posix_spawnp() a command and wait for it to exit
+        Fifo,       // write one line to a FIFO (or any file) without blocking
+        Callback    // call a function registered with setCallback()
+    };
+
+    struct Job {
+        uint64_t enqueuedNs;
+        uint64_t eventNs;           // when the button event happened
+        uint64_t deadlineNs;        // kNoDeadline unless the rule has max_age_ms
+        uint64_t seq;               // submit order
+        uint32_t connId;
+        uint16_t action;
+        uint8_t trigger;
+        uint8_t addr[6];
+    };
+
+    // Runs on a worker thread; returns false to count the job as failed
+    typedef std::function<bool(const Job& job)> CallbackFn;
+
+    struct Stats {
+        uint64_t submitted;
+        uint64_t dropped;           // queue full
+        uint64_t expired;           // past the deadline when a worker got to them
+        uint64_t completed;
+        uint64_t failed;            // spawn/open/write error, non-zero exit, callback false
+        size_t backlog;             // queued and running now
+        size_t backlogHighWater;
+        LatencyHistogram queueUs;   // submit() to a worker picking the job up
+        LatencyHistogram runUs;     // action start to finish
+
+        Stats()
+            : submitted(0), dropped(0), expired(0), completed(0), failed(0), backlog(0),
+              backlogHighWater(0), queueUs(60000000), runUs(600000000) {}
+    };
+
+    static const uint64_t kNoDeadline = UINT64_MAX;
+
+    ActionEngine() : workerCount(2), stopping(false), capacity(256), nextSeq(0), running(0) {
+        rows.resize(1);
+        clearRow(rows[0]);
+    }
+
+    ~ActionEngine() { stop(); }
+
+    // Must be called before load() for rules that use "call NAME"
+    void setCallback(const std::string& name, CallbackFn fn) { callbacks[name] = fn; }
+
+    // Reads a rule file; '#' starts a comment. Must be called before start().
+    //   workers 4                       worker threads (default 2)
+    //   queue 256                       jobs waiting before new ones are dropped
+    //   group hall 80:e4:da:71:3b:ff 80:e4:da:71:3b:fe
+    //   80:e4:da:71:3b:ff single exec /usr/local/bin/lights toggle
+    //   hall double fifo /run/flic.fifo scene-off
+    //   * hold max_age_ms=2000 call alarm
+    // The target is a button address, a group defined above, or * for every
+    // button; the trigger is down, up, click, single, double, hold, early or
+    // early_hold (see Trigger). An address rule beats a group rule beats a
+    // * rule; among equals the later line wins. max_age_ms=N drops the job
+    // if it cannot start within N ms of the button event. exec gets
+    // FLIC_BDADDR, FLIC_CONN_ID, FLIC_TRIGGER and FLIC_AGE_MS (event to
+    // start) in its environment and stdin from /dev/null; fifo writes
+    // "bdaddr trigger [text]\n".
+    bool load(const std::string& path, std::string* error) {
+        std::ifstream file(path.c_str());
+        if (!file) {
+            if (error) *error = "cannot open " + path;
+            return false;
+        }
+        std::map<std::string, std::vector<uint64_t> > groups;
+        std::vector<Rule> rules;
+        std::string line;
+        size_t lineNo = 0;
+        while (std::getline(file, line)) {
+            lineNo++;
+            std::istringstream iss(line);
+            std::vector<std::string> words;
+            std::string word;
+            while (iss >> word && word[0] != '#') words.push_back(word);
+            if (words.empty()) continue;
+
+            if (words[0] == "workers" || words[0] == "queue") {
+                char* end;
+                unsigned long n = words.size() == 2 ? std::strtoul(words[1].c_str(), &end, 10) : 0;
+                if (n == 0 || *end != '\0' || n > 65536) {
+                    return configError(error, path, lineNo, "expected '" + words[0] + " N'");
+                }
+                if (words[0] == "workers") {
+                    workerCount = n;
+                } else {
+                    capacity = n;
+                }
+                continue;
+            }
+            if (words[0] == "group") {
+                if (words.size() < 3) return configError(error, path, lineNo, "expected 'group NAME bdaddr...'");
+                std::vector<uint64_t>& members = groups[words[1]];
+                for (size_t i = 2; i < words.size(); i++) {
+                    BdAddr addr;
+                    if (!addr.fromString(words[i])) {
+                        return configError(error, path, lineNo, "bad address '" + words[i] + "'");
+                    }
+                    members.push_back(packAddress(addr.data()));
+                }
+                continue;
+            }
+
+            if (words.size() < 4) {
+                return configError(error, path, lineNo, "expected 'target trigger action [args]'");
+            }
+            Rule rule;
+            BdAddr addr;
+            if (words[0] == "*") {
+                rule.rank = 0;
+            } else if (addr.fromString(words[0])) {
+                rule.rank = 2;
+                rule.addrs.push_back(packAddress(addr.data()));
+            } else if (groups.count(words[0])) {
+                rule.rank = 1;
+                rule.addrs = groups[words[0]];
+            } else {
+                return configError(error, path, lineNo, "unknown target '" + words[0] + "'");
+            }
+            rule.trigger = parseTrigger(words[1]);
+            if (rule.trigger < 0) return configError(error, path, lineNo, "unknown trigger '" + words[1] + "'");
+
+            Action action;
+            size_t kind = 2;
+            if (words[kind].compare(0, 11, "max_age_ms=") == 0) {
+                char* end;
+                unsigned long ms = std::strtoul(words[kind].c_str() + 11, &end, 10);
+                if (ms == 0 || *end != '\0' || ms > 86400000) {
+                    return configError(error, path, lineNo, "bad setting '" + words[kind] + "'");
+                }
+                action.maxAgeMs = static_cast<uint32_t>(ms);
+                kind++;
+            }
+            if (words.size() < kind + 2) {
+                return configError(error, path, lineNo, "expected 'target trigger action [args]'");
+            }
+            if (words[kind] == "exec") {
+                action.kind = Exec;
+                action.args.assign(words.begin() + kind + 1, words.end());
+            } else if (words[kind] == "fifo") {
+                action.kind = Fifo;
+                action.args.assign(words.begin() + kind + 1, words.end());
+            } else if (words[kind] == "call" && words.size() == kind + 2) {
+                action.kind = Callback;
+                std::map<std::string, CallbackFn>::const_iterator it = callbacks.find(words[kind + 1]);
+                if (it == callbacks.end()) {
+                    return configError(error, path, lineNo, "no callback named '" + words[kind + 1] + "'");
+                }
+                action.args.push_back(words[kind + 1]);
+                action.callback = it->second;
+            } else {
+                return configError(error, path, lineNo, "expected exec, fifo or call NAME");
+            }
+            if (actions.size() >= 0xffff) return configError(error, path, lineNo, "too many rules");
+            rule.action = static_cast<uint16_t>(actions.size());
+            actions.push_back(action);
+            rules.push_back(rule);
+        }
+        compile(rules);
+        return true;
+    }
+
+    // Starts the worker threads
+    void start() {
+        if (!workers.empty()) return;
+        stopping = false;
+        for (size_t i = 0; i < workerCount; i++) {
+            workers.push_back(std::thread(&ActionEngine::workerMain, this));
+        }
+    }
+
+    // Lets the workers finish what is queued and joins them
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+        workers.clear();
+    }
+
+    // The action slot for addr and trigger, or -1; no locking
+    int lookup(const uint8_t* addr, int trigger) const {
+        if (trigger < 0 || trigger >= kTriggerCount) return -1;
+        std::unordered_map<uint64_t, uint32_t>::const_iterator it =
+            rowByAddr.find(packAddress(addr));
+        const Row& row = rows[it != rowByAddr.end() ? it->second : 0];
+        return row.slot[trigger] ? row.slot[trigger] - 1 : -1;
+    }
+
+    // Queues the action for addr and trigger, if there is one. eventNs is
+    // when the button event happened (EventLoop::nowNs() clock), 0 for now.
+    // Returns false if there is no action or the queue is full.
+    bool submit(const uint8_t* addr, uint32_t connId, int trigger, uint64_t eventNs = 0) {
+        int action = lookup(addr, trigger);
+        if (action < 0) return false;
+        Job job;
+        job.enqueuedNs = EventLoop::nowNs();
+        job.eventNs = eventNs ? eventNs : job.enqueuedNs;
+        uint32_t maxAgeMs = actions[action].maxAgeMs;
+        job.deadlineNs = maxAgeMs ? job.eventNs + maxAgeMs * 1000000ull : kNoDeadline;
+        job.connId = connId;
+        job.action = static_cast<uint16_t>(action);
+        job.trigger = static_cast<uint8_t>(trigger);
+        std::memcpy(job.addr, addr, sizeof(job.addr));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.submitted++;
+            if (queue.size() == capacity) {
+                counters.dropped++;
+                return false;
+            }
+            job.seq = nextSeq++;
+            queue.push_back(job);
+            std::push_heap(queue.begin(), queue.end(), later);
+            if (queue.size() + running > counters.backlogHighWater) {
+                counters.backlogHighWater = queue.size() + running;
+            }
+        }
+        wake.notify_one();
+        return true;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s = counters;
+        s.backlog = queue.size() + running;
+        return s;
+    }
+
+    size_t ruleCount() const { return actions.size(); }
+    size_t buttonCount() const { return rowByAddr.size(); }
+    size_t workerThreads() const { return workerCount; }
+    size_t queueCapacity() const { return capacity; }
+
+    // The trigger for a button event packet, or -1 for events that repeat
+    // one already covered (ButtonSingleOrDoubleClick, ClickOrHold's hold)
+    static int triggerFor(uint8_t opcode, uint8_t clickType) {
+        using namespace FlicClientProtocol;
+        switch (opcode) {
+            case EVT_BUTTON_UP_OR_DOWN_OPCODE:
+                return clickType == ClickTypeButtonDown ? Down : clickType == ClickTypeButtonUp ? Up : -1;
+            case EVT_BUTTON_CLICK_OR_HOLD_OPCODE:
+                return clickType == ClickTypeButtonClick ? Click : -1;
+            case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE:
+                return clickType == ClickTypeButtonSingleClick ? SingleClick :
+                       clickType == ClickTypeButtonDoubleClick ? DoubleClick :
+                       clickType == ClickTypeButtonHold ? Hold : -1;
+            default:
+                return -1;
+        }
+    }
+
+    static const char* triggerName(int trigger) {
+        static const char* const names[kTriggerCount] = {
+            "down", "up", "click", "single", "double", "hold", "early", "early_hold"
+        };
+        return trigger >= 0 && trigger < kTriggerCount ? names[trigger] : "?";
+    }
+
+    static int parseTrigger(const std::string& name) {
+        for (int i = 0; i < kTriggerCount; i++) {
+            if (name == triggerName(i)) return i;
+        }
+        return -1;
+    }
+
+private:
+    struct Action {
+        ActionKind kind;
+        std::vector<std::string> args;   // exec: argv; fifo: path, text; call: name
+        CallbackFn callback;
+        uint32_t maxAgeMs;               // 0 = no deadline
+
+        Action() : kind(Exec), maxAgeMs(0) {}
+    };
+
+    struct Rule {
+        std::vector<uint64_t> addrs;     // packed; empty for *
+        int rank;                        // 0 = *, 1 = group, 2 = address
+        int trigger;
+        uint16_t action;
+    };
+
+    // Action index + 1 per trigger; 0 = no action
+    struct Row {
+        uint16_t slot[kTriggerCount];
+    };
+
+    std::vector<Action> actions;
+    std::map<std::string, CallbackFn> callbacks;
+    std::vector<Row> rows;                          // rows[0]: buttons without their own
+    std::unordered_map<uint64_t, uint32_t> rowByAddr;
+
+    size_t workerCount;
+    std::vector<std::thread> workers;
+
+    // Guarded by mutex
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::vector<Job> queue;                         // heap, see later()
+    size_t capacity;
+    uint64_t nextSeq;
+    size_t running;
+    Stats counters;
+
+    static void clearRow(Row& row) { std::memset(&row, 0, sizeof(row)); }
+
+    // Heap order: earliest deadline first, then submit order
+    static bool later(const Job& a, const Job& b) {
+        if (a.deadlineNs != b.deadlineNs) return a.deadlineNs > b.deadlineNs;
+        return a.seq > b.seq;
+    }
+
+    // Applies rules by rank, then line order, so every row starts from the
+    // * rules and more specific or later rules overwrite slots
+    void compile(const std::vector<Rule>& rules) {
+        rows.assign(1, Row());
+        clearRow(rows[0]);
+        rowByAddr.clear();
+        for (int rank = 0; rank <= 2; rank++) {
+            for (size_t i = 0; i < rules.size(); i++) {
+                const Rule& rule = rules[i];
+                if (rule.rank != rank) continue;
+                if (rank == 0) {
+                    // Addresses that already have a row need the * rule too
+                    for (size_t r = 0; r < rows.size(); r++) rows[r].slot[rule.trigger] = rule.action + 1;
+                    continue;
+                }
+                for (size_t a = 0; a < rule.addrs.size(); a++) {
+                    std::unordered_map<uint64_t, uint32_t>::iterator it = rowByAddr.find(rule.addrs[a]);
+                    if (it == rowByAddr.end()) {
+                        it = rowByAddr.insert(std::make_pair(rule.addrs[a],
+                                                             static_cast<uint32_t>(rows.size()))).first;
+                        Row row = rows[0];
+                        rows.push_back(row);
+                    }
+                    rows[it->second].slot[rule.trigger] = rule.action + 1;
+                }
+            }
+        }
+    }
+
+    void workerMain() {
+        // Signals stay with the loop thread's signalfd
+        sigset_t all;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            std::pop_heap(queue.begin(), queue.end(), later);
+            Job job = queue.back();
+            queue.pop_back();
+            uint64_t startNs = EventLoop::nowNs();
+            if (startNs > job.deadlineNs) {
+                counters.expired++;
+                counters.queueUs.record((startNs - job.enqueuedNs) / 1000);
+                continue;
+            }
+            running++;
+            lock.unlock();
+
+            bool ok = run(actions[job.action], job);
+            uint64_t endNs = EventLoop::nowNs();
+
+            lock.lock();
+            running--;
+            counters.queueUs.record((startNs - job.enqueuedNs) / 1000);
+            counters.runUs.record((endNs - startNs) / 1000);
+            if (ok) {
+                counters.completed++;
+            } else {
+                counters.failed++;
+            }
+        }
+    }
+
+    static bool run(const Action& action, const Job& job) {
+        switch (action.kind) {
+            case Exec: return spawn(action.args, job);
+            case Fifo: return writeLine(action.args, job);
+            case Callback: return action.callback(job);
+        }
+        return false;
+    }
+
+    static bool spawn(const std::vector<std::string>& args, const Job& job) {
+        std::vector<char*> argv;
+        for (size_t i = 0; i < args.size(); i++) argv.push_back(const_cast<char*>(args[i].c_str()));
+        argv.push_back(nullptr);
+
+        char addr[BdAddr::kStringLength + 1];
+        BdAddr::format(job.addr, addr);
+        addr[BdAddr::kStringLength] = '\0';
+        std::string vars[4] = {
+            std::string("FLIC_BDADDR=") + addr,
+            "FLIC_CONN_ID=" + std::to_string(job.connId),
+            std::string("FLIC_TRIGGER=") + triggerName(job.trigger),
+            "FLIC_AGE_MS=" + std::to_string((EventLoop::nowNs() - job.eventNs) / 1000000)
+        };
+        std::vector<char*> envp;
+        for (char** e = environ; *e; e++) {
+            if (std::strncmp(*e, "FLIC_", 5) != 0) envp.push_back(*e);
+        }
+        for (size_t i = 0; i < 4; i++) envp.push_back(const_cast<char*>(vars[i].c_str()));
+        envp.push_back(nullptr);
+
+        // Keep the child off the console's stdin, and give it a clean signal
+        // mask rather than the blocked set of the thread that spawns it
+        posix_spawn_file_actions_t files;
+        posix_spawn_file_actions_init(&files);
+        posix_spawn_file_actions_addopen(&files, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t none;
+        sigemptyset(&none);
+        posix_spawnattr_setsigmask(&attr, &none);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+        pid_t pid;
+        int err = posix_spawnp(&pid, argv[0], &files, &attr, &argv[0], &envp[0]);
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&files);
+        if (err != 0) return false;
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) return false;
+        }
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    static bool writeLine(const std::vector<std::string>& args, const Job& job) {
+        std::string line(BdAddr::kStringLength, ' ');
+        BdAddr::format(job.addr, &line[0]);
+        line += ' ';
+        line += triggerName(job.trigger);
+        for (size_t i = 1; i < args.size(); i++) {
+            line += ' ';
+            line += args[i];
+        }
+        line += '\n';
+
+        // A FIFO without a reader fails with ENXIO instead of blocking
+        int fd = open(args[0].c_str(), O_WRONLY | O_NONBLOCK | O_APPEND | O_CLOEXEC);
+        if (fd < 0) return false;
+        ssize_t n = write(fd, line.data(), line.size());
+        close(fd);
+        return n == static_cast<ssize_t>(line.size());
+    }
+};
+
+#endif // ACTION_ENGINE_H
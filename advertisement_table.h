@@ -0,0 +1,162 @@
+#ifndef ADVERTISEMENT_TABLE_H
+#define ADVERTISEMENT_TABLE_H
+
+#include <cstring>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "client_protocol_packets.h"
+#include "bd_addr.h"
+
+// Aggregates raw advertisements into one entry per button address.
+//
+// A scanning button advertises many times per second, once per active
+// scanner. Each entry keeps the latest packet, an exponential moving average
+// of the RSSI, first/last-seen times and packet counters. update() decides
+// whether a packet is worth reporting: a new button or a change of name or
+// flags always is, a smoothed RSSI that moved by at least the threshold only
+// once the entry's minimum report interval has passed, and everything else
+// is absorbed. Times are monotonic milliseconds supplied by the caller.
+class AdvertisementTable {
+public:
+    // Bits returned by update() and passed to expire() callbacks
+    enum Change {
+        New = 1,
+        Rssi = 2,
+        Name = 4,
+        Flags = 8,   // is_private, already_verified or already_connected_*
+        Lost = 16    // not seen for the expiry time; the entry is removed
+    };
+
+    struct Entry {
+        FlicClientProtocol::EvtAdvertisementPacket last;  // most recent packet
+        float rssiAvg;
+        int8_t reportedRssi;      // smoothed RSSI at the last report
+        uint64_t firstSeenMs;
+        uint64_t lastSeenMs;
+        uint64_t lastReportMs;
+        uint64_t packets;         // since first seen
+        uint32_t windowPackets;   // since the last resetWindow()
+
+        int8_t rssi() const {
+            return static_cast<int8_t>(rssiAvg < 0 ? rssiAvg - 0.5f : rssiAvg + 0.5f);
+        }
+    };
+
+    AdvertisementTable()
+        : alpha(0.25f), rssiThresholdDb(6), minIntervalMs(1000), expiryMs(30000),
+          packetCount(0) {}
+
+    // Weight of a new sample in the RSSI average, in (0, 1]
+    void setSmoothing(float weight) {
+        alpha = weight > 0 && weight <= 1 ? weight : 0.25f;
+    }
+
+    // Smoothed RSSI movement that is reported, at most once per interval
+    void setRssiThreshold(unsigned db) { rssiThresholdDb = db; }
+    void setMinInterval(uint64_t ms) { minIntervalMs = ms; }
+
+    // Entries not seen for this long are reported Lost and removed
+    void setExpiry(uint64_t ms) { expiryMs = ms > 0 ? ms : 1; }
+    uint64_t expiry() const { return expiryMs; }
+
+    // Folds one packet into its entry. Returns the Change bits to report, or
+    // 0 if the packet changed nothing worth reporting; entry is set either way.
+    unsigned update(const FlicClientProtocol::EvtAdvertisementPacket& evt, uint64_t nowMs,
+                    const Entry*& entry) {
+        packetCount++;
+        std::pair<EntryMap::iterator, bool> slot =
+            entries.insert(std::make_pair(packAddress(evt.bd_addr), Entry()));
+        Entry& e = slot.first->second;
+        entry = &e;
+
+        unsigned changes = 0;
+        if (slot.second) {
+            e.rssiAvg = evt.rssi;
+            e.firstSeenMs = nowMs;
+            e.packets = 0;
+            e.windowPackets = 0;
+            changes = New;
+        } else {
+            if (nameLength(evt) != nameLength(e.last) ||
+                std::memcmp(evt.name, e.last.name, nameLength(evt)) != 0) {
+                changes |= Name;
+            }
+            if (flags(evt) != flags(e.last)) changes |= Flags;
+            e.rssiAvg += alpha * (evt.rssi - e.rssiAvg);
+        }
+        e.last = evt;
+        e.lastSeenMs = nowMs;
+        e.packets++;
+        e.windowPackets++;
+
+        int moved = e.rssi() - e.reportedRssi;
+        if (changes == 0 && (moved >= static_cast<int>(rssiThresholdDb) ||
+                             -moved >= static_cast<int>(rssiThresholdDb)) &&
+            nowMs - e.lastReportMs >= minIntervalMs) {
+            changes = Rssi;
+        }
+        if (changes != 0) {
+            e.reportedRssi = e.rssi();
+            e.lastReportMs = nowMs;
+        }
+        return changes;
+    }
+
+    // Calls onLost(entry) for every entry not seen for the expiry time, then
+    // removes them
+    template <typename Fn>
+    void expire(uint64_t nowMs, Fn onLost) {
+        for (EntryMap::iterator it = entries.begin(); it != entries.end();) {
+            if (nowMs - it->second.lastSeenMs < expiryMs) {
+                ++it;
+                continue;
+            }
+            onLost(it->second);
+            it = entries.erase(it);
+        }
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (EntryMap::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            fn(it->second);
+        }
+    }
+
+    // Starts a new digest window
+    void resetWindow() {
+        for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it) {
+            it->second.windowPackets = 0;
+        }
+    }
+
+    void clear() { entries.clear(); }
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+
+    // Packets folded in since the table was created
+    uint64_t packets() const { return packetCount; }
+
+private:
+    typedef std::unordered_map<uint64_t, Entry> EntryMap;
+
+    EntryMap entries;
+    float alpha;
+    unsigned rssiThresholdDb;
+    uint64_t minIntervalMs;
+    uint64_t expiryMs;
+    uint64_t packetCount;
+
+    static size_t nameLength(const FlicClientProtocol::EvtAdvertisementPacket& evt) {
+        return evt.name_length < sizeof(evt.name) ? evt.name_length : sizeof(evt.name);
+    }
+
+    static unsigned flags(const FlicClientProtocol::EvtAdvertisementPacket& evt) {
+        return (evt.is_private ? 1 : 0) | (evt.already_verified ? 2 : 0) |
+               (evt.already_connected_to_this_device ? 4 : 0) |
+               (evt.already_connected_to_other_device ? 8 : 0);
+    }
+};
+
+#endif // ADVERTISEMENT_TABLE_H
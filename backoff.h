@@ -0,0 +1,51 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <random>
+#include <stdint.h>
+
+// Exponential backoff with jitter for reconnect attempts.
+//
+// The ceiling starts at minMs and doubles after every attempt up to maxMs.
+// Each delay is drawn uniformly from [ceiling/2, ceiling] ("equal jitter"),
+// so many clients that lost the same server do not retry in lockstep, while
+// no delay collapses to zero.
+class Backoff {
+public:
+    Backoff(uint64_t minMs = 250, uint64_t maxMs = 30000)
+        : minMs(minMs), maxMs(maxMs < minMs ? minMs : maxMs), ceiling(minMs),
+          attemptCount(0), rng(std::random_device()()) {}
+
+    void setRange(uint64_t min, uint64_t max) {
+        minMs = min > 0 ? min : 1;
+        maxMs = max < minMs ? minMs : max;
+        reset();
+    }
+
+    // Delay before the next attempt
+    uint64_t nextDelayMs() {
+        uint64_t half = ceiling / 2;
+        std::uniform_int_distribution<uint64_t> jitter(0, ceiling - half);
+        uint64_t delay = half + jitter(rng);
+        attemptCount++;
+        ceiling = ceiling * 2 > maxMs ? maxMs : ceiling * 2;
+        return delay;
+    }
+
+    // Called once a connection succeeds
+    void reset() {
+        ceiling = minMs;
+        attemptCount = 0;
+    }
+
+    unsigned attempts() const { return attemptCount; }
+
+private:
+    uint64_t minMs;
+    uint64_t maxMs;
+    uint64_t ceiling;
+    unsigned attemptCount;
+    std::minstd_rand rng;
+};
+
+#endif // BACKOFF_H
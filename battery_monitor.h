@@ -0,0 +1,188 @@
+#ifndef BATTERY_MONITOR_H
+#define BATTERY_MONITOR_H
+
+#include <cstring>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "client_protocol_packets.h"
+#include "bd_addr.h"
+
+// Battery history per button address with fixed memory per button.
+//
+// Each button keeps at most kSamples buckets. A reading either folds into
+// the newest bucket (same bucket window) or opens a new one; when all
+// buckets are used, neighbours are merged pairwise and the window doubles,
+// so the whole history since the first reading is kept at a resolution
+// that coarsens as it grows. Buckets hold min/max/last percentage, which is
+// what matters for a level that only ever drains (or jumps on replacement).
+//
+// Each button also has an alert level (FlicClientProtocol::BatteryStatus)
+// that drops to Low or Critical when the level falls to the thresholds, and
+// only returns to Ok once it rises a margin above the Low threshold, so a
+// reading that wobbles around a threshold alerts once.
+class BatteryMonitor {
+public:
+    static const size_t kSamples = 32;
+    static const int kReplacementJump = 10;    // rise in percent taken as a new battery
+
+    struct Sample {
+        uint32_t start;    // first reading in the bucket, Unix seconds
+        uint32_t end;      // last reading in the bucket
+        int8_t min;
+        int8_t max;
+        int8_t last;
+        uint8_t readings;  // saturates at 255
+    };
+
+    struct Series {
+        uint64_t addr;          // packed address, see packAddress()
+        Sample samples[kSamples];
+        uint32_t windowSeconds; // bucket width, doubles on each compaction
+        uint8_t count;
+        uint8_t level;          // FlicClientProtocol::BatteryStatus
+
+        const Sample& latest() const { return samples[count - 1]; }
+
+        // Average drain in percent per day from the first to the latest
+        // reading since the last battery replacement, i.e. a rise of at
+        // least kReplacementJump; smaller rises are reading noise. 0 with
+        // less than a day of data.
+        double percentPerDay() const {
+            size_t from = 0;
+            for (size_t i = 1; i < count; i++) {
+                if (samples[i].max >= samples[i - 1].last + kReplacementJump) from = i;
+            }
+            uint32_t seconds = latest().end - samples[from].start;
+            if (seconds < 86400) return 0;
+            return (samples[from].max - latest().last) * 86400.0 / seconds;
+        }
+
+        // Estimated days until empty, or -1 when the level is not draining
+        double daysLeft() const {
+            double rate = percentPerDay();
+            return rate > 0 ? latest().last / rate : -1;
+        }
+    };
+
+    BatteryMonitor()
+        : lowPercent(20), criticalPercent(10), rearmMargin(10), initialWindow(3600),
+          readingCount(0) {}
+
+    // Percentages at which the level becomes Low and Critical
+    void setThresholds(int low, int critical) {
+        lowPercent = low;
+        criticalPercent = critical < low ? critical : low;
+    }
+
+    int lowThreshold() const { return lowPercent; }
+    int criticalThreshold() const { return criticalPercent; }
+
+    // Bucket width for new series; history then covers kSamples windows
+    // before the first compaction
+    void setInitialWindow(uint32_t seconds) { initialWindow = seconds > 0 ? seconds : 1; }
+
+    // Folds one reading in. timestamp is flicd's Unix time of the reading;
+    // percent is -1 when the level is unknown, which is ignored. Returns the
+    // new alert level if it changed, or -1. series is set unless ignored.
+    int update(const uint8_t* address, int8_t percent, uint64_t timestamp, const Series*& series) {
+        series = nullptr;
+        if (percent < 0 || percent > 100) return -1;
+        readingCount++;
+        uint32_t t = static_cast<uint32_t>(timestamp);
+
+        std::pair<SeriesMap::iterator, bool> slot = table.insert(std::make_pair(packAddress(address), Series()));
+        Series& s = slot.first->second;
+        series = &s;
+        if (slot.second) {
+            std::memset(&s, 0, sizeof(s));
+            s.addr = packAddress(address);
+            s.windowSeconds = initialWindow;
+            s.level = FlicClientProtocol::BatteryStatusOk;
+        }
+
+        Sample* last = s.count ? &s.samples[s.count - 1] : nullptr;
+        if (last && t < last->end) t = last->end;  // clock went back; keep order
+        if (last && t - last->start < s.windowSeconds) {
+            last->end = t;
+            if (percent < last->min) last->min = percent;
+            if (percent > last->max) last->max = percent;
+            last->last = percent;
+            if (last->readings < 255) last->readings++;
+        } else {
+            if (s.count == kSamples) compact(s);
+            Sample& sample = s.samples[s.count++];
+            sample.start = sample.end = t;
+            sample.min = sample.max = sample.last = percent;
+            sample.readings = 1;
+        }
+
+        uint8_t level = levelFor(percent, s.level);
+        if (level == s.level) return -1;
+        s.level = level;
+        return level;
+    }
+
+    const Series* find(const uint8_t* address) const {
+        SeriesMap::const_iterator it = table.find(packAddress(address));
+        return it != table.end() ? &it->second : nullptr;
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (SeriesMap::const_iterator it = table.begin(); it != table.end(); ++it) {
+            fn(it->second);
+        }
+    }
+
+    void erase(const uint8_t* address) { table.erase(packAddress(address)); }
+    void clear() { table.clear(); }
+    size_t size() const { return table.size(); }
+
+    // Readings folded in since the monitor was created
+    uint64_t readings() const { return readingCount; }
+
+private:
+    typedef std::unordered_map<uint64_t, Series> SeriesMap;
+
+    SeriesMap table;
+    int lowPercent;
+    int criticalPercent;
+    int rearmMargin;
+    uint32_t initialWindow;
+    uint64_t readingCount;
+
+    uint8_t levelFor(int percent, uint8_t current) const {
+        if (percent <= criticalPercent) return FlicClientProtocol::BatteryStatusCritical;
+        if (percent <= lowPercent) {
+            return current == FlicClientProtocol::BatteryStatusCritical ?
+                   current : static_cast<uint8_t>(FlicClientProtocol::BatteryStatusLow);
+        }
+        if (current != FlicClientProtocol::BatteryStatusOk && percent < lowPercent + rearmMargin) {
+            return current;
+        }
+        return FlicClientProtocol::BatteryStatusOk;
+    }
+
+    // Merges neighbouring buckets pairwise and doubles the window
+    static void compact(Series& s) {
+        size_t out = 0;
+        for (size_t i = 0; i < s.count; i += 2, out++) {
+            Sample merged = s.samples[i];
+            if (i + 1 < s.count) {
+                const Sample& next = s.samples[i + 1];
+                merged.end = next.end;
+                if (next.min < merged.min) merged.min = next.min;
+                if (next.max > merged.max) merged.max = next.max;
+                merged.last = next.last;
+                unsigned readings = merged.readings + next.readings;
+                merged.readings = static_cast<uint8_t>(readings < 255 ? readings : 255);
+            }
+            s.samples[out] = merged;
+        }
+        s.count = static_cast<uint8_t>(out);
+        s.windowSeconds *= 2;
+    }
+};
+
+#endif // BATTERY_MONITOR_H
@@ -0,0 +1,118 @@
+#ifndef BD_ADDR_H
+#define BD_ADDR_H
+
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+// Helper class for Bluetooth address handling
+//
+// The protocol stores addresses little-endian (addr[0] is the last byte of
+// the printed form). Encoding and decoding are table driven and never
+// allocate except for toString()'s result.
+class BdAddr {
+private:
+    uint8_t addr[6];
+
+    static const char* hexDigits() {
+        return "0123456789abcdef";
+    }
+
+    // Maps an ASCII character to its hex value, or -1
+    static int hexValue(char c) {
+        struct Table {
+            int8_t values[256];
+            Table() {
+                std::memset(values, -1, sizeof(values));
+                for (int i = 0; i < 10; i++) values['0' + i] = static_cast<int8_t>(i);
+                for (int i = 0; i < 6; i++) {
+                    values['a' + i] = static_cast<int8_t>(10 + i);
+                    values['A' + i] = static_cast<int8_t>(10 + i);
+                }
+            }
+        };
+        static const Table table;
+        return table.values[static_cast<unsigned char>(c)];
+    }
+
+public:
+    // Length of "xx:xx:xx:xx:xx:xx"
+    static const size_t kStringLength = 17;
+
+    BdAddr() {
+        std::memset(addr, 0, 6);
+    }
+
+    // Invalid strings give the all-zero address; use parse() to detect them
+    explicit BdAddr(const std::string& addrStr) {
+        if (!fromString(addrStr)) std::memset(addr, 0, 6);
+    }
+
+    explicit BdAddr(const uint8_t* a) {
+        std::memcpy(addr, a, 6);
+    }
+
+    // Accepts exactly "xx:xx:xx:xx:xx:xx" (either case). Leaves the address
+    // unchanged and returns false otherwise.
+    bool fromString(const std::string& addrStr) {
+        return parse(addrStr.data(), addrStr.size(), addr);
+    }
+
+    static bool parse(const char* text, size_t len, uint8_t* out) {
+        if (len != kStringLength) return false;
+        uint8_t bytes[6];
+        for (int i = 0; i < 6; i++) {
+            const char* p = text + 3 * i;
+            if (i < 5 && p[2] != ':') return false;
+            int hi = hexValue(p[0]);
+            int lo = hexValue(p[1]);
+            if (hi < 0 || lo < 0) return false;
+            bytes[5 - i] = static_cast<uint8_t>((hi << 4) | lo);
+        }
+        std::memcpy(out, bytes, 6);
+        return true;
+    }
+
+    // Writes the kStringLength characters of the printed form (no NUL)
+    static char* format(const uint8_t* a, char* out) {
+        const char* hex = hexDigits();
+        for (int i = 5; i >= 0; i--) {
+            *out++ = hex[a[i] >> 4];
+            *out++ = hex[a[i] & 15];
+            if (i > 0) *out++ = ':';
+        }
+        return out;
+    }
+
+    std::string toString() const {
+        char text[kStringLength];
+        format(addr, text);
+        return std::string(text, kStringLength);
+    }
+
+    bool operator==(const BdAddr& other) const {
+        return std::memcmp(addr, other.addr, 6) == 0;
+    }
+    bool operator!=(const BdAddr& other) const { return !(*this == other); }
+
+    const uint8_t* data() const { return addr; }
+    uint8_t* data() { return addr; }
+};
+
+// Protocol address bytes to a 48-bit integer with bit 48 set, so a packed
+// address is never 0 even for 00:00:00:00:00:00. The key of every
+// per-button table, and the address field of the button info snapshot.
+inline uint64_t packAddress(const uint8_t* address) {
+    uint64_t key = 0;
+    for (int i = 5; i >= 0; i--) key = (key << 8) | address[i];
+    return key | (1ull << 48);
+}
+
+inline void unpackAddress(uint64_t key, uint8_t* out) {
+    for (int i = 0; i < 6; i++) {
+        out[i] = static_cast<uint8_t>(key);
+        key >>= 8;
+    }
+}
+
+#endif // BD_ADDR_H
@@ -0,0 +1,72 @@
+// Address parsing and printing.
+//
+// Converts a fixed set of 64 addresses back and forth through each BdAddr
+// entry point, so the table lookups stay warm but the branch predictor
+// cannot learn a single input.
+
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../bd_addr.h"
+#include "../output_buffer.h"
+#include "bench_common.h"
+
+namespace {
+
+const size_t kAddresses = 64;
+
+} // namespace
+
+int main() {
+    std::vector<BdAddr> addrs(kAddresses);
+    std::vector<std::string> texts(kAddresses);
+    for (size_t i = 0; i < kAddresses; i++) {
+        uint8_t bytes[6] = { static_cast<uint8_t>(i * 37), static_cast<uint8_t>(i * 11), 0x3b,
+                             0x71, 0xda, static_cast<uint8_t>(i & 1 ? 0xe4 : 0x80) };
+        addrs[i] = BdAddr(bytes);
+        texts[i] = addrs[i].toString();
+        // Mixed case, which fromString() accepts
+        if (i & 2) texts[i][0] = static_cast<char>(std::toupper(texts[i][0]));
+    }
+
+    Bench::printHeader("BdAddr");
+
+    BdAddr parsed;
+    Bench::report("fromString", Bench::run([&](uint64_t i) {
+        parsed.fromString(texts[i % kAddresses]);
+        Bench::keep(parsed);
+    }));
+
+    uint8_t out[6];
+    Bench::report("parse", Bench::run([&](uint64_t i) {
+        const std::string& text = texts[i % kAddresses];
+        BdAddr::parse(text.data(), text.size(), out);
+        Bench::keep(out);
+    }));
+
+    std::string invalid = "80:e4:da:71:3b:fg";
+    Bench::report("parse (invalid)", Bench::run([&](uint64_t) {
+        bool ok = BdAddr::parse(invalid.data(), invalid.size(), out);
+        Bench::keep(ok);
+    }));
+
+    Bench::report("toString", Bench::run([&](uint64_t i) {
+        std::string text = addrs[i % kAddresses].toString();
+        Bench::keep(text);
+    }));
+
+    char text[BdAddr::kStringLength];
+    Bench::report("format", Bench::run([&](uint64_t i) {
+        BdAddr::format(addrs[i % kAddresses].data(), text);
+        Bench::keep(text);
+    }));
+
+    OutputBuffer buffer;
+    Bench::report("OutputBuffer::appendBdAddr", Bench::run([&](uint64_t i) {
+        if (buffer.size() > 60000) buffer.clear();
+        buffer.appendBdAddr(addrs[i % kAddresses].data());
+    }));
+    return 0;
+}
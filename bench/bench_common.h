@@ -0,0 +1,99 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+// Shared timing and allocation counting for the benchmarks.
+//
+// Include from exactly one translation unit per benchmark: it replaces the
+// global operator new/delete so every heap allocation in the process,
+// library code included, is counted.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <stdint.h>
+
+namespace Bench {
+
+inline std::atomic<uint64_t>& allocationCounter() {
+    static std::atomic<uint64_t> counter(0);
+    return counter;
+}
+
+inline uint64_t allocations() {
+    return allocationCounter().load(std::memory_order_relaxed);
+}
+
+// Keeps the compiler from discarding a result that is otherwise unused
+template <typename T>
+inline void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Result {
+    uint64_t ops;
+    double seconds;
+    uint64_t allocs;
+};
+
+// Runs fn(i) for i in [0, ops) and measures it
+template <typename Fn>
+Result measure(uint64_t ops, Fn fn) {
+    Result r;
+    r.ops = ops;
+    uint64_t allocsBefore = allocations();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < ops; i++) fn(i);
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    r.allocs = allocations() - allocsBefore;
+    return r;
+}
+
+// Doubles the iteration count until a run takes at least minSeconds, after
+// one untimed pass that warms caches and lets buffers reach their working
+// size, so steady-state allocations/op read as 0
+template <typename Fn>
+Result run(Fn fn, double minSeconds = 0.2) {
+    uint64_t ops = 1000;
+    measure(ops, fn);
+    for (;;) {
+        Result r = measure(ops, fn);
+        if (r.seconds >= minSeconds || ops >= (1ull << 40)) return r;
+        ops *= 2;
+    }
+}
+
+inline void printHeader(const char* title) {
+    std::printf("%s\n%-36s %12s %14s %12s\n", title, "", "ns/op", "ops/s", "allocs/op");
+}
+
+inline void report(const char* name, const Result& r) {
+    double ops = static_cast<double>(r.ops ? r.ops : 1);
+    double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+    std::printf("%-36s %12.1f %14.0f %12.3f\n", name, seconds * 1e9 / ops, ops / seconds,
+                r.allocs / ops);
+}
+
+} // namespace Bench
+
+void* operator new(size_t size) {
+    Bench::allocationCounter().fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+#endif // BENCH_COMMON_H
@@ -0,0 +1,174 @@
+// Frame decoding throughput over a socketpair.
+//
+// A writer thread floods the socket with EvtAdvertisementPacket frames, cut
+// into arbitrarily sized writes so frames regularly straddle segment
+// boundaries. The reader decodes them either the legacy way (one read() for
+// the length, one for the body) or with FrameDecoder (one recv() per wakeup).
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "../client_protocol_packets.h"
+#include "../frame_decoder.h"
+#include "bench_common.h"
+
+using namespace FlicClientProtocol;
+
+namespace {
+
+struct Result {
+    uint64_t events;
+    uint64_t readCalls;
+    uint64_t pollCalls;
+    uint64_t allocs;
+    double seconds;
+};
+
+std::vector<uint8_t> buildStream(size_t events) {
+    EvtAdvertisementPacket evt;
+    std::memset(&evt, 0, sizeof(evt));
+    evt.opcode = EVT_ADVERTISEMENT_PACKET_OPCODE;
+    evt.name_length = 9;
+    std::memcpy(evt.name, "Flic-3bff", 9);
+    evt.rssi = -60;
+
+    std::vector<uint8_t> stream;
+    stream.reserve(events * (sizeof(evt) + 2));
+    for (size_t i = 0; i < events; i++) {
+        evt.bd_addr[0] = static_cast<uint8_t>(i);
+        evt.bd_addr[1] = static_cast<uint8_t>(i >> 8);
+        uint16_t len = sizeof(evt);
+        const uint8_t* hdr = reinterpret_cast<const uint8_t*>(&len);
+        const uint8_t* body = reinterpret_cast<const uint8_t*>(&evt);
+        stream.insert(stream.end(), hdr, hdr + 2);
+        stream.insert(stream.end(), body, body + sizeof(evt));
+    }
+    return stream;
+}
+
+void writer(int fd, const std::vector<uint8_t>* stream) {
+    size_t off = 0;
+    unsigned seed = 1;
+    while (off < stream->size()) {
+        // Chunk sizes between 1 and ~4 KiB, deliberately not frame aligned
+        seed = seed * 1103515245u + 12345u;
+        size_t chunk = 1 + (seed >> 16) % 4096;
+        if (chunk > stream->size() - off) chunk = stream->size() - off;
+        ssize_t n = write(fd, &(*stream)[off], chunk);
+        if (n <= 0) break;
+        off += static_cast<size_t>(n);
+    }
+    shutdown(fd, SHUT_WR);
+}
+
+// Mirrors the previous readPacket(): two read() calls per frame. Short reads
+// are retried here so the comparison completes; the old code dropped the
+// session instead.
+bool readExact(int fd, uint8_t* buf, size_t len, uint64_t& calls) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        calls++;
+        if (n <= 0) return false;
+        got += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+Result runLegacy(int fd) {
+    Result r = {0, 0, 0, 0, 0};
+    uint8_t buf[1024];
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    uint64_t allocsBefore = Bench::allocations();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (;;) {
+        poll(&pfd, 1, -1);
+        r.pollCalls++;
+        uint16_t len;
+        if (!readExact(fd, reinterpret_cast<uint8_t*>(&len), 2, r.readCalls)) break;
+        if (!readExact(fd, buf, len, r.readCalls)) break;
+        r.events++;
+    }
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    r.allocs = Bench::allocations() - allocsBefore;
+    return r;
+}
+
+Result runDecoder(int fd) {
+    Result r = {0, 0, 0, 0, 0};
+    FrameDecoder decoder;
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    uint64_t allocsBefore = Bench::allocations();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (;;) {
+        poll(&pfd, 1, -1);
+        r.pollCalls++;
+        if (decoder.fill(fd) <= 0) break;
+        const uint8_t* frame;
+        size_t len;
+        while (decoder.next(frame, len)) {
+            r.events++;
+        }
+    }
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    r.allocs = Bench::allocations() - allocsBefore;
+    r.readCalls = decoder.recvCount();
+    return r;
+}
+
+void report(const char* name, const Result& r) {
+    double events = static_cast<double>(r.events ? r.events : 1);
+    std::cout << std::left << std::setw(10) << name << std::right
+              << std::setw(10) << r.events << " events"
+              << std::fixed << std::setprecision(4)
+              << std::setw(10) << r.readCalls / events << " reads/event"
+              << std::setw(10) << (r.readCalls + r.pollCalls) / events << " syscalls/event"
+              << std::setprecision(1)
+              << std::setw(8) << r.seconds * 1e9 / events << " ns/event"
+              << std::setprecision(0)
+              << std::setw(12) << r.events / r.seconds << " events/s"
+              << std::setprecision(4)
+              << std::setw(9) << r.allocs / events << " allocs/event" << std::endl;
+}
+
+Result runOnce(Result (*reader)(int), const std::vector<uint8_t>& stream) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        std::exit(1);
+    }
+    std::thread t(writer, sv[1], &stream);
+    Result r = reader(sv[0]);
+    t.join();
+    close(sv[0]);
+    close(sv[1]);
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t events = (argc >= 2) ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    std::vector<uint8_t> stream = buildStream(events);
+
+    std::cout << "Framing " << events << " advertisement packets ("
+              << sizeof(EvtAdvertisementPacket) << " byte body)" << std::endl;
+    report("legacy", runOnce(runLegacy, stream));
+    report("decoder", runOnce(runDecoder, stream));
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Event dispatch through FlicClient, one opcode at a time.
+//
+// Frames are fed with injectFrame(), which runs the same path as a frame
+// read from the socket (handlePacket(), channel bookkeeping, statistics)
+// without the socket. The first table uses the client's no-op observer, so
+// it measures the library alone; the others also format each event in one
+// of flic_client's output formats, with GetInfoResponse carrying verified
+// button lists up to what fits in one frame.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../flic_client.h"
+#include "../event_formatter.h"
+#include "../output_buffer.h"
+#include "bench_common.h"
+
+using namespace FlicClientProtocol;
+
+namespace {
+
+typedef std::vector<uint8_t> Frame;
+
+const uint32_t kConnId = 1;       // has a channel in the client's table
+const uint32_t kOtherConnId = 2;  // does not
+
+template <typename T>
+Frame frameOf(const T& packet) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&packet);
+    return Frame(p, p + sizeof(packet));
+}
+
+// Zeroed packet of type T with its opcode set
+template <typename T>
+T packet(uint8_t opcode) {
+    T p;
+    std::memset(&p, 0, sizeof(p));
+    p.opcode = opcode;
+    return p;
+}
+
+template <typename T>
+Frame buttonFrame(uint8_t opcode, uint8_t clickType) {
+    T evt = packet<T>(opcode);
+    evt.conn_id = kConnId;
+    evt.click_type = clickType;
+    evt.time_diff = 3;
+    return frameOf(evt);
+}
+
+Frame getInfoFrame(size_t buttons) {
+    EvtGetInfoResponse evt = packet<EvtGetInfoResponse>(EVT_GET_INFO_RESPONSE_OPCODE);
+    evt.bluetooth_controller_state = 2;
+    evt.max_pending_connections = 128;
+    evt.max_concurrently_connected_buttons = -1;
+    Frame frame = frameOf(evt);
+    frame.push_back(static_cast<uint8_t>(buttons));
+    frame.push_back(static_cast<uint8_t>(buttons >> 8));
+    for (size_t i = 0; i < buttons; i++) {
+        uint8_t addr[6] = { static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8), 0x3b, 0x71, 0xda, 0x80 };
+        frame.insert(frame.end(), addr, addr + 6);
+    }
+    return frame;
+}
+
+struct Case {
+    const char* name;
+    Frame frame;
+};
+
+std::vector<Case> opcodeCases() {
+    std::vector<Case> cases;
+
+    EvtAdvertisementPacket adv = packet<EvtAdvertisementPacket>(EVT_ADVERTISEMENT_PACKET_OPCODE);
+    adv.name_length = 9;
+    std::memcpy(adv.name, "Flic-3bff", 9);
+    adv.rssi = -60;
+    cases.push_back(Case{ "AdvertisementPacket", frameOf(adv) });
+
+    EvtCreateConnectionChannelResponse created =
+        packet<EvtCreateConnectionChannelResponse>(EVT_CREATE_CONNECTION_CHANNEL_RESPONSE_OPCODE);
+    created.conn_id = kConnId;
+    created.connection_status = Connected;
+    cases.push_back(Case{ "CreateConnectionChannelResponse", frameOf(created) });
+
+    EvtConnectionStatusChanged status =
+        packet<EvtConnectionStatusChanged>(EVT_CONNECTION_STATUS_CHANGED_OPCODE);
+    status.conn_id = kConnId;
+    status.connection_status = Ready;
+    cases.push_back(Case{ "ConnectionStatusChanged", frameOf(status) });
+
+    // For a channel the client does not know, so the table stays as it is
+    EvtConnectionChannelRemoved removed =
+        packet<EvtConnectionChannelRemoved>(EVT_CONNECTION_CHANNEL_REMOVED_OPCODE);
+    removed.conn_id = kOtherConnId;
+    cases.push_back(Case{ "ConnectionChannelRemoved", frameOf(removed) });
+
+    cases.push_back(Case{ "ButtonUpOrDown",
+                          buttonFrame<EvtButtonUpOrDown>(EVT_BUTTON_UP_OR_DOWN_OPCODE, ClickTypeButtonDown) });
+    cases.push_back(Case{ "ButtonClickOrHold",
+                          buttonFrame<EvtButtonClickOrHold>(EVT_BUTTON_CLICK_OR_HOLD_OPCODE, ClickTypeButtonClick) });
+    cases.push_back(Case{ "ButtonSingleOrDoubleClick",
+                          buttonFrame<EvtButtonSingleOrDoubleClick>(EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OPCODE,
+                                                                    ClickTypeButtonSingleClick) });
+    cases.push_back(Case{ "ButtonSingleOrDoubleClickOrHold",
+                          buttonFrame<EvtButtonSingleOrDoubleClickOrHold>(
+                              EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE, ClickTypeButtonHold) });
+
+    cases.push_back(Case{ "NewVerifiedButton",
+                          frameOf(packet<EvtNewVerifiedButton>(EVT_NEW_VERIFIED_BUTTON_OPCODE)) });
+    cases.push_back(Case{ "GetInfoResponse", getInfoFrame(4) });
+    cases.push_back(Case{ "NoSpaceForNewConnection",
+                          frameOf(packet<EvtNoSpaceForNewConnection>(EVT_NO_SPACE_FOR_NEW_CONNECTION_OPCODE)) });
+    cases.push_back(Case{ "GotSpaceForNewConnection",
+                          frameOf(packet<EvtGotSpaceForNewConnection>(EVT_GOT_SPACE_FOR_NEW_CONNECTION_OPCODE)) });
+    cases.push_back(Case{ "BluetoothControllerStateChange",
+                          frameOf(packet<EvtBluetoothControllerStateChange>(
+                              EVT_BLUETOOTH_CONTROLLER_STATE_CHANGE_OPCODE)) });
+    cases.push_back(Case{ "PingResponse", frameOf(packet<EvtPingResponse>(EVT_PING_RESPONSE_OPCODE)) });
+
+    Frame info = frameOf(packet<EvtGetButtonInfoResponse>(EVT_GET_BUTTON_INFO_RESPONSE_OPCODE));
+    const uint8_t tail[] = { 0, 4, 'F', 'l', 'i', 'c', 0, 0, 0, 0, 0, 2, 0, 0, 0, 0 };
+    info.insert(info.end(), tail, tail + sizeof(tail));
+    cases.push_back(Case{ "GetButtonInfoResponse", info });
+
+    cases.push_back(Case{ "ScanWizardFoundPrivateButton",
+                          frameOf(packet<EvtScanWizardFoundPrivateButton>(
+                              EVT_SCAN_WIZARD_FOUND_PRIVATE_BUTTON_OPCODE)) });
+    EvtScanWizardFoundPublicButton found =
+        packet<EvtScanWizardFoundPublicButton>(EVT_SCAN_WIZARD_FOUND_PUBLIC_BUTTON_OPCODE);
+    found.name_length = 4;
+    std::memcpy(found.name, "Flic", 4);
+    cases.push_back(Case{ "ScanWizardFoundPublicButton", frameOf(found) });
+    cases.push_back(Case{ "ScanWizardButtonConnected",
+                          frameOf(packet<EvtScanWizardButtonConnected>(EVT_SCAN_WIZARD_BUTTON_CONNECTED_OPCODE)) });
+    cases.push_back(Case{ "ScanWizardCompleted",
+                          frameOf(packet<EvtScanWizardCompleted>(EVT_SCAN_WIZARD_COMPLETED_OPCODE)) });
+    cases.push_back(Case{ "ButtonDeleted", frameOf(packet<EvtButtonDeleted>(EVT_BUTTON_DELETED_OPCODE)) });
+
+    EvtBatteryStatus battery = packet<EvtBatteryStatus>(EVT_BATTERY_STATUS_OPCODE);
+    battery.listener_id = kConnId;
+    battery.battery_percentage = 80;
+    battery.timestamp = 1700000000;
+    cases.push_back(Case{ "BatteryStatus", frameOf(battery) });
+
+    Frame unknown(1, 0xee);
+    cases.push_back(Case{ "(unknown opcode)", unknown });
+    return cases;
+}
+
+// Formats events into a buffer like flic_client's console does, without
+// writing them anywhere
+class FormattingObserver : public FlicClientObserver {
+public:
+    explicit FormattingObserver(EventFormatter::Format format) {
+        formatter.setFormat(format);
+        formatter.setSource("localhost:5551", 0);
+    }
+
+    void onAdvertisementPacket(const EvtAdvertisementPacket& evt) {
+        formatter.advertisement(buffer, evt);
+    }
+    void onConnectionStatusChanged(const EvtConnectionStatusChanged& evt) {
+        formatter.connectionStatusChanged(buffer, evt);
+    }
+    void onButtonUpOrDown(const EvtButtonUpOrDown& evt) {
+        formatter.buttonEvent(buffer, evt);
+    }
+    void onGetInfoResponse(const EvtGetInfoResponse& evt, const VerifiedButtonList& verifiedButtons) {
+        formatter.getInfoResponse(buffer, evt, verifiedButtons);
+    }
+    void onBatteryStatus(const EvtBatteryStatus& evt) {
+        formatter.batteryStatus(buffer, evt);
+    }
+    // flic_client flushes once per event loop iteration
+    void onDispatchDone() {
+        buffer.clear();
+    }
+
+private:
+    EventFormatter formatter;
+    OutputBuffer buffer;
+};
+
+Bench::Result dispatch(FlicClient& client, const Frame& frame) {
+    return Bench::run([&](uint64_t i) {
+        client.injectFrame(frame.data(), frame.size());
+        if ((i & 63) == 63) client.injectDone();
+    });
+}
+
+} // namespace
+
+int main() {
+    FlicClient client("localhost");
+    client.connectButton(BdAddr("80:e4:da:71:3b:ff"), kConnId);
+
+    std::vector<Case> cases = opcodeCases();
+    Bench::printHeader("Dispatch, no-op observer");
+    for (size_t i = 0; i < cases.size(); i++) {
+        Bench::report(cases[i].name, dispatch(client, cases[i].frame));
+    }
+
+    const char* formatNames[] = { "human", "json", "binary" };
+    for (int f = EventFormatter::Human; f <= EventFormatter::Binary; f++) {
+        FormattingObserver observer(static_cast<EventFormatter::Format>(f));
+        client.setObserver(&observer);
+        std::printf("\n");
+        std::string title = std::string("Dispatch and format, ") + formatNames[f];
+        Bench::printHeader(title.c_str());
+        for (size_t i = 0; i < cases.size(); i++) {
+            const std::string& name = cases[i].name;
+            if (name == "AdvertisementPacket" || name == "ConnectionStatusChanged" ||
+                name == "ButtonUpOrDown" || name == "BatteryStatus") {
+                Bench::report(cases[i].name, dispatch(client, cases[i].frame));
+            }
+        }
+        const size_t sizes[] = { 0, 100, 1000, 10000 };
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            char name[48];
+            std::snprintf(name, sizeof(name), "GetInfoResponse, %zu buttons", sizes[s]);
+            Bench::report(name, dispatch(client, getInfoFrame(sizes[s])));
+        }
+        client.setObserver(nullptr);
+    }
+    return 0;
+}
@@ -0,0 +1,175 @@
+#ifndef BUTTON_INFO_CACHE_H
+#define BUTTON_INFO_CACHE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <stdint.h>
+
+#include "bd_addr.h"
+#include "packet_views.h"
+#include "snapshot_file.h"
+
+// Button metadata from GetButtonInfoResponse, keyed by address.
+//
+// Entries are fixed-size records, so find() is a hash lookup that never
+// allocates and the snapshot file is the records written back to back.
+// Fields longer than their slot are truncated. Requests in flight are
+// tracked per address so that any number of callers asking for the same
+// button cost one CmdGetButtonInfo.
+//
+// Snapshot layout (see snapshot_file.h): SnapshotHeader, then count Entry
+// records.
+class ButtonInfoCache {
+public:
+    struct Entry {
+        uint64_t addr;              // packed address, see packAddress()
+        uint32_t fetchedAt;         // Unix seconds of the response
+        int32_t color;
+        uint32_t firmwareVersion;
+        uint8_t flicVersion;
+        uint8_t uuidLength;
+        uint8_t nameLength;
+        uint8_t serialLength;
+        uint8_t uuid[16];
+        char name[32];
+        char serialNumber[16];
+    };
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t count;
+    };
+
+    ButtonInfoCache() : changeCount(0), savedChanges(0) {}
+
+    const Entry* find(const uint8_t* address) const {
+        EntryMap::const_iterator it = table.find(packAddress(address));
+        return it != table.end() ? &it->second : nullptr;
+    }
+
+    // Records a response and ends the fetch for its address
+    const Entry& store(const uint8_t* address, const ButtonInfoView& info, uint32_t now) {
+        Entry& e = table[packAddress(address)];
+        std::memset(&e, 0, sizeof(e));
+        e.addr = packAddress(address);
+        e.fetchedAt = now;
+        e.color = info.color();
+        e.firmwareVersion = info.firmwareVersion();
+        e.flicVersion = info.flicVersion();
+        e.uuidLength = copyField(info.uuid(), e.uuid, sizeof(e.uuid));
+        e.nameLength = copyField(info.name(), e.name, sizeof(e.name));
+        e.serialLength = copyField(info.serialNumber(), e.serialNumber, sizeof(e.serialNumber));
+        pending.erase(e.addr);
+        changeCount++;
+        return e;
+    }
+
+    void erase(const uint8_t* address) {
+        if (table.erase(packAddress(address))) changeCount++;
+    }
+
+    // Returns true if the caller should send the request, false if one for
+    // the address is already in flight
+    bool beginFetch(const uint8_t* address) {
+        return pending.insert(packAddress(address)).second;
+    }
+
+    // For a request that could not be sent
+    void endFetch(const uint8_t* address) { pending.erase(packAddress(address)); }
+
+    // The server forgets requests when the session ends
+    void clearPending() { pending.clear(); }
+    size_t pendingCount() const { return pending.size(); }
+    bool isPending(const uint8_t* address) const { return pending.count(packAddress(address)) != 0; }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (EntryMap::const_iterator it = table.begin(); it != table.end(); ++it) {
+            fn(it->second);
+        }
+    }
+
+    size_t size() const { return table.size(); }
+
+    // Whether entries changed since the last load() or save()
+    bool dirty() const { return changeCount != savedChanges; }
+
+    // A missing file is an empty cache. Entries in the file replace the
+    // ones in memory for the same address.
+    bool load(const std::string& path, std::string* error) {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            if (errno == ENOENT) return true;
+            return snapshotError(error, "open " + path + ": " + std::strerror(errno));
+        }
+        SnapshotHeader header;
+        std::vector<Entry> entries;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                  std::memcmp(header.magic, magic(), sizeof(header.magic)) == 0 &&
+                  header.version == kVersion && header.count <= kMaxEntries;
+        if (ok) {
+            entries.resize(header.count);
+            ok = header.count == 0 ||
+                 std::fread(&entries[0], sizeof(Entry), header.count, file) == header.count;
+        }
+        std::fclose(file);
+        if (!ok) return snapshotError(error, path + ": not a button info snapshot or truncated");
+
+        table.reserve(table.size() + entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            Entry& e = entries[i];
+            e.uuidLength = std::min<uint8_t>(e.uuidLength, sizeof(e.uuid));
+            e.nameLength = std::min<uint8_t>(e.nameLength, sizeof(e.name));
+            e.serialLength = std::min<uint8_t>(e.serialLength, sizeof(e.serialNumber));
+            table[e.addr] = e;
+        }
+        savedChanges = changeCount;
+        return true;
+    }
+
+    bool save(const std::string& path, std::string* error) {
+        SnapshotWriter file(path);
+        if (!file.open(error)) return false;
+
+        SnapshotHeader header;
+        std::memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = kVersion;
+        header.count = static_cast<uint32_t>(table.size());
+        file.write(&header, sizeof(header));
+        for (EntryMap::const_iterator it = table.begin(); it != table.end(); ++it) {
+            file.write(&it->second, sizeof(Entry));
+        }
+        if (!file.commit(error)) return false;
+        savedChanges = changeCount;
+        return true;
+    }
+
+private:
+    typedef std::unordered_map<uint64_t, Entry> EntryMap;
+
+    static const uint32_t kVersion = 2;  // 2: Entry::addr with packAddress()'s bit 48
+    static const uint32_t kMaxEntries = 1 << 20;  // sanity bound for load()
+
+    EntryMap table;
+    std::unordered_set<uint64_t> pending;
+    uint64_t changeCount;
+    uint64_t savedChanges;
+
+    static const char* magic() { return "FLICBIC1"; }
+
+    template <typename T>
+    static uint8_t copyField(const ButtonInfoView::Field& field, T* out, size_t capacity) {
+        size_t n = std::min(field.size, capacity);
+        std::memcpy(out, field.data, n);
+        return static_cast<uint8_t>(n);
+    }
+};
+
+#endif // BUTTON_INFO_CACHE_H
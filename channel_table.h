@@ -0,0 +1,222 @@
+#ifndef CHANNEL_TABLE_H
+#define CHANNEL_TABLE_H
+
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+// Connection channels of one FlicClient, keyed by conn_id, with a reverse
+// index from button address to conn_id.
+//
+// Both tables are flat arrays with linear probing and backward-shift
+// deletion (no tombstones), sized to a power of two and kept at most 3/4
+// full. Channels are stored inline and addresses as packed 48-bit integers,
+// so lookups touch one or two cache lines and nothing allocates until the
+// table has to grow. Pointers returned by find() stay valid until the next
+// insert() or erase().
+class ChannelTable {
+public:
+    enum Flag {
+        AwaitingReady = 1,  // replayed after a reconnect, not yet Ready
+        Queued = 2,         // waiting for admission, not sent to the server
+        Pending = 4,        // on the server and counting towards its pending limit
+        Provisioning = 8,   // part of a connectAll() run that has not settled
+        BatteryListener = 16  // battery status listener (id = conn_id) on the server
+    };
+
+    struct Channel {
+        uint64_t addr;              // packed address, see packAddress(); 0 = free slot
+        uint64_t lastEventNs;       // monotonic receive time of the last button event
+        uint64_t modeChangedNs;     // when latencyMode was last set
+        uint64_t burstStartNs;      // first press of the current activation burst
+        uint32_t connId;
+        uint32_t events;            // button events received
+        uint32_t disconnects;       // Connected/Ready -> Disconnected transitions
+        int16_t autoDisconnectTime;
+        uint8_t status;             // FlicClientProtocol::ConnectionStatus
+        uint8_t latencyMode;        // FlicClientProtocol::LatencyMode
+        uint8_t flags;
+        uint16_t burstPresses;      // presses since burstStartNs
+        uint16_t profile;           // LatencyPolicy profile index
+
+        void address(uint8_t* out) const { unpackAddress(addr, out); }
+    };
+
+    explicit ChannelTable(size_t expected = 16) : count(0) {
+        reserve(expected);
+    }
+
+    // Sizes both tables for n channels without further allocation
+    void reserve(size_t n) {
+        size_t capacity = 16;
+        while (capacity * 3 < n * 4) capacity *= 2;
+        if (capacity > slots.size()) rehash(capacity);
+    }
+
+    Channel* find(uint32_t connId) {
+        size_t i = probe(connId);
+        return slots[i].addr ? &slots[i] : nullptr;
+    }
+
+    const Channel* find(uint32_t connId) const {
+        return const_cast<ChannelTable*>(this)->find(connId);
+    }
+
+    // A channel to this address, normally the most recently added one
+    Channel* findByAddr(const uint8_t* address) {
+        size_t i = probeIndex(packAddress(address));
+        return index[i].addr ? find(index[i].connId) : nullptr;
+    }
+
+    const Channel* findByAddr(const uint8_t* address) const {
+        return const_cast<ChannelTable*>(this)->findByAddr(address);
+    }
+
+    // Adds a channel, or re-targets an existing conn_id; counters restart
+    Channel& insert(uint32_t connId, const uint8_t* address) {
+        if ((count + 1) * 4 > slots.size() * 3) rehash(slots.size() * 2);
+
+        size_t i = probe(connId);
+        if (slots[i].addr) {
+            unindex(slots[i]);
+        } else {
+            count++;
+        }
+        Channel& channel = slots[i];
+        std::memset(&channel, 0, sizeof(channel));
+        channel.addr = packAddress(address);
+        channel.connId = connId;
+        addIndex(channel.addr, connId);
+        return channel;
+    }
+
+    bool erase(uint32_t connId) {
+        size_t i = probe(connId);
+        if (!slots[i].addr) return false;
+        Channel removed = slots[i];
+        removeSlot(slots, i);
+        count--;
+        unindex(removed);
+        return true;
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) {
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].addr) fn(slots[i]);
+        }
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].addr) fn(slots[i]);
+        }
+    }
+
+    void clear() {
+        std::memset(&slots[0], 0, slots.size() * sizeof(Channel));
+        std::memset(&index[0], 0, index.size() * sizeof(IndexSlot));
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacity() const { return slots.size() * 3 / 4; }
+
+private:
+
+    struct IndexSlot {
+        uint64_t addr;  // packed address; 0 = free slot
+        uint32_t connId;
+    };
+
+    std::vector<Channel> slots;
+    std::vector<IndexSlot> index;
+    size_t count;
+
+    size_t mask() const { return slots.size() - 1; }
+
+    static size_t hashConnId(uint32_t connId) {
+        return static_cast<size_t>((connId * 0x9e3779b97f4a7c15ull) >> 32);
+    }
+
+    static size_t hashAddr(uint64_t key) {
+        key ^= key >> 29;
+        key *= 0xbf58476d1ce4e5b9ull;
+        return static_cast<size_t>(key ^ (key >> 32));
+    }
+
+    // Slot holding connId, or the free slot where it would go
+    size_t probe(uint32_t connId) const {
+        size_t i = hashConnId(connId) & mask();
+        while (slots[i].addr && slots[i].connId != connId) i = (i + 1) & mask();
+        return i;
+    }
+
+    size_t probeIndex(uint64_t key) const {
+        size_t i = hashAddr(key) & mask();
+        while (index[i].addr && index[i].addr != key) i = (i + 1) & mask();
+        return i;
+    }
+
+    void addIndex(uint64_t key, uint32_t connId) {
+        size_t i = probeIndex(key);
+        index[i].addr = key;
+        index[i].connId = connId;
+    }
+
+    // Drops the index entry of a removed channel. If another channel has the
+    // same address it takes over the entry; finding it scans the table, but
+    // only when several channels share an address.
+    void unindex(const Channel& removed) {
+        size_t i = probeIndex(removed.addr);
+        if (!index[i].addr || index[i].connId != removed.connId) return;
+        for (size_t s = 0; s < slots.size(); s++) {
+            if (slots[s].addr == removed.addr && slots[s].connId != removed.connId) {
+                index[i].connId = slots[s].connId;
+                return;
+            }
+        }
+        removeSlot(index, i);
+    }
+
+    static size_t home(const Channel& channel) { return hashConnId(channel.connId); }
+    static size_t home(const IndexSlot& slot) { return hashAddr(slot.addr); }
+
+    // Backward-shift deletion: moves later entries of the probe run into the
+    // hole so lookups never need tombstones
+    template <typename Slot>
+    static void removeSlot(std::vector<Slot>& table, size_t hole) {
+        size_t m = table.size() - 1;
+        size_t i = hole;
+        for (;;) {
+            i = (i + 1) & m;
+            if (!table[i].addr) break;
+            size_t h = home(table[i]) & m;
+            // Movable unless its home lies cyclically in (hole, i]
+            if (((i - h) & m) >= ((i - hole) & m)) {
+                table[hole] = table[i];
+                hole = i;
+            }
+        }
+        std::memset(&table[hole], 0, sizeof(Slot));
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Channel> oldSlots(capacity);
+        oldSlots.swap(slots);
+        index.assign(capacity, IndexSlot());
+        for (size_t i = 0; i < oldSlots.size(); i++) {
+            if (!oldSlots[i].addr) continue;
+            slots[probe(oldSlots[i].connId)] = oldSlots[i];
+            size_t at = probeIndex(oldSlots[i].addr);
+            if (!index[at].addr) {
+                index[at].addr = oldSlots[i].addr;
+                index[at].connId = oldSlots[i].connId;
+            }
+        }
+    }
+};
+
+#endif // CHANNEL_TABLE_H
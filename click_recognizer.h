@@ -0,0 +1,256 @@
+#ifndef CLICK_RECOGNIZER_H
+#define CLICK_RECOGNIZER_H
+
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "client_protocol_packets.h"
+#include "bd_addr.h"
+#include "channel_table.h"
+#include "event_loop.h"
+#include "latency_histogram.h"
+#include "profile_table.h"
+
+// Speculative click recognition from ButtonUpOrDown.
+//
+// flicd reports a single click only once its double click window has
+// passed. For buttons that are never double clicked that wait is pure
+// latency, so the recognizer guesses from the raw events instead: a release
+// within clickMs of the press is a single click, and a press still held
+// after holdMs is a hold. The guess is reported at once and settled when
+// flicd's ButtonSingleOrDoubleClickOrHold arrives: confirmed if flicd says
+// the same, retracted if not (a double click, or a hold for a guessed
+// click), and expired if nothing arrives within confirmMs. A press whose
+// guess is still open does not start another one, so both halves of a
+// double click end up in one retraction.
+//
+// FlicClient feeds the recognizer events, runs the hold and confirm timers
+// and reports to its observer.
+class ClickRecognizer {
+public:
+    struct Profile {
+        bool enabled;
+        uint32_t clickMs;      // longest press taken as a single click
+        uint32_t holdMs;       // press length taken as a hold; 0 = no hold guesses
+        uint32_t confirmMs;    // how long a guess waits for flicd
+
+        Profile() : enabled(true), clickMs(300), holdMs(0), confirmMs(2000) {}
+    };
+
+    enum Outcome {
+        Pending,
+        Confirmed,
+        Retracted,
+        Expired
+    };
+
+    struct Speculation {
+        uint64_t downNs;            // monotonic receive time of the press
+        uint64_t speculatedNs;
+        uint64_t resolvedNs;        // 0 while pending
+        uint32_t connId;
+        uint8_t clickType;          // ClickTypeButtonSingleClick or ClickTypeButtonHold
+        uint8_t outcome;
+        uint8_t actualClickType;    // flicd's verdict, once Confirmed or Retracted
+    };
+
+    struct Stats {
+        uint64_t speculations;
+        uint64_t confirmed;
+        uint64_t retracted;
+        uint64_t expired;
+        uint64_t missed;            // flicd classified a press that was not guessed
+        LatencyHistogram leadMs;    // how much earlier confirmed guesses were reported
+
+        Stats() : speculations(0), confirmed(0), retracted(0), expired(0), missed(0), leadMs(60000) {}
+    };
+
+    // Profile 0, used for buttons without their own
+    Profile& defaultProfile() { return profiles.defaultProfile(); }
+
+    void setProfile(const BdAddr& addr, const Profile& profile) { profiles.set(addr, profile); }
+    uint16_t profileFor(const uint8_t* addr) const { return profiles.indexOf(addr); }
+    const Profile& profile(uint16_t index) const { return profiles.at(index); }
+    size_t profileCount() const { return profiles.size(); }
+
+    // The profile connId's last press used
+    const Profile& profileOf(uint32_t connId) const {
+        StateMap::const_iterator it = states.find(connId);
+        return profile(it != states.end() ? it->second.profile : 0);
+    }
+
+    // A press. Returns the delay for the hold timer in ms, 0 for none.
+    uint32_t onDown(uint32_t connId, const uint8_t* addr, uint64_t nowNs) {
+        uint16_t index = profileFor(addr);
+        const Profile& p = profile(index);
+        if (!p.enabled) return 0;
+        State& s = states[connId];
+        s.profile = index;
+        s.down = true;
+        s.downNs = nowNs;
+        return isOpen(s) ? 0 : p.holdMs;
+    }
+
+    // A release. Returns the new single click guess, if any.
+    const Speculation* onUp(uint32_t connId, uint64_t nowNs) {
+        State* s = find(connId);
+        if (!s || !s->down) return nullptr;
+        s->down = false;
+        if (isOpen(*s) || nowNs - s->downNs > profile(s->profile).clickMs * 1000000ull) return nullptr;
+        return open(*s, connId, FlicClientProtocol::ClickTypeButtonSingleClick, nowNs);
+    }
+
+    // The hold timer of connId fired. Returns the new hold guess, if any.
+    const Speculation* onHoldTimer(uint32_t connId, uint64_t nowNs) {
+        State* s = find(connId);
+        if (!s || !s->down || isOpen(*s)) return nullptr;
+        return open(*s, connId, FlicClientProtocol::ClickTypeButtonHold, nowNs);
+    }
+
+    // flicd's ButtonSingleOrDoubleClickOrHold. Returns the settled guess, if
+    // one was open.
+    const Speculation* onClassified(uint32_t connId, uint8_t clickType, uint64_t nowNs) {
+        State* s = find(connId);
+        if (!s) return nullptr;
+        if (!isOpen(*s)) {
+            counters.missed++;
+            return nullptr;
+        }
+        s->spec.actualClickType = clickType;
+        if (clickType == s->spec.clickType) {
+            counters.leadMs.record((nowNs - s->spec.speculatedNs) / 1000000ull);
+            return close(*s, Confirmed, nowNs);
+        }
+        return close(*s, Retracted, nowNs);
+    }
+
+    // The confirm timer of connId fired
+    const Speculation* onConfirmTimer(uint32_t connId, uint64_t nowNs) {
+        State* s = find(connId);
+        if (!s || !isOpen(*s)) return nullptr;
+        return close(*s, Expired, nowNs);
+    }
+
+    // The timers FlicClient runs for connId (0 when not armed), or null if
+    // connId has no state
+    EventLoop::TimerId* holdTimer(uint32_t connId) {
+        State* s = find(connId);
+        return s ? &s->holdTimer : nullptr;
+    }
+    EventLoop::TimerId* confirmTimer(uint32_t connId) {
+        State* s = find(connId);
+        return s ? &s->confirmTimer : nullptr;
+    }
+
+    // The server connection is gone: no release will come for buttons
+    // that are down. Open guesses still expire through their timers.
+    void releaseAll() {
+        for (StateMap::iterator it = states.begin(); it != states.end(); ++it) it->second.down = false;
+    }
+
+    // Drops connId's state, passing its armed timers to cancel
+    template <typename Fn>
+    void forget(uint32_t connId, Fn cancel) {
+        StateMap::iterator it = states.find(connId);
+        if (it == states.end()) return;
+        if (it->second.holdTimer) cancel(it->second.holdTimer);
+        if (it->second.confirmTimer) cancel(it->second.confirmTimer);
+        states.erase(it);
+    }
+
+    // Drops all state, passing every armed timer to cancel
+    template <typename Fn>
+    void clear(Fn cancel) {
+        for (StateMap::iterator it = states.begin(); it != states.end(); ++it) {
+            if (it->second.holdTimer) cancel(it->second.holdTimer);
+            if (it->second.confirmTimer) cancel(it->second.confirmTimer);
+        }
+        states.clear();
+    }
+
+    const Stats& stats() const { return counters; }
+
+    // Reads a profile file (see ProfileTable::load) of key=value settings
+    // or "off". Address lines are on unless they say "off".
+    //   default off
+    //   80:e4:da:71:3b:ff click_ms=250 hold_ms=600
+    // Keys: click_ms, hold_ms (0 = no hold guesses), confirm_ms.
+    bool load(const std::string& path, std::string* error) {
+        return profiles.load(path, error, apply,
+            [](const Profile& p) -> const char* {
+                return p.holdMs != 0 && p.holdMs <= p.clickMs ? "hold_ms must be above click_ms" : nullptr;
+            },
+            [](Profile& p) { p.enabled = true; });
+    }
+
+private:
+    struct State {
+        uint16_t profile;
+        uint64_t downNs;
+        EventLoop::TimerId holdTimer;
+        EventLoop::TimerId confirmTimer;
+        Speculation spec;
+        bool down;
+
+        State() : profile(0), downNs(0), holdTimer(0), confirmTimer(0), down(false) {
+            spec.speculatedNs = 0;
+            spec.outcome = Expired;
+        }
+    };
+
+    typedef std::unordered_map<uint32_t, State> StateMap;
+
+    ProfileTable<Profile> profiles;
+    StateMap states;                                // by conn_id
+    Stats counters;
+
+    State* find(uint32_t connId) {
+        StateMap::iterator it = states.find(connId);
+        return it != states.end() ? &it->second : nullptr;
+    }
+
+    static bool isOpen(const State& s) { return s.spec.outcome == Pending; }
+
+    const Speculation* open(State& s, uint32_t connId, uint8_t clickType, uint64_t nowNs) {
+        s.spec.downNs = s.downNs;
+        s.spec.speculatedNs = nowNs;
+        s.spec.resolvedNs = 0;
+        s.spec.connId = connId;
+        s.spec.clickType = clickType;
+        s.spec.outcome = Pending;
+        s.spec.actualClickType = clickType;
+        counters.speculations++;
+        return &s.spec;
+    }
+
+    const Speculation* close(State& s, Outcome outcome, uint64_t nowNs) {
+        s.spec.outcome = static_cast<uint8_t>(outcome);
+        s.spec.resolvedNs = nowNs;
+        if (outcome == Confirmed) counters.confirmed++;
+        else if (outcome == Retracted) counters.retracted++;
+        else counters.expired++;
+        return &s.spec;
+    }
+
+    static bool apply(Profile& p, const std::string& setting) {
+        if (setting == "off") {
+            p.enabled = false;
+            return true;
+        }
+        size_t eq = setting.find('=');
+        if (eq == std::string::npos || eq + 1 == setting.size()) return false;
+        std::string key = setting.substr(0, eq);
+        char* end;
+        unsigned long long number = std::strtoull(setting.c_str() + eq + 1, &end, 10);
+        if (*end != '\0' || number > 60000) return false;
+        if (key == "click_ms" && number > 0) p.clickMs = static_cast<uint32_t>(number);
+        else if (key == "hold_ms") p.holdMs = static_cast<uint32_t>(number);
+        else if (key == "confirm_ms" && number > 0) p.confirmMs = static_cast<uint32_t>(number);
+        else return false;
+        return true;
+    }
+};
+
+#endif // CLICK_RECOGNIZER_H
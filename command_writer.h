@@ -0,0 +1,162 @@
+#ifndef COMMAND_WRITER_H
+#define COMMAND_WRITER_H
+
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Outbound command queue for a non-blocking socket.
+//
+// Outside a batch, a command is sent straight away with one sendmsg() whose
+// iovec holds the length header and the body. Inside beginBatch()/commit(),
+// frames are serialized back to back into one contiguous buffer and the whole
+// batch goes out with a single sendmsg() on commit. Whatever the kernel does
+// not accept (partial write or EAGAIN) stays queued, later commands are
+// appended behind it, and flush() resumes once the socket is writable again.
+class CommandWriter {
+public:
+    // Refuse to buffer more than this while the peer is not reading
+    static const size_t kDefaultMaxQueued = 4 * 1024 * 1024;
+
+    explicit CommandWriter(size_t maxQueued = kDefaultMaxQueued)
+        : fd(-1), maxQueued(maxQueued), offset(0), batchDepth(0),
+          framesQueued(0), sendCalls(0), bytesSent(0), partialWrites(0), wouldBlock(0) {}
+
+    // Starts writing to a (new) socket, dropping anything still queued
+    void attach(int sockfd) {
+        fd = sockfd;
+        queue.clear();
+        offset = 0;
+        batchDepth = 0;
+    }
+
+    // Queues one frame. Returns false on a fatal socket error or overflow.
+    bool send(const void* data, size_t len) {
+        if (len > 0xffff) {
+            errno = EMSGSIZE;
+            return false;
+        }
+        framesQueued++;
+        uint8_t header[2] = { static_cast<uint8_t>(len), static_cast<uint8_t>(len >> 8) };
+
+        if (batchDepth == 0 && !pending()) {
+            struct iovec iov[2];
+            iov[0].iov_base = header;
+            iov[0].iov_len = 2;
+            iov[1].iov_base = const_cast<void*>(data);
+            iov[1].iov_len = len;
+            ssize_t n = sendv(iov, 2);
+            if (n < 0) {
+                if (!isTransient(errno)) return false;
+                n = 0;
+            }
+            size_t done = static_cast<size_t>(n);
+            if (done == len + 2) return true;
+
+            // Keep the unsent tail, in order
+            partialWrites++;
+            if (done < 2) append(header + done, 2 - done);
+            size_t bodyDone = done > 2 ? done - 2 : 0;
+            append(static_cast<const uint8_t*>(data) + bodyDone, len - bodyDone);
+            return true;
+        }
+
+        if (queue.size() - offset + len + 2 > maxQueued) {
+            errno = ENOBUFS;
+            return false;
+        }
+        append(header, 2);
+        append(static_cast<const uint8_t*>(data), len);
+        return batchDepth > 0 ? true : flush();
+    }
+
+    // Opens a batch; batches nest and only the outermost commit() flushes
+    void beginBatch() { batchDepth++; }
+
+    bool commit() {
+        if (batchDepth > 0) batchDepth--;
+        return batchDepth > 0 ? true : flush();
+    }
+
+    // Writes as much of the queue as the socket accepts. Returns false only on
+    // a fatal error; check pending() to see whether POLLOUT is still needed.
+    bool flush() {
+        while (pending()) {
+            struct iovec iov;
+            iov.iov_base = &queue[offset];
+            iov.iov_len = queue.size() - offset;
+            ssize_t n = sendv(&iov, 1);
+            if (n < 0) {
+                return isTransient(errno);
+            }
+            offset += static_cast<size_t>(n);
+            if (offset < queue.size()) {
+                partialWrites++;
+            }
+        }
+        queue.clear();
+        offset = 0;
+        return true;
+    }
+
+    bool pending() const { return offset < queue.size(); }
+    bool inBatch() const { return batchDepth > 0; }
+    size_t queuedBytes() const { return queue.size() - offset; }
+
+    uint64_t frameCount() const { return framesQueued; }
+    uint64_t sendCount() const { return sendCalls; }
+    uint64_t byteCount() const { return bytesSent; }
+    uint64_t partialCount() const { return partialWrites; }
+    uint64_t wouldBlockCount() const { return wouldBlock; }
+
+private:
+    int fd;
+    size_t maxQueued;
+    std::vector<uint8_t> queue;
+    size_t offset;
+    int batchDepth;
+
+    uint64_t framesQueued;
+    uint64_t sendCalls;
+    uint64_t bytesSent;
+    uint64_t partialWrites;
+    uint64_t wouldBlock;
+
+    static bool isTransient(int err) {
+        return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+    }
+
+    ssize_t sendv(struct iovec* iov, size_t count) {
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        sendCalls++;
+        if (n > 0) {
+            bytesSent += static_cast<uint64_t>(n);
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            wouldBlock++;
+        }
+        return n;
+    }
+
+    void append(const uint8_t* data, size_t len) {
+        // Reclaim the already-sent prefix before growing
+        if (offset > 0 && offset == queue.size()) {
+            queue.clear();
+            offset = 0;
+        } else if (offset > 4096 && offset * 2 > queue.size()) {
+            queue.erase(queue.begin(), queue.begin() + offset);
+            offset = 0;
+        }
+        queue.insert(queue.end(), data, data + len);
+    }
+};
+
+#endif // COMMAND_WRITER_H
@@ -0,0 +1,573 @@
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "client_protocol_packets.h"
+#include "bd_addr.h"
+#include "event_formatter.h"
+#include "event_loop.h"
+#include "output_buffer.h"
+#include "packet_views.h"
+
+// Local fan-out of event packets over a UNIX domain socket.
+//
+// Subscribers connect to the socket and send text lines:
+//   format json|binary      encoding of what follows (default json, see EventFormatter)
+//   subscribe [bd_addr=A[,B...]] [conn_id=N[,M...]] [event=Name[,Name...]]
+//                           adds a filter; one without keys matches everything
+//   unsubscribe             drops all filters
+// An event goes to a subscriber when one of its filters matches, i.e. the
+// event has one of the listed values for every key the filter sets. Event
+// names are the JSON ones (ButtonUpOrDown, ConnectionStatusChanged, ...).
+// A line the bus does not understand closes the subscriber.
+//
+// publish() encodes an event at most once per encoding, into a pooled
+// message that the queue of every matching subscriber references; the last
+// reference returns it to the pool. A per-opcode index skips subscribers
+// that want none of the event's kind. flush() writes each subscriber's new
+// messages with one sendmsg(), so a read from the server costs one write
+// per interested subscriber however many events it carried. A subscriber
+// whose queue is full (setQueueLimit) loses the events that do not fit,
+// counted, and never holds up the others or the loop. Loop thread only.
+class EventBus {
+public:
+    enum Encoding {
+        Json,
+        Binary,
+        kEncodingCount
+    };
+
+    // A packet and the button it concerns, see describe()
+    struct Event {
+        const uint8_t* data;
+        size_t len;
+        uint32_t connId;
+        bool hasConnId;
+        const uint8_t* addr;    // null if unknown
+    };
+
+    struct Stats {
+        uint64_t accepted;
+        uint64_t rejected;      // over kMaxSubscribers, or closed for a bad line
+        uint64_t published;     // events that matched at least one subscriber
+        uint64_t encoded;       // messages encoded, at most one per encoding per event
+        uint64_t queued;        // message references queued to subscribers
+        uint64_t dropped;       // references that did not fit a subscriber's queue
+        uint64_t writes;        // sendmsg() calls
+        uint64_t bytes;
+    };
+
+    static const size_t kMaxSubscribers = 1024;
+
+    explicit EventBus(EventLoop& loop)
+        : loop(loop), listenFd(-1), queueLimit(1024 * 1024), liveCount(0), closedCount(0) {
+        std::memset(&counters, 0, sizeof(counters));
+        formatters[Json].setFormat(EventFormatter::Json);
+        formatters[Binary].setFormat(EventFormatter::Binary);
+    }
+
+    ~EventBus() {
+        for (size_t i = 0; i < subscribers.size(); i++) closeSubscriber(*subscribers[i]);
+        subscribers.clear();
+        for (size_t i = 0; i < pool.size(); i++) delete pool[i];
+        if (listenFd < 0) return;
+        loop.removeFd(listenFd);
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+
+    // Creates the socket at path, replacing a socket left there by an
+    // earlier run, and starts accepting subscribers
+    bool listen(const std::string& path, std::string* error) {
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            return fail(error, "socket path too long: " + path);
+        }
+        std::memcpy(addr.sun_path, path.data(), path.size());
+
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return fail(error, std::string("socket: ") + std::strerror(errno));
+        if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            ::listen(fd, 128) < 0) {
+            int err = errno;
+            close(fd);
+            return fail(error, path + ": " + std::strerror(err));
+        }
+        if (!loop.addFd(fd, EPOLLIN, [this](uint32_t) { acceptSubscribers(); })) {
+            close(fd);
+            return fail(error, path + ": cannot watch socket");
+        }
+        listenFd = fd;
+        socketPath = path;
+        return true;
+    }
+
+    // Source tag and index for the encoded records, as in EventFormatter
+    void setSource(const std::string& tag, uint16_t id) {
+        for (int i = 0; i < kEncodingCount; i++) formatters[i].setSource(tag, id);
+    }
+
+    // Bytes a subscriber may have waiting before events are dropped for it
+    void setQueueLimit(size_t bytes) { queueLimit = bytes; }
+
+    // Whether any subscriber has a filter for packets with this opcode;
+    // lets the caller skip describing the rest
+    bool wants(uint8_t opcode) const {
+        return opcode < kOpcodes && !byOpcode[opcode].empty();
+    }
+
+    // The conn_id (battery listener ids are conn_ids in FlicClient) and
+    // address a packet carries; the caller may fill in addr from the channel
+    static Event describe(const uint8_t* data, size_t len) {
+        using namespace FlicClientProtocol;
+        Event e;
+        e.data = data;
+        e.len = len;
+        e.connId = 0;
+        e.hasConnId = false;
+        e.addr = nullptr;
+        if (len == 0) return e;
+        switch (data[0]) {
+            case EVT_CREATE_CONNECTION_CHANNEL_RESPONSE_OPCODE:
+            case EVT_CONNECTION_STATUS_CHANGED_OPCODE:
+            case EVT_CONNECTION_CHANNEL_REMOVED_OPCODE:
+            case EVT_BUTTON_UP_OR_DOWN_OPCODE:
+            case EVT_BUTTON_CLICK_OR_HOLD_OPCODE:
+            case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OPCODE:
+            case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE:
+            case EVT_BATTERY_STATUS_OPCODE:
+                if (len >= 5) {
+                    std::memcpy(&e.connId, data + 1, sizeof(e.connId));
+                    e.hasConnId = true;
+                }
+                break;
+            default:
+                break;
+        }
+        switch (data[0]) {
+            case EVT_ADVERTISEMENT_PACKET_OPCODE:
+                if (const EvtAdvertisementPacket* evt = packetAs<EvtAdvertisementPacket>(data, len)) {
+                    e.addr = evt->bd_addr;
+                }
+                break;
+            case EVT_CONNECTION_STATUS_CHANGED_OPCODE:
+                if (const EvtConnectionStatusChanged* evt = packetAs<EvtConnectionStatusChanged>(data, len)) {
+                    e.addr = evt->bd_addr;
+                }
+                break;
+            case EVT_NEW_VERIFIED_BUTTON_OPCODE:
+                if (const EvtNewVerifiedButton* evt = packetAs<EvtNewVerifiedButton>(data, len)) {
+                    e.addr = evt->bd_addr;
+                }
+                break;
+            case EVT_GET_BUTTON_INFO_RESPONSE_OPCODE:
+                if (const EvtGetButtonInfoResponse* evt = packetAs<EvtGetButtonInfoResponse>(data, len)) {
+                    e.addr = evt->bd_addr;
+                }
+                break;
+            case EVT_SCAN_WIZARD_FOUND_PUBLIC_BUTTON_OPCODE:
+                if (const EvtScanWizardFoundPublicButton* evt =
+                        packetAs<EvtScanWizardFoundPublicButton>(data, len)) {
+                    e.addr = evt->bd_addr;
+                }
+                break;
+            case EVT_BUTTON_DELETED_OPCODE:
+                if (const EvtButtonDeleted* evt = packetAs<EvtButtonDeleted>(data, len)) {
+                    e.addr = evt->bd_addr;
+                }
+                break;
+            default:
+                break;
+        }
+        return e;
+    }
+
+    // Queues the event for every subscriber with a matching filter
+    void publish(const Event& e) {
+        if (e.len == 0 || !wants(e.data[0])) return;
+        const std::vector<Subscriber*>& candidates = byOpcode[e.data[0]];
+        uint64_t key = e.addr ? packAddress(e.addr) : 0;
+        Message* encoded[kEncodingCount] = { nullptr, nullptr };
+        for (size_t i = 0; i < candidates.size(); i++) {
+            Subscriber& s = *candidates[i];
+            if (!matches(s, e, key)) continue;
+            Message*& m = encoded[s.encoding];
+            if (!m) {
+                m = acquire();
+                formatters[s.encoding].packet(m->bytes, e.data, e.len);
+                counters.encoded++;
+            }
+            enqueue(s, m);
+        }
+        bool delivered = false;
+        for (int i = 0; i < kEncodingCount; i++) {
+            if (!encoded[i]) continue;
+            delivered = true;
+            if (encoded[i]->refs == 0) release(encoded[i]);
+        }
+        if (delivered) counters.published++;
+    }
+
+    // Writes what publish() queued since the last flush
+    void flush() {
+        for (size_t i = 0; i < dirty.size(); i++) {
+            Subscriber& s = *dirty[i];
+            s.dirty = false;
+            if (!s.closed) writeQueued(s);
+        }
+        dirty.clear();
+        if (closedCount) reap();
+    }
+
+    const Stats& stats() const { return counters; }
+    size_t subscriberCount() const { return liveCount; }
+    const std::string& path() const { return socketPath; }
+
+    // Bytes waiting in all subscriber queues, and the most one subscriber has
+    size_t queuedBytes(size_t* largest = nullptr) const {
+        size_t total = 0;
+        size_t most = 0;
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            total += subscribers[i]->queuedBytes;
+            most = std::max(most, subscribers[i]->queuedBytes);
+        }
+        if (largest) *largest = most;
+        return total;
+    }
+
+private:
+    static const uint8_t kOpcodes = 32;
+    static const size_t kMaxIov = 64;
+    static const size_t kMaxLine = 4096;
+    static const size_t kMaxPooled = 1024;
+
+    struct Message {
+        unsigned refs;
+        OutputBuffer bytes;
+
+        Message() : refs(0), bytes(256) {}
+    };
+
+    struct Filter {
+        uint32_t events;                // opcode bits
+        std::vector<uint64_t> addrs;    // packed, sorted; empty = any
+        std::vector<uint32_t> connIds;  // sorted; empty = any
+    };
+
+    struct Subscriber {
+        int fd;
+        uint8_t encoding;
+        bool closed;
+        bool dirty;                     // in the flush list
+        bool wantWrite;                 // EPOLLOUT armed after a short write
+        std::vector<Filter> filters;
+        std::deque<Message*> queue;
+        size_t headOffset;              // bytes of queue.front() already sent
+        size_t queuedBytes;
+        std::string input;
+
+        explicit Subscriber(int fd)
+            : fd(fd), encoding(Json), closed(false), dirty(false), wantWrite(false),
+              headOffset(0), queuedBytes(0) {}
+    };
+
+    EventLoop& loop;
+    int listenFd;
+    std::string socketPath;
+    EventFormatter formatters[kEncodingCount];
+    size_t queueLimit;
+
+    std::vector<std::unique_ptr<Subscriber> > subscribers;
+    std::vector<Subscriber*> byOpcode[kOpcodes];    // subscribers with a filter for the opcode
+    std::vector<Subscriber*> dirty;
+    std::vector<Message*> pool;
+    size_t liveCount;
+    size_t closedCount;                             // closed, not yet reaped
+    Stats counters;
+
+    Message* acquire() {
+        if (pool.empty()) return new Message();
+        Message* m = pool.back();
+        pool.pop_back();
+        return m;
+    }
+
+    void release(Message* m) {
+        if (pool.size() >= kMaxPooled) {
+            delete m;
+            return;
+        }
+        m->bytes.clear();
+        pool.push_back(m);
+    }
+
+    void unref(Message* m) {
+        if (--m->refs == 0) release(m);
+    }
+
+    static bool matches(const Subscriber& s, const Event& e, uint64_t key) {
+        uint32_t bit = 1u << e.data[0];
+        for (size_t i = 0; i < s.filters.size(); i++) {
+            const Filter& f = s.filters[i];
+            if (!(f.events & bit)) continue;
+            if (!f.connIds.empty() &&
+                (!e.hasConnId || !std::binary_search(f.connIds.begin(), f.connIds.end(), e.connId))) {
+                continue;
+            }
+            if (!f.addrs.empty() &&
+                (!e.addr || !std::binary_search(f.addrs.begin(), f.addrs.end(), key))) {
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void enqueue(Subscriber& s, Message* m) {
+        if (s.queuedBytes + m->bytes.size() > queueLimit) {
+            counters.dropped++;
+            return;
+        }
+        m->refs++;
+        s.queue.push_back(m);
+        s.queuedBytes += m->bytes.size();
+        counters.queued++;
+        // After a short write the queue drains on EPOLLOUT instead
+        if (!s.dirty && !s.wantWrite) {
+            s.dirty = true;
+            dirty.push_back(&s);
+        }
+    }
+
+    void writeQueued(Subscriber& s) {
+        while (!s.queue.empty()) {
+            struct iovec iov[kMaxIov];
+            size_t count = 0;
+            size_t total = 0;
+            for (std::deque<Message*>::const_iterator it = s.queue.begin();
+                 it != s.queue.end() && count < kMaxIov; ++it, ++count) {
+                size_t offset = count == 0 ? s.headOffset : 0;
+                iov[count].iov_base = const_cast<char*>((*it)->bytes.bytes() + offset);
+                iov[count].iov_len = (*it)->bytes.size() - offset;
+                total += iov[count].iov_len;
+            }
+            struct msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = sendmsg(s.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return setWantWrite(s, true);
+                return closeSubscriber(s);
+            }
+            counters.writes++;
+            counters.bytes += static_cast<uint64_t>(n);
+            consume(s, static_cast<size_t>(n));
+            if (static_cast<size_t>(n) < total) return setWantWrite(s, true);
+        }
+        setWantWrite(s, false);
+    }
+
+    void consume(Subscriber& s, size_t n) {
+        s.queuedBytes -= n;
+        while (n > 0) {
+            Message* m = s.queue.front();
+            size_t remaining = m->bytes.size() - s.headOffset;
+            if (n < remaining) {
+                s.headOffset += n;
+                return;
+            }
+            n -= remaining;
+            s.headOffset = 0;
+            s.queue.pop_front();
+            unref(m);
+        }
+    }
+
+    void setWantWrite(Subscriber& s, bool on) {
+        if (s.wantWrite == on) return;
+        s.wantWrite = on;
+        loop.modifyFd(s.fd, on ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    }
+
+    void acceptSubscribers() {
+        for (;;) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            if (liveCount >= kMaxSubscribers) {
+                close(fd);
+                counters.rejected++;
+                continue;
+            }
+            std::unique_ptr<Subscriber> s(new Subscriber(fd));
+            Subscriber* raw = s.get();
+            if (!loop.addFd(fd, EPOLLIN, [this, raw](uint32_t events) { onSubscriberEvent(*raw, events); })) {
+                close(fd);
+                continue;
+            }
+            subscribers.push_back(std::move(s));
+            liveCount++;
+            counters.accepted++;
+        }
+    }
+
+    void onSubscriberEvent(Subscriber& s, uint32_t events) {
+        if (events & EPOLLOUT) writeQueued(s);
+        if (!s.closed && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) readCommands(s);
+        if (closedCount && dirty.empty()) reap();
+    }
+
+    void readCommands(Subscriber& s) {
+        char buf[1024];
+        ssize_t n = read(s.fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        if (n <= 0) return closeSubscriber(s);
+        s.input.append(buf, static_cast<size_t>(n));
+
+        size_t start = 0;
+        size_t nl;
+        while ((nl = s.input.find('\n', start)) != std::string::npos) {
+            if (!command(s, s.input.substr(start, nl - start))) {
+                counters.rejected++;
+                return closeSubscriber(s);
+            }
+            start = nl + 1;
+        }
+        s.input.erase(0, start);
+        if (s.input.size() > kMaxLine) {
+            counters.rejected++;
+            closeSubscriber(s);
+        }
+    }
+
+    bool command(Subscriber& s, const std::string& line) {
+        std::istringstream iss(line);
+        std::string cmd;
+        if (!(iss >> cmd)) return true;
+        if (cmd == "format") {
+            std::string name;
+            iss >> name;
+            if (name == "json") s.encoding = Json;
+            else if (name == "binary") s.encoding = Binary;
+            else return false;
+            return true;
+        }
+        if (cmd == "unsubscribe") {
+            s.filters.clear();
+            rebuildIndex();
+            return true;
+        }
+        if (cmd != "subscribe") return false;
+
+        Filter f;
+        f.events = 0;
+        std::string setting;
+        while (iss >> setting) {
+            size_t eq = setting.find('=');
+            if (eq == std::string::npos) return false;
+            std::string key = setting.substr(0, eq);
+            std::istringstream values(setting.substr(eq + 1));
+            std::string value;
+            while (std::getline(values, value, ',')) {
+                if (key == "bd_addr") {
+                    BdAddr addr;
+                    if (!addr.fromString(value)) return false;
+                    f.addrs.push_back(packAddress(addr.data()));
+                } else if (key == "conn_id") {
+                    char* end;
+                    unsigned long id = std::strtoul(value.c_str(), &end, 10);
+                    if (value.empty() || *end != '\0' || id > UINT32_MAX) return false;
+                    f.connIds.push_back(static_cast<uint32_t>(id));
+                } else if (key == "event") {
+                    uint32_t bit = eventBit(value);
+                    if (!bit) return false;
+                    f.events |= bit;
+                } else {
+                    return false;
+                }
+            }
+        }
+        if (f.events == 0) f.events = ~0u;
+        std::sort(f.addrs.begin(), f.addrs.end());
+        std::sort(f.connIds.begin(), f.connIds.end());
+        s.filters.push_back(f);
+        rebuildIndex();
+        return true;
+    }
+
+    static uint32_t eventBit(const std::string& name) {
+        for (uint8_t op = 0; op < kOpcodes; op++) {
+            if (name == EventFormatter::eventName(op)) return 1u << op;
+        }
+        return 0;
+    }
+
+    void rebuildIndex() {
+        for (uint8_t op = 0; op < kOpcodes; op++) byOpcode[op].clear();
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            Subscriber* s = subscribers[i].get();
+            if (s->closed) continue;
+            uint32_t events = 0;
+            for (size_t f = 0; f < s->filters.size(); f++) events |= s->filters[f].events;
+            for (uint8_t op = 0; op < kOpcodes; op++) {
+                if (events & (1u << op)) byOpcode[op].push_back(s);
+            }
+        }
+    }
+
+    // Stops everything for s; the object goes away in reap()
+    void closeSubscriber(Subscriber& s) {
+        if (s.closed) return;
+        s.closed = true;
+        loop.removeFd(s.fd);
+        close(s.fd);
+        for (size_t i = 0; i < s.queue.size(); i++) unref(s.queue[i]);
+        s.queue.clear();
+        s.queuedBytes = 0;
+        liveCount--;
+        closedCount++;
+        if (!s.filters.empty()) rebuildIndex();
+    }
+
+    // Frees closed subscribers; none may be in the flush list
+    void reap() {
+        size_t kept = 0;
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            if (!subscribers[i]->closed) std::swap(subscribers[kept++], subscribers[i]);
+        }
+        subscribers.resize(kept);
+        closedCount = 0;
+    }
+
+    static bool fail(std::string* error, const std::string& what) {
+        if (error) *error = what;
+        return false;
+    }
+};
+
+#endif // EVENT_BUS_H
@@ -0,0 +1,924 @@
+#ifndef EVENT_FORMATTER_H
+#define EVENT_FORMATTER_H
+
+#include <string>
+#include <ctime>
+#include <stdint.h>
+
+#include "client_protocol_packets.h"
+#include "advertisement_table.h"
+#include "battery_monitor.h"
+#include "click_recognizer.h"
+#include "output_buffer.h"
+#include "packet_views.h"
+
+// Formats flicd events into an OutputBuffer without allocating.
+//
+// Human is the classic one-line-per-event text. Json writes one JSON object
+// per line with a wall-clock timestamp and the source endpoint. Binary writes
+// a BinaryRecordHeader followed by the event packet exactly as flicd sent it,
+// so consumers decode it with client_protocol_packets.h.
+class EventFormatter {
+public:
+    enum Format {
+        Human,
+        Json,
+        Binary
+    };
+
+#pragma pack(push, 1)
+    struct BinaryRecordHeader {
+        uint16_t length;       // packet bytes following the header
+        uint16_t source;       // endpoint index (hub mode), 0 otherwise
+        uint64_t timestampUs;  // CLOCK_REALTIME
+    };
+#pragma pack(pop)
+
+    EventFormatter() : fmt(Human), sourceId(0) {}
+
+    static bool parseFormat(const std::string& name, Format& format) {
+        if (name == "human") format = Human;
+        else if (name == "json") format = Json;
+        else if (name == "binary") format = Binary;
+        else return false;
+        return true;
+    }
+
+    void setFormat(Format format) { fmt = format; }
+    Format format() const { return fmt; }
+
+    void setSource(const std::string& tag, uint16_t id) {
+        sourceTag = tag;
+        sourceId = id;
+    }
+
+    uint16_t sourceIndex() const { return sourceId; }
+
+    void advertisement(OutputBuffer& out, const FlicClientProtocol::EvtAdvertisementPacket& evt) {
+        size_t nameLen = evt.name_length < sizeof(evt.name) ? evt.name_length : sizeof(evt.name);
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "Advertisement");
+            field(out, "scan_id", evt.scan_id);
+            addressField(out, "bd_addr", evt.bd_addr);
+            key(out, "name");
+            out.append('"');
+            out.appendJsonEscaped(evt.name, nameLen);
+            out.append('"');
+            signedField(out, "rssi", evt.rssi);
+            boolField(out, "is_private", evt.is_private);
+            boolField(out, "already_verified", evt.already_verified);
+            return end(out);
+        }
+        out.append("Advertisement: ");
+        out.appendBdAddr(evt.bd_addr);
+        out.append(" Name: ");
+        out.append(evt.name, nameLen);
+        out.append(" RSSI: ");
+        out.appendInt(evt.rssi);
+        out.append(" dBm Private: ");
+        out.append(evt.is_private ? "yes\n" : "no\n");
+    }
+
+    // Aggregated advertisements. Binary records carry the entry's latest
+    // packet with the smoothed RSSI; lost buttons have no binary record.
+    void advertisementChange(OutputBuffer& out, const AdvertisementTable::Entry& entry,
+                             unsigned changes, uint64_t nowMs) {
+        if (fmt == Binary) {
+            if (changes & AdvertisementTable::Lost) return;
+            FlicClientProtocol::EvtAdvertisementPacket evt = entry.last;
+            evt.rssi = entry.rssi();
+            return binary(out, &evt, sizeof(evt));
+        }
+        if (fmt == Json) {
+            begin(out, "AdvertisementChanged");
+            key(out, "changes");
+            out.append('[');
+            const char* separator = "";
+            for (unsigned bit = 0; changeName(bit); bit++) {
+                if (!(changes & (1u << bit))) continue;
+                out.append(separator);
+                out.append('"');
+                out.append(changeName(bit));
+                out.append('"');
+                separator = ",";
+            }
+            out.append(']');
+            advertisementFields(out, entry, nowMs);
+            return end(out);
+        }
+        out.append("Advertisement ");
+        if (changes & AdvertisementTable::Lost) {
+            out.append("lost: ");
+        } else if (changes & AdvertisementTable::New) {
+            out.append("new: ");
+        } else {
+            out.append("changed: ");
+        }
+        advertisementText(out, entry);
+        out.append('\n');
+    }
+
+    // One line (human) or record (json) per button that advertised during
+    // the digest window
+    void advertisementDigest(OutputBuffer& out, const AdvertisementTable& table, uint64_t nowMs) {
+        if (fmt == Binary) {
+            table.forEach([this, &out](const AdvertisementTable::Entry& entry) {
+                if (entry.windowPackets > 0) advertisementChange(out, entry, 0, 0);
+            });
+            return;
+        }
+        if (fmt == Json) {
+            table.forEach([this, &out, nowMs](const AdvertisementTable::Entry& entry) {
+                if (entry.windowPackets == 0) return;
+                begin(out, "AdvertisementDigest");
+                field(out, "window_packets", entry.windowPackets);
+                advertisementFields(out, entry, nowMs);
+                end(out);
+            });
+            return;
+        }
+        size_t active = 0;
+        table.forEach([&active](const AdvertisementTable::Entry& entry) {
+            if (entry.windowPackets > 0) active++;
+        });
+        out.append("Advertisement digest: ");
+        out.appendUInt(active);
+        out.append(" of ");
+        out.appendUInt(table.size());
+        out.append(" buttons active\n");
+        table.forEach([&out](const AdvertisementTable::Entry& entry) {
+            if (entry.windowPackets == 0) return;
+            out.append("  ");
+            advertisementText(out, entry);
+            out.append(" Packets: ");
+            out.appendUInt(entry.windowPackets);
+            out.append('\n');
+        });
+    }
+
+    void createConnectionChannelResponse(OutputBuffer& out,
+            const FlicClientProtocol::EvtCreateConnectionChannelResponse& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "CreateConnectionChannelResponse");
+            field(out, "conn_id", evt.conn_id);
+            stringField(out, "error", evt.error == FlicClientProtocol::NoError ? "NoError" :
+                        evt.error == FlicClientProtocol::MaxPendingConnectionsReached ?
+                        "MaxPendingConnectionsReached" : "Unknown");
+            stringField(out, "connection_status", connectionStatusName(evt.connection_status));
+            return end(out);
+        }
+        out.append("Create connection channel response: ");
+        out.append(evt.error == FlicClientProtocol::NoError ? "Success" :
+                   evt.error == FlicClientProtocol::MaxPendingConnectionsReached ?
+                   "Max pending connections reached" : "Unknown error");
+        out.append(" (conn_id: ");
+        out.appendUInt(evt.conn_id);
+        out.append(")\n");
+    }
+
+    void connectionStatusChanged(OutputBuffer& out,
+            const FlicClientProtocol::EvtConnectionStatusChanged& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        bool disconnected = evt.connection_status == FlicClientProtocol::Disconnected;
+        if (fmt == Json) {
+            begin(out, "ConnectionStatusChanged");
+            field(out, "conn_id", evt.conn_id);
+            addressField(out, "bd_addr", evt.bd_addr);
+            stringField(out, "connection_status", connectionStatusName(evt.connection_status));
+            if (disconnected) {
+                stringField(out, "disconnect_reason", disconnectReason(evt.disconnect_reason).json);
+            }
+            return end(out);
+        }
+        out.append("Connection status changed for ");
+        out.appendBdAddr(evt.bd_addr);
+        out.append(" (conn_id: ");
+        out.appendUInt(evt.conn_id);
+        out.append("): ");
+        out.append(connectionStatusName(evt.connection_status));
+        if (disconnected) {
+            out.append(" - Reason: ");
+            out.append(disconnectReason(evt.disconnect_reason).human);
+        }
+        out.append('\n');
+    }
+
+    void connectionChannelRemoved(OutputBuffer& out,
+            const FlicClientProtocol::EvtConnectionChannelRemoved& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        Name reason = removedReason(evt.removed_reason);
+        if (fmt == Json) {
+            begin(out, "ConnectionChannelRemoved");
+            field(out, "conn_id", evt.conn_id);
+            stringField(out, "removed_reason", reason.json);
+            return end(out);
+        }
+        out.append("Connection channel removed (conn_id: ");
+        out.appendUInt(evt.conn_id);
+        out.append("): ");
+        out.append(reason.human);
+        out.append('\n');
+    }
+
+    // All four button events share the EvtButtonUpOrDown layout
+    void buttonEvent(OutputBuffer& out, const FlicClientProtocol::EvtButtonUpOrDown& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        Name click = clickType(evt.click_type);
+        if (fmt == Json) {
+            begin(out, eventName(evt.opcode));
+            field(out, "conn_id", evt.conn_id);
+            stringField(out, "click_type", click.json);
+            boolField(out, "was_queued", evt.was_queued);
+            field(out, "age_ms", evt.time_diff);
+            return end(out);
+        }
+        out.append("Button ");
+        out.append(click.human);
+        out.append(" (conn_id: ");
+        out.appendUInt(evt.conn_id);
+        out.append(", age: ");
+        out.appendUInt(evt.time_diff);
+        out.append(" ms)\n");
+    }
+
+    void newVerifiedButton(OutputBuffer& out, const FlicClientProtocol::EvtNewVerifiedButton& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "NewVerifiedButton");
+            addressField(out, "bd_addr", evt.bd_addr);
+            return end(out);
+        }
+        out.append("New verified button: ");
+        out.appendBdAddr(evt.bd_addr);
+        out.append('\n');
+    }
+
+    void getInfoResponse(OutputBuffer& out, const FlicClientProtocol::EvtGetInfoResponse& evt,
+                         const VerifiedButtonList& verifiedButtons) {
+        size_t count = verifiedButtons.size();
+        if (fmt == Binary) {
+            uint8_t countLE[2] = { static_cast<uint8_t>(count), static_cast<uint8_t>(count >> 8) };
+            binaryHeader(out, sizeof(evt) + 2 + 6 * count);
+            out.appendBytes(&evt, sizeof(evt));
+            out.appendBytes(countLE, 2);
+            out.appendBytes(verifiedButtons.data(), 6 * count);
+            return;
+        }
+        const char* addrType = evt.my_bd_addr_type == FlicClientProtocol::PublicBdAddrType ? "Public" :
+                               evt.my_bd_addr_type == FlicClientProtocol::RandomBdAddrType ? "Random" :
+                               "Unknown";
+        if (fmt == Json) {
+            begin(out, "GetInfoResponse");
+            stringField(out, "bluetooth_controller_state",
+                        controllerStateName(evt.bluetooth_controller_state));
+            addressField(out, "my_bd_addr", evt.my_bd_addr);
+            stringField(out, "my_bd_addr_type", addrType);
+            field(out, "max_pending_connections", evt.max_pending_connections);
+            signedField(out, "max_concurrently_connected_buttons", evt.max_concurrently_connected_buttons);
+            field(out, "current_pending_connection_count", evt.current_pending_connection_count);
+            boolField(out, "currently_no_space_for_new_connection",
+                      evt.currently_no_space_for_new_connection);
+            key(out, "verified_buttons");
+            out.append('[');
+            for (VerifiedButtonList::const_iterator it = verifiedButtons.begin();
+                 it != verifiedButtons.end(); ++it) {
+                if (it != verifiedButtons.begin()) out.append(',');
+                out.append('"');
+                out.appendBdAddr(*it);
+                out.append('"');
+            }
+            out.append(']');
+            return end(out);
+        }
+        out.append("\n=== Server Info ===\nBluetooth controller state: ");
+        out.append(controllerStateName(evt.bluetooth_controller_state));
+        out.append("\nMy BD Address: ");
+        out.appendBdAddr(evt.my_bd_addr);
+        out.append(" (");
+        out.append(addrType);
+        out.append(")\nMax pending connections: ");
+        out.appendUInt(evt.max_pending_connections);
+        out.append("\nMax concurrent connections: ");
+        out.appendInt(evt.max_concurrently_connected_buttons);
+        out.append("\nCurrent pending connections: ");
+        out.appendUInt(evt.current_pending_connection_count);
+        out.append("\nCurrently no space for new connections: ");
+        out.append(evt.currently_no_space_for_new_connection ? "yes" : "no");
+        out.append("\n\nVerified buttons:\n");
+        if (count == 0) {
+            out.append("  (none)\n");
+        }
+        for (VerifiedButtonList::const_iterator it = verifiedButtons.begin();
+             it != verifiedButtons.end(); ++it) {
+            out.append("  ");
+            out.appendBdAddr(*it);
+            out.append('\n');
+        }
+        out.append("==================\n\n");
+    }
+
+    void noSpaceForNewConnection(OutputBuffer& out,
+            const FlicClientProtocol::EvtNoSpaceForNewConnection& evt) {
+        spaceEvent(out, &evt, sizeof(evt), "NoSpaceForNewConnection",
+                   evt.max_concurrently_connected_buttons, "No space for new connection\n");
+    }
+
+    void gotSpaceForNewConnection(OutputBuffer& out,
+            const FlicClientProtocol::EvtGotSpaceForNewConnection& evt) {
+        spaceEvent(out, &evt, sizeof(evt), "GotSpaceForNewConnection",
+                   evt.max_concurrently_connected_buttons, "Got space for new connection\n");
+    }
+
+    void bluetoothControllerStateChange(OutputBuffer& out,
+            const FlicClientProtocol::EvtBluetoothControllerStateChange& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "BluetoothControllerStateChange");
+            stringField(out, "state", controllerStateName(evt.state));
+            return end(out);
+        }
+        out.append("Bluetooth controller state changed to: ");
+        out.append(controllerStateName(evt.state));
+        out.append('\n');
+    }
+
+    void pingResponse(OutputBuffer& out, const FlicClientProtocol::EvtPingResponse& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "PingResponse");
+            field(out, "ping_id", evt.ping_id);
+            return end(out);
+        }
+        out.append("Ping response (ping_id: ");
+        out.appendUInt(evt.ping_id);
+        out.append(")\n");
+    }
+
+    void getButtonInfoResponse(OutputBuffer& out,
+            const FlicClientProtocol::EvtGetButtonInfoResponse& evt, const ButtonInfoView& info) {
+        if (fmt == Binary) {
+            binaryHeader(out, sizeof(evt) + info.size());
+            out.appendBytes(&evt, sizeof(evt));
+            out.appendBytes(info.data(), info.size());
+            return;
+        }
+        ButtonInfoView::Field name = info.name();
+        ButtonInfoView::Field serial = info.serialNumber();
+        if (fmt == Json) {
+            begin(out, "GetButtonInfoResponse");
+            addressField(out, "bd_addr", evt.bd_addr);
+            ButtonInfoView::Field uuid = info.uuid();
+            key(out, "uuid");
+            out.append('"');
+            out.appendHex(uuid.data, uuid.size);
+            out.append('"');
+            key(out, "name");
+            out.append('"');
+            out.appendJsonEscaped(name.chars(), name.size);
+            out.append('"');
+            signedField(out, "color", info.color());
+            key(out, "serial_number");
+            out.append('"');
+            out.appendJsonEscaped(serial.chars(), serial.size);
+            out.append('"');
+            field(out, "flic_version", info.flicVersion());
+            field(out, "firmware_version", info.firmwareVersion());
+            return end(out);
+        }
+        out.append("Button info for ");
+        out.appendBdAddr(evt.bd_addr);
+        out.append(": name \"");
+        out.append(name.chars(), name.size);
+        out.append("\", serial ");
+        out.append(serial.chars(), serial.size);
+        out.append(", Flic ");
+        out.appendUInt(info.flicVersion());
+        out.append(", firmware ");
+        out.appendUInt(info.firmwareVersion());
+        out.append('\n');
+    }
+
+    void scanWizardFoundPrivateButton(OutputBuffer& out,
+            const FlicClientProtocol::EvtScanWizardFoundPrivateButton& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "ScanWizardFoundPrivateButton");
+            field(out, "scan_wizard_id", evt.scan_wizard_id);
+            return end(out);
+        }
+        out.append("Scan wizard found private button\n");
+    }
+
+    void scanWizardFoundPublicButton(OutputBuffer& out,
+            const FlicClientProtocol::EvtScanWizardFoundPublicButton& evt) {
+        size_t nameLen = evt.name_length < sizeof(evt.name) ? evt.name_length : sizeof(evt.name);
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "ScanWizardFoundPublicButton");
+            field(out, "scan_wizard_id", evt.scan_wizard_id);
+            addressField(out, "bd_addr", evt.bd_addr);
+            key(out, "name");
+            out.append('"');
+            out.appendJsonEscaped(evt.name, nameLen);
+            out.append('"');
+            return end(out);
+        }
+        out.append("Scan wizard found button: ");
+        out.appendBdAddr(evt.bd_addr);
+        out.append(" Name: ");
+        out.append(evt.name, nameLen);
+        out.append('\n');
+    }
+
+    void scanWizardButtonConnected(OutputBuffer& out,
+            const FlicClientProtocol::EvtScanWizardButtonConnected& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "ScanWizardButtonConnected");
+            field(out, "scan_wizard_id", evt.scan_wizard_id);
+            return end(out);
+        }
+        out.append("Scan wizard: Button connected!\n");
+    }
+
+    void scanWizardCompleted(OutputBuffer& out,
+            const FlicClientProtocol::EvtScanWizardCompleted& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        Name result = wizardResult(evt.result);
+        if (fmt == Json) {
+            begin(out, "ScanWizardCompleted");
+            field(out, "scan_wizard_id", evt.scan_wizard_id);
+            stringField(out, "result", result.json);
+            return end(out);
+        }
+        out.append("Scan wizard completed: ");
+        out.append(result.human);
+        out.append('\n');
+    }
+
+    void buttonDeleted(OutputBuffer& out, const FlicClientProtocol::EvtButtonDeleted& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "ButtonDeleted");
+            addressField(out, "bd_addr", evt.bd_addr);
+            boolField(out, "deleted_by_this_client", evt.deleted_by_this_client);
+            return end(out);
+        }
+        out.append("Button deleted: ");
+        out.appendBdAddr(evt.bd_addr);
+        out.append(evt.deleted_by_this_client ? " (by this client)\n" : " (by another client)\n");
+    }
+
+    void batteryStatus(OutputBuffer& out, const FlicClientProtocol::EvtBatteryStatus& evt) {
+        if (fmt == Binary) return binary(out, &evt, sizeof(evt));
+        if (fmt == Json) {
+            begin(out, "BatteryStatus");
+            field(out, "listener_id", evt.listener_id);
+            signedField(out, "battery_percentage", evt.battery_percentage);
+            field(out, "timestamp", evt.timestamp);
+            return end(out);
+        }
+        out.append("Battery status (listener_id: ");
+        out.appendUInt(evt.listener_id);
+        out.append("): ");
+        out.appendInt(evt.battery_percentage);
+        out.append("%\n");
+    }
+
+    void unknownPacket(OutputBuffer& out, const uint8_t* data, size_t len) {
+        if (len == 0) return;
+        if (fmt == Binary) return binary(out, data, len);
+        if (fmt == Json) {
+            begin(out, "Unknown");
+            field(out, "opcode", data[0]);
+            field(out, "length", len);
+            return end(out);
+        }
+        out.append("Unknown opcode: ");
+        out.appendUInt(data[0]);
+        out.append('\n');
+    }
+
+    // Any event packet as received, through the method for its opcode
+    void packet(OutputBuffer& out, const uint8_t* data, size_t len) {
+        using namespace FlicClientProtocol;
+        if (len == 0) return;
+        switch (data[0]) {
+            case EVT_ADVERTISEMENT_PACKET_OPCODE:
+                if (const EvtAdvertisementPacket* evt = packetAs<EvtAdvertisementPacket>(data, len)) {
+                    return advertisement(out, *evt);
+                }
+                break;
+            case EVT_CREATE_CONNECTION_CHANNEL_RESPONSE_OPCODE:
+                if (const EvtCreateConnectionChannelResponse* evt =
+                        packetAs<EvtCreateConnectionChannelResponse>(data, len)) {
+                    return createConnectionChannelResponse(out, *evt);
+                }
+                break;
+            case EVT_CONNECTION_STATUS_CHANGED_OPCODE:
+                if (const EvtConnectionStatusChanged* evt = packetAs<EvtConnectionStatusChanged>(data, len)) {
+                    return connectionStatusChanged(out, *evt);
+                }
+                break;
+            case EVT_CONNECTION_CHANNEL_REMOVED_OPCODE:
+                if (const EvtConnectionChannelRemoved* evt = packetAs<EvtConnectionChannelRemoved>(data, len)) {
+                    return connectionChannelRemoved(out, *evt);
+                }
+                break;
+            case EVT_BUTTON_UP_OR_DOWN_OPCODE:
+            case EVT_BUTTON_CLICK_OR_HOLD_OPCODE:
+            case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OPCODE:
+            case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE:
+                if (const EvtButtonUpOrDown* evt = packetAs<EvtButtonUpOrDown>(data, len)) {
+                    return buttonEvent(out, *evt);
+                }
+                break;
+            case EVT_NEW_VERIFIED_BUTTON_OPCODE:
+                if (const EvtNewVerifiedButton* evt = packetAs<EvtNewVerifiedButton>(data, len)) {
+                    return newVerifiedButton(out, *evt);
+                }
+                break;
+            case EVT_GET_INFO_RESPONSE_OPCODE:
+                if (const EvtGetInfoResponse* evt = packetAs<EvtGetInfoResponse>(data, len)) {
+                    VerifiedButtonList buttons;
+                    if (buttons.parse(data + sizeof(*evt), len - sizeof(*evt))) {
+                        return getInfoResponse(out, *evt, buttons);
+                    }
+                }
+                break;
+            case EVT_NO_SPACE_FOR_NEW_CONNECTION_OPCODE:
+                if (const EvtNoSpaceForNewConnection* evt = packetAs<EvtNoSpaceForNewConnection>(data, len)) {
+                    return noSpaceForNewConnection(out, *evt);
+                }
+                break;
+            case EVT_GOT_SPACE_FOR_NEW_CONNECTION_OPCODE:
+                if (const EvtGotSpaceForNewConnection* evt = packetAs<EvtGotSpaceForNewConnection>(data, len)) {
+                    return gotSpaceForNewConnection(out, *evt);
+                }
+                break;
+            case EVT_BLUETOOTH_CONTROLLER_STATE_CHANGE_OPCODE:
+                if (const EvtBluetoothControllerStateChange* evt =
+                        packetAs<EvtBluetoothControllerStateChange>(data, len)) {
+                    return bluetoothControllerStateChange(out, *evt);
+                }
+                break;
+            case EVT_PING_RESPONSE_OPCODE:
+                if (const EvtPingResponse* evt = packetAs<EvtPingResponse>(data, len)) {
+                    return pingResponse(out, *evt);
+                }
+                break;
+            case EVT_GET_BUTTON_INFO_RESPONSE_OPCODE:
+                if (const EvtGetButtonInfoResponse* evt = packetAs<EvtGetButtonInfoResponse>(data, len)) {
+                    ButtonInfoView info;
+                    if (info.parse(data + sizeof(*evt), len - sizeof(*evt))) {
+                        return getButtonInfoResponse(out, *evt, info);
+                    }
+                }
+                break;
+            case EVT_SCAN_WIZARD_FOUND_PRIVATE_BUTTON_OPCODE:
+                if (const EvtScanWizardFoundPrivateButton* evt =
+                        packetAs<EvtScanWizardFoundPrivateButton>(data, len)) {
+                    return scanWizardFoundPrivateButton(out, *evt);
+                }
+                break;
+            case EVT_SCAN_WIZARD_FOUND_PUBLIC_BUTTON_OPCODE:
+                if (const EvtScanWizardFoundPublicButton* evt =
+                        packetAs<EvtScanWizardFoundPublicButton>(data, len)) {
+                    return scanWizardFoundPublicButton(out, *evt);
+                }
+                break;
+            case EVT_SCAN_WIZARD_BUTTON_CONNECTED_OPCODE:
+                if (const EvtScanWizardButtonConnected* evt =
+                        packetAs<EvtScanWizardButtonConnected>(data, len)) {
+                    return scanWizardButtonConnected(out, *evt);
+                }
+                break;
+            case EVT_SCAN_WIZARD_COMPLETED_OPCODE:
+                if (const EvtScanWizardCompleted* evt = packetAs<EvtScanWizardCompleted>(data, len)) {
+                    return scanWizardCompleted(out, *evt);
+                }
+                break;
+            case EVT_BUTTON_DELETED_OPCODE:
+                if (const EvtButtonDeleted* evt = packetAs<EvtButtonDeleted>(data, len)) {
+                    return buttonDeleted(out, *evt);
+                }
+                break;
+            case EVT_BATTERY_STATUS_OPCODE:
+                if (const EvtBatteryStatus* evt = packetAs<EvtBatteryStatus>(data, len)) {
+                    return batteryStatus(out, *evt);
+                }
+                break;
+            default:
+                break;
+        }
+        unknownPacket(out, data, len);
+    }
+
+    // Session lifecycle records; JSON only, the other formats report these
+    // as text on the console
+    void lifecycle(OutputBuffer& out, const char* event) {
+        begin(out, event);
+        end(out);
+    }
+
+    void lifecycle(OutputBuffer& out, const char* event, const char* key1, uint64_t value1,
+                   const char* key2 = nullptr, uint64_t value2 = 0) {
+        begin(out, event);
+        field(out, key1, value1);
+        if (key2) field(out, key2, value2);
+        end(out);
+    }
+
+    // JSON only, like the lifecycle records
+    void batteryAlert(OutputBuffer& out, const BatteryMonitor::Series& series, uint8_t level) {
+        uint8_t addr[6];
+        unpackAddress(series.addr, addr);
+        begin(out, "BatteryAlert");
+        addressField(out, "bd_addr", addr);
+        stringField(out, "level", batteryLevelName(level));
+        signedField(out, "battery_percentage", series.latest().last);
+        field(out, "timestamp", series.latest().end);
+        end(out);
+    }
+
+    // A button event delivered past its deadline; the event itself follows
+    void staleEvent(OutputBuffer& out, const FlicClientProtocol::EvtButtonUpOrDown& evt,
+                    uint64_t ageMs, uint32_t collapsed) {
+        if (fmt == Binary) return;
+        if (fmt == Json) {
+            begin(out, "StaleEvent");
+            field(out, "conn_id", evt.conn_id);
+            stringField(out, "packet", eventName(evt.opcode));
+            stringField(out, "click_type", clickType(evt.click_type).json);
+            field(out, "age_ms", ageMs);
+            field(out, "collapsed", collapsed);
+            return end(out);
+        }
+        out.append("Stale (conn_id: ");
+        out.appendUInt(evt.conn_id);
+        out.append(", age: ");
+        out.appendUInt(ageMs);
+        out.append(" ms");
+        if (collapsed) {
+            out.append(", replaces ");
+            out.appendUInt(collapsed);
+        }
+        out.append("):\n");
+    }
+
+    // JSON only, like the lifecycle records; addr may be null
+    void speculation(OutputBuffer& out, const ClickRecognizer::Speculation& s, const uint8_t* addr) {
+        static const char* const outcomes[] = { "Pending", "Confirmed", "Retracted", "Expired" };
+        begin(out, s.outcome == ClickRecognizer::Pending ? "SpeculativeClick" : "SpeculationResolved");
+        field(out, "conn_id", s.connId);
+        if (addr) addressField(out, "bd_addr", addr);
+        stringField(out, "click_type", clickType(s.clickType).json);
+        field(out, "press_ms", (s.speculatedNs - s.downNs) / 1000000ull);
+        if (s.outcome != ClickRecognizer::Pending) {
+            stringField(out, "outcome", outcomes[s.outcome & 3]);
+            if (s.outcome != ClickRecognizer::Expired) {
+                stringField(out, "actual_click_type", clickType(s.actualClickType).json);
+            }
+            field(out, "lead_ms", (s.resolvedNs - s.speculatedNs) / 1000000ull);
+        }
+        end(out);
+    }
+
+    static const char* clickTypeName(uint8_t value) { return clickType(value).human; }
+
+    static const char* batteryLevelName(uint8_t level) {
+        switch (level) {
+            case FlicClientProtocol::BatteryStatusOk: return "Ok";
+            case FlicClientProtocol::BatteryStatusLow: return "Low";
+            case FlicClientProtocol::BatteryStatusCritical: return "Critical";
+            default: return "Unknown";
+        }
+    }
+
+    // The JSON event name of an event packet opcode
+    static const char* eventName(uint8_t opcode) {
+        static const char* const names[] = {
+            "Advertisement", "CreateConnectionChannelResponse", "ConnectionStatusChanged",
+            "ConnectionChannelRemoved", "ButtonUpOrDown", "ButtonClickOrHold",
+            "ButtonSingleOrDoubleClick", "ButtonSingleOrDoubleClickOrHold", "NewVerifiedButton",
+            "GetInfoResponse", "NoSpaceForNewConnection", "GotSpaceForNewConnection",
+            "BluetoothControllerStateChange", "PingResponse", "GetButtonInfoResponse",
+            "ScanWizardFoundPrivateButton", "ScanWizardFoundPublicButton",
+            "ScanWizardButtonConnected", "ScanWizardCompleted", "ButtonDeleted", "BatteryStatus"
+        };
+        return opcode < sizeof(names) / sizeof(names[0]) ? names[opcode] : "Unknown";
+    }
+
+private:
+    struct Name {
+        const char* human;
+        const char* json;
+    };
+
+    Format fmt;
+    std::string sourceTag;
+    uint16_t sourceId;
+
+    // Enum tables indexed by the protocol value
+    static Name disconnectReason(uint8_t value) {
+        static const Name names[] = {
+            { "Unspecified", "Unspecified" },
+            { "Connection establishment failed", "ConnectionEstablishmentFailed" },
+            { "Timed out", "TimedOut" },
+            { "Bonding keys mismatch", "BondingKeysMismatch" }
+        };
+        return pick(names, sizeof(names) / sizeof(names[0]), value, "Unknown");
+    }
+
+    static Name removedReason(uint8_t value) {
+        static const Name names[] = {
+            { "Removed by this client", "RemovedByThisClient" },
+            { "Force disconnected by this client", "ForceDisconnectedByThisClient" },
+            { "Force disconnected by other client", "ForceDisconnectedByOtherClient" },
+            { "Button is private", "ButtonIsPrivate" },
+            { "Verify timeout", "VerifyTimeout" },
+            { "Internet backend error", "InternetBackendError" },
+            { "Invalid data", "InvalidData" },
+            { "Couldn't load device", "CouldntLoadDevice" },
+            { "Deleted by this client", "DeletedByThisClient" },
+            { "Deleted by other client", "DeletedByOtherClient" },
+            { "Button belongs to other partner", "ButtonBelongsToOtherPartner" },
+            { "Deleted from button", "DeletedFromButton" }
+        };
+        return pick(names, sizeof(names) / sizeof(names[0]), value, "Unknown reason");
+    }
+
+    static Name clickType(uint8_t value) {
+        static const Name names[] = {
+            { "DOWN", "ButtonDown" },
+            { "UP", "ButtonUp" },
+            { "CLICK", "ButtonClick" },
+            { "SINGLE CLICK", "ButtonSingleClick" },
+            { "DOUBLE CLICK", "ButtonDoubleClick" },
+            { "HOLD", "ButtonHold" }
+        };
+        return pick(names, sizeof(names) / sizeof(names[0]), value, "UNKNOWN");
+    }
+
+    static Name wizardResult(uint8_t value) {
+        static const Name names[] = {
+            { "Success!", "WizardSuccess" },
+            { "Cancelled by user", "WizardCancelledByUser" },
+            { "Failed (timeout)", "WizardFailedTimeout" },
+            { "Button is private", "WizardButtonIsPrivate" },
+            { "Bluetooth unavailable", "WizardBluetoothUnavailable" },
+            { "Internet backend error", "WizardInternetBackendError" },
+            { "Invalid data", "WizardInvalidData" },
+            { "Button belongs to other partner", "WizardButtonBelongsToOtherPartner" },
+            { "Button already connected to other device", "WizardButtonAlreadyConnectedToOtherDevice" }
+        };
+        return pick(names, sizeof(names) / sizeof(names[0]), value, "Unknown result");
+    }
+
+    static Name pick(const Name* names, size_t count, uint8_t value, const char* unknown) {
+        if (value < count) return names[value];
+        Name name = { unknown, "Unknown" };
+        return name;
+    }
+
+    static const char* connectionStatusName(uint8_t status) {
+        switch (status) {
+            case FlicClientProtocol::Disconnected: return "Disconnected";
+            case FlicClientProtocol::Connected: return "Connected";
+            case FlicClientProtocol::Ready: return "Ready";
+            default: return "Unknown";
+        }
+    }
+
+    static const char* controllerStateName(uint8_t state) {
+        switch (state) {
+            case FlicClientProtocol::Detached: return "Detached";
+            case FlicClientProtocol::Resetting: return "Resetting";
+            case FlicClientProtocol::Attached: return "Attached";
+            default: return "Unknown";
+        }
+    }
+
+    static uint64_t wallClockUs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000ull + ts.tv_nsec / 1000;
+    }
+
+    void binaryHeader(OutputBuffer& out, size_t length) {
+        BinaryRecordHeader header;
+        header.length = static_cast<uint16_t>(length);
+        header.source = sourceId;
+        header.timestampUs = wallClockUs();
+        out.appendBytes(&header, sizeof(header));
+    }
+
+    void binary(OutputBuffer& out, const void* packet, size_t len) {
+        binaryHeader(out, len);
+        out.appendBytes(packet, len);
+    }
+
+    void begin(OutputBuffer& out, const char* event) {
+        out.append("{\"ts_ms\":");
+        out.appendUInt(wallClockUs() / 1000);
+        out.append(",\"source\":\"");
+        out.appendJsonEscaped(sourceTag.data(), sourceTag.size());
+        out.append("\",\"event\":\"");
+        out.append(event);
+        out.append('"');
+    }
+
+    void end(OutputBuffer& out) {
+        out.append("}\n");
+    }
+
+    static void key(OutputBuffer& out, const char* name) {
+        out.append(",\"");
+        out.append(name);
+        out.append("\":");
+    }
+
+    static void field(OutputBuffer& out, const char* name, uint64_t value) {
+        key(out, name);
+        out.appendUInt(value);
+    }
+
+    static void signedField(OutputBuffer& out, const char* name, int64_t value) {
+        key(out, name);
+        out.appendInt(value);
+    }
+
+    static void boolField(OutputBuffer& out, const char* name, bool value) {
+        key(out, name);
+        out.append(value ? "true" : "false");
+    }
+
+    static void stringField(OutputBuffer& out, const char* name, const char* value) {
+        key(out, name);
+        out.append('"');
+        out.append(value);
+        out.append('"');
+    }
+
+    static void addressField(OutputBuffer& out, const char* name, const uint8_t* addr) {
+        key(out, name);
+        out.append('"');
+        out.appendBdAddr(addr);
+        out.append('"');
+    }
+
+    // Names of the AdvertisementTable::Change bits, null past the last
+    static const char* changeName(unsigned bit) {
+        static const char* const names[] = { "New", "Rssi", "Name", "Flags", "Lost" };
+        return bit < sizeof(names) / sizeof(names[0]) ? names[bit] : nullptr;
+    }
+
+    static void advertisementText(OutputBuffer& out, const AdvertisementTable::Entry& entry) {
+        const FlicClientProtocol::EvtAdvertisementPacket& evt = entry.last;
+        out.appendBdAddr(evt.bd_addr);
+        out.append(" Name: ");
+        out.append(evt.name, evt.name_length < sizeof(evt.name) ? evt.name_length : sizeof(evt.name));
+        out.append(" RSSI: ");
+        out.appendInt(entry.rssi());
+        out.append(" dBm Private: ");
+        out.append(evt.is_private ? "yes" : "no");
+        out.append(" Verified: ");
+        out.append(evt.already_verified ? "yes" : "no");
+        if (evt.already_connected_to_this_device) out.append(" Connected: this client");
+        else if (evt.already_connected_to_other_device) out.append(" Connected: other device");
+    }
+
+    void advertisementFields(OutputBuffer& out, const AdvertisementTable::Entry& entry,
+                             uint64_t nowMs) {
+        const FlicClientProtocol::EvtAdvertisementPacket& evt = entry.last;
+        addressField(out, "bd_addr", evt.bd_addr);
+        key(out, "name");
+        out.append('"');
+        out.appendJsonEscaped(evt.name, evt.name_length < sizeof(evt.name) ? evt.name_length : sizeof(evt.name));
+        out.append('"');
+        signedField(out, "rssi", entry.rssi());
+        signedField(out, "last_rssi", evt.rssi);
+        boolField(out, "is_private", evt.is_private);
+        boolField(out, "already_verified", evt.already_verified);
+        boolField(out, "already_connected_to_this_device", evt.already_connected_to_this_device);
+        boolField(out, "already_connected_to_other_device", evt.already_connected_to_other_device);
+        field(out, "packets", entry.packets);
+        field(out, "seen_for_ms", entry.lastSeenMs - entry.firstSeenMs);
+        field(out, "last_seen_ms_ago", nowMs - entry.lastSeenMs);
+    }
+
+    void spaceEvent(OutputBuffer& out, const void* packet, size_t len, const char* event,
+                    uint8_t maxButtons, const char* text) {
+        if (fmt == Binary) return binary(out, packet, len);
+        if (fmt == Json) {
+            begin(out, event);
+            field(out, "max_concurrently_connected_buttons", maxButtons);
+            return end(out);
+        }
+        out.append(text);
+    }
+};
+
+#endif // EVENT_FORMATTER_H
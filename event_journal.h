@@ -0,0 +1,356 @@
+#ifndef EVENT_JOURNAL_H
+#define EVENT_JOURNAL_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// On-disk journal of received frames, split into fixed-size segments.
+//
+// A journal is a directory of segment-NNNNNNNNNNNNNNNN.fj files. Each
+// segment is created at its full size, mapped with MAP_SHARED and filled
+// with records, so appending a frame is two memcpy()s into the mapping and
+// no system call; the kernel writes pages back on its own schedule and they
+// survive a crash of the process. When a record does not fit, the segment
+// is truncated to its used length and the next one is started, and the
+// oldest segments beyond the retention limit are deleted.
+//
+// Segment layout (little-endian, as written by the host):
+//   SegmentHeader, then records back to back, each a RecordHeader followed
+//   by the frame (without its length prefix), padded to 4 bytes. A record
+//   with len 0 ends the segment; len is written last, so a record is only
+//   visible once complete.
+namespace EventJournalFormat {
+
+static const char kMagic[8] = { 'F', 'L', 'I', 'C', 'J', 'N', 'L', '1' };
+static const uint32_t kVersion = 1;
+
+struct SegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint16_t sourceId;
+    uint16_t sourceLen;
+    uint64_t sequence;
+    uint64_t createdNs;     // wall clock
+    char source[32];        // "host:port" of the writer, truncated
+};
+
+#pragma pack(push, 1)
+struct RecordHeader {
+    uint64_t wallNs;        // receive time, wall clock
+    uint16_t sourceId;
+    uint16_t len;           // frame length; 0 = end of segment
+};
+#pragma pack(pop)
+
+static const size_t kRecordAlign = 4;
+
+inline size_t recordSize(size_t len) {
+    return (sizeof(RecordHeader) + len + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+inline uint64_t wallNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+inline uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Segment files of dir in sequence order
+inline bool listSegments(const std::string& dir, std::vector<std::string>& names) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return false;
+    while (struct dirent* entry = readdir(d)) {
+        const char* name = entry->d_name;
+        size_t len = std::strlen(name);
+        if (len == 27 && std::strncmp(name, "segment-", 8) == 0 &&
+            std::strcmp(name + 24, ".fj") == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    return true;
+}
+
+}  // namespace EventJournalFormat
+
+class EventJournal {
+public:
+    struct Options {
+        size_t segmentBytes;    // size of each segment file
+        size_t maxSegments;     // oldest segments beyond this are deleted; 0 = keep all
+
+        Options() : segmentBytes(64 << 20), maxSegments(16) {}
+    };
+
+    EventJournal()
+        : sourceId(0), fd(-1), base(nullptr), used(0), sequence(0), wallOffsetNs(0),
+          frameCount(0), byteCount(0) {}
+
+    ~EventJournal() { close(); }
+
+    // Opens dir (created if missing) and starts a new segment after any
+    // existing ones. source and sourceId are stored with the frames.
+    bool open(const std::string& path, const std::string& sourceTag, uint16_t id,
+              const Options& opts, std::string* error) {
+        close();
+        dir = path;
+        source = sourceTag;
+        sourceId = id;
+        options = opts;
+        size_t minimum = sizeof(EventJournalFormat::SegmentHeader) +
+                         EventJournalFormat::recordSize(0xffff) + sizeof(EventJournalFormat::RecordHeader);
+        if (options.segmentBytes < minimum) options.segmentBytes = minimum;
+
+        if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) return fail(error, "mkdir " + dir);
+        std::vector<std::string> names;
+        if (!EventJournalFormat::listSegments(dir, names)) return fail(error, "opendir " + dir);
+        segments.assign(names.begin(), names.end());
+        sequence = names.empty() ? 0 : std::strtoull(names.back().c_str() + 8, nullptr, 10) + 1;
+
+        wallOffsetNs = EventJournalFormat::wallNs() - EventJournalFormat::monotonicNs();
+        return startSegment(error);
+    }
+
+    bool isOpen() const { return base != nullptr; }
+
+    // Appends one frame received at recvNs (EventLoop::nowNs() clock).
+    // Returns false if a new segment could not be started; the journal is
+    // closed then.
+    bool append(const uint8_t* frame, size_t len, uint64_t recvNs) {
+        if (!base) return false;
+        size_t size = EventJournalFormat::recordSize(len);
+        // Leave room for the end marker
+        if (used + size + sizeof(EventJournalFormat::RecordHeader) > options.segmentBytes) {
+            finishSegment();
+            if (!startSegment(nullptr)) return false;
+        }
+        uint8_t* record = base + used;
+        EventJournalFormat::RecordHeader header;
+        header.wallNs = recvNs + wallOffsetNs;
+        header.sourceId = sourceId;
+        header.len = static_cast<uint16_t>(len);
+        std::memcpy(record + sizeof(header), frame, len);
+        std::memcpy(record, &header, offsetof(EventJournalFormat::RecordHeader, len));
+        __atomic_store_n(reinterpret_cast<uint16_t*>(record + offsetof(EventJournalFormat::RecordHeader, len)),
+                         header.len, __ATOMIC_RELEASE);
+        used += size;
+        frameCount++;
+        byteCount += size;
+        return true;
+    }
+
+    void close() {
+        if (base) finishSegment();
+    }
+
+    const std::string& directory() const { return dir; }
+    uint64_t frames() const { return frameCount; }
+    uint64_t bytes() const { return byteCount; }
+    size_t segmentCount() const { return segments.size(); }
+
+private:
+    std::string dir;
+    std::string source;
+    uint16_t sourceId;
+    Options options;
+    std::deque<std::string> segments;   // file names, oldest first
+    int fd;
+    uint8_t* base;
+    size_t used;
+    uint64_t sequence;
+    uint64_t wallOffsetNs;
+    uint64_t frameCount;
+    uint64_t byteCount;
+
+    EventJournal(const EventJournal&);
+    EventJournal& operator=(const EventJournal&);
+
+    bool startSegment(std::string* error) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "segment-%016llu.fj",
+                      static_cast<unsigned long long>(sequence));
+        std::string path = dir + "/" + name;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return fail(error, "open " + path);
+        if (ftruncate(fd, options.segmentBytes) < 0) {
+            ::close(fd);
+            fd = -1;
+            return fail(error, "ftruncate " + path);
+        }
+        void* p = mmap(nullptr, options.segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            fd = -1;
+            return fail(error, "mmap " + path);
+        }
+        base = static_cast<uint8_t*>(p);
+
+        EventJournalFormat::SegmentHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, EventJournalFormat::kMagic, sizeof(header.magic));
+        header.version = EventJournalFormat::kVersion;
+        header.sourceId = sourceId;
+        header.sourceLen = static_cast<uint16_t>(std::min(source.size(), sizeof(header.source)));
+        header.sequence = sequence;
+        header.createdNs = EventJournalFormat::wallNs();
+        std::memcpy(header.source, source.data(), header.sourceLen);
+        std::memcpy(base, &header, sizeof(header));
+        used = sizeof(header);
+
+        sequence++;
+        segments.push_back(name);
+        while (options.maxSegments > 0 && segments.size() > options.maxSegments) {
+            unlink((dir + "/" + segments.front()).c_str());
+            segments.pop_front();
+        }
+        return true;
+    }
+
+    // The zero-filled tail already reads as the end marker; truncating to
+    // the used length keeps closed segments from occupying their full size
+    void finishSegment() {
+        munmap(base, options.segmentBytes);
+        base = nullptr;
+        if (ftruncate(fd, used + sizeof(EventJournalFormat::RecordHeader)) < 0) {
+            // The segment stays at full size; readers stop at the end marker
+        }
+        ::close(fd);
+        fd = -1;
+    }
+
+    static bool fail(std::string* error, const std::string& what) {
+        if (error) *error = what + ": " + std::strerror(errno);
+        return false;
+    }
+};
+
+// Reads the records of a journal directory in order, one mapped segment at
+// a time. Segments deleted by the writer's retention while reading are
+// skipped.
+class JournalReader {
+public:
+    struct Record {
+        uint64_t wallNs;
+        uint16_t sourceId;
+        uint16_t len;
+        const uint8_t* data;    // valid until the next call to next()
+    };
+
+    JournalReader() : current(0), fd(-1), base(nullptr), size(0), offset(0) {}
+    ~JournalReader() { unmap(); }
+
+    bool open(const std::string& path, std::string* error) {
+        unmap();
+        dir = path;
+        names.clear();
+        current = 0;
+        if (!EventJournalFormat::listSegments(dir, names)) {
+            if (error) *error = "opendir " + dir + ": " + std::strerror(errno);
+            return false;
+        }
+        if (names.empty()) {
+            if (error) *error = "no segments in " + dir;
+            return false;
+        }
+        return true;
+    }
+
+    bool next(Record& record) {
+        for (;;) {
+            if (!base && !mapNext()) return false;
+            if (offset + sizeof(EventJournalFormat::RecordHeader) <= size) {
+                EventJournalFormat::RecordHeader header;
+                std::memcpy(&header, base + offset, sizeof(header));
+                size_t recordSize = EventJournalFormat::recordSize(header.len);
+                if (header.len != 0 && offset + recordSize <= size) {
+                    record.wallNs = header.wallNs;
+                    record.sourceId = header.sourceId;
+                    record.len = header.len;
+                    record.data = base + offset + sizeof(header);
+                    offset += recordSize;
+                    return true;
+                }
+            }
+            unmap();
+        }
+    }
+
+    size_t segmentCount() const { return names.size(); }
+    // Writer tag of the segment being read
+    const std::string& source() const { return sourceTag; }
+
+private:
+    std::string dir;
+    std::vector<std::string> names;
+    size_t current;
+    int fd;
+    uint8_t* base;
+    size_t size;
+    size_t offset;
+    std::string sourceTag;
+
+    JournalReader(const JournalReader&);
+    JournalReader& operator=(const JournalReader&);
+
+    bool mapNext() {
+        while (current < names.size()) {
+            std::string path = dir + "/" + names[current++];
+            fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+            struct stat st;
+            EventJournalFormat::SegmentHeader header;
+            if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(header)) {
+                unmap();
+                continue;
+            }
+            size = st.st_size;
+            void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                unmap();
+                continue;
+            }
+            base = static_cast<uint8_t*>(p);
+            std::memcpy(&header, base, sizeof(header));
+            if (std::memcmp(header.magic, EventJournalFormat::kMagic, sizeof(header.magic)) != 0 ||
+                header.version != EventJournalFormat::kVersion) {
+                unmap();
+                continue;
+            }
+            sourceTag.assign(header.source, std::min<size_t>(header.sourceLen, sizeof(header.source)));
+            offset = sizeof(header);
+            posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+            return true;
+        }
+        return false;
+    }
+
+    void unmap() {
+        if (base) munmap(base, size);
+        base = nullptr;
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+};
+
+#endif // EVENT_JOURNAL_H
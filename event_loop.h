@@ -0,0 +1,318 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <unistd.h>
+
+// Single-threaded reactor built on epoll.
+//
+// File descriptors are registered with a callback that receives the epoll
+// event mask. All timers share one timerfd that is always armed for the
+// earliest deadline, so thousands of timers cost one fd and an ordered map.
+// Signals are delivered synchronously through a signalfd, and other threads
+// hand work to the loop with post(), which wakes it through an eventfd. The
+// loop sleeps in epoll_wait() with no timeout and only wakes up when one of
+// these has work.
+class EventLoop {
+public:
+    typedef std::function<void(uint32_t events)> FdCallback;
+    typedef std::function<void()> TimerCallback;
+    typedef std::function<void(const struct signalfd_siginfo& info)> SignalCallback;
+    typedef uint64_t TimerId;
+
+    EventLoop()
+        : epfd(-1), timerfd(-1), sigfd(-1), wakefd(-1), running(false),
+          nextGeneration(1), nextTimerId(1), armedDeadline(0) {
+        sigemptyset(&sigmask);
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epfd < 0 || timerfd < 0 || wakefd < 0) {
+            perror("EventLoop");
+            return;
+        }
+        addFd(timerfd, EPOLLIN, [this](uint32_t) { onTimerFd(); });
+        addFd(wakefd, EPOLLIN, [this](uint32_t) { onWakeFd(); });
+    }
+
+    ~EventLoop() {
+        if (sigfd >= 0) {
+            close(sigfd);
+            pthread_sigmask(SIG_UNBLOCK, &sigmask, nullptr);
+        }
+        if (wakefd >= 0) close(wakefd);
+        if (timerfd >= 0) close(timerfd);
+        if (epfd >= 0) close(epfd);
+    }
+
+    bool valid() const { return epfd >= 0 && timerfd >= 0 && wakefd >= 0; }
+
+    // Monotonic clock shared by timers and callers that want to stamp events
+    static uint64_t nowNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    static uint64_t nowMs() { return nowNs() / 1000000ull; }
+
+    bool addFd(int fd, uint32_t events, FdCallback cb) {
+        std::shared_ptr<FdEntry> entry(new FdEntry());
+        entry->generation = nextGeneration++;
+        entry->callback = cb;
+
+        struct epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.u64 = (entry->generation << 32) | static_cast<uint32_t>(fd);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl(ADD)");
+            return false;
+        }
+        fds[fd] = entry;
+        return true;
+    }
+
+    bool modifyFd(int fd, uint32_t events) {
+        std::unordered_map<int, std::shared_ptr<FdEntry> >::iterator it = fds.find(fd);
+        if (it == fds.end()) return false;
+
+        struct epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.u64 = (it->second->generation << 32) | static_cast<uint32_t>(fd);
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+            perror("epoll_ctl(MOD)");
+            return false;
+        }
+        return true;
+    }
+
+    // Safe to call from inside any callback, including the fd's own
+    void removeFd(int fd) {
+        if (fds.erase(fd) > 0) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+
+    TimerId addTimer(uint64_t delayMs, TimerCallback cb) {
+        return scheduleTimer(delayMs, 0, cb);
+    }
+
+    TimerId addPeriodicTimer(uint64_t intervalMs, TimerCallback cb) {
+        return scheduleTimer(intervalMs, intervalMs, cb);
+    }
+
+    // Returns false if the timer already fired (one-shot) or never existed
+    bool cancelTimer(TimerId id) {
+        std::unordered_map<TimerId, Timer>::iterator it = timers.find(id);
+        if (it == timers.end()) return false;
+        deadlines.erase(it->second.slot);
+        timers.erase(it);
+        return true;
+    }
+
+    // Blocks signo for the process and delivers it through the loop instead
+    bool addSignal(int signo, SignalCallback cb) {
+        sigaddset(&sigmask, signo);
+        if (pthread_sigmask(SIG_BLOCK, &sigmask, nullptr) != 0) {
+            perror("pthread_sigmask");
+            return false;
+        }
+        bool created = sigfd < 0;
+        sigfd = signalfd(sigfd, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (sigfd < 0) {
+            perror("signalfd");
+            return false;
+        }
+        signals[signo] = cb;
+        if (created) {
+            return addFd(sigfd, EPOLLIN, [this](uint32_t) { onSignalFd(); });
+        }
+        return true;
+    }
+
+    // Runs fn on the loop thread. This is the only method that may be called
+    // from other threads.
+    void post(std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lock(postMutex);
+            posted.push_back(fn);
+        }
+        uint64_t one = 1;
+        ssize_t n = write(wakefd, &one, sizeof(one));
+        (void)n;
+    }
+
+    // Dispatches events until stop() is called
+    void run() {
+        running = true;
+        while (running) {
+            if (!runOnce(-1)) break;
+        }
+        running = false;
+    }
+
+    // Waits up to timeoutMs (-1 = forever) and dispatches one batch of events
+    bool runOnce(int timeoutMs) {
+        struct epoll_event events[64];
+        int n = epoll_wait(epfd, events, 64, timeoutMs);
+        if (n < 0) {
+            if (errno == EINTR) return true;
+            perror("epoll_wait");
+            return false;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = static_cast<int>(events[i].data.u64 & 0xffffffffu);
+            uint64_t generation = events[i].data.u64 >> 32;
+            std::unordered_map<int, std::shared_ptr<FdEntry> >::iterator it = fds.find(fd);
+
+            // Skip fds removed (or replaced) by an earlier callback this round
+            if (it == fds.end() || it->second->generation != generation) continue;
+
+            std::shared_ptr<FdEntry> entry = it->second;
+            entry->callback(events[i].events);
+        }
+        return true;
+    }
+
+    void stop() { running = false; }
+    bool isRunning() const { return running; }
+
+    size_t fdCount() const { return fds.size(); }
+    size_t timerCount() const { return timers.size(); }
+
+private:
+    struct FdEntry {
+        uint64_t generation;
+        FdCallback callback;
+    };
+
+    typedef std::multimap<uint64_t, TimerId> DeadlineMap;
+
+    struct Timer {
+        uint64_t intervalNs;
+        TimerCallback callback;
+        DeadlineMap::iterator slot;
+    };
+
+    int epfd;
+    int timerfd;
+    int sigfd;
+    int wakefd;
+    sigset_t sigmask;
+    bool running;
+
+    std::unordered_map<int, std::shared_ptr<FdEntry> > fds;
+    uint64_t nextGeneration;
+
+    std::unordered_map<TimerId, Timer> timers;
+    DeadlineMap deadlines;
+    TimerId nextTimerId;
+    uint64_t armedDeadline;
+
+    std::unordered_map<int, SignalCallback> signals;
+
+    std::mutex postMutex;
+    std::vector<std::function<void()> > posted;
+
+    TimerId scheduleTimer(uint64_t delayMs, uint64_t intervalMs, TimerCallback cb) {
+        TimerId id = nextTimerId++;
+        Timer timer;
+        timer.intervalNs = intervalMs * 1000000ull;
+        timer.callback = cb;
+        timer.slot = deadlines.insert(std::make_pair(nowNs() + delayMs * 1000000ull, id));
+        timers[id] = timer;
+        rearm();
+        return id;
+    }
+
+    // Points the timerfd at the earliest pending deadline
+    void rearm() {
+        uint64_t deadline = deadlines.empty() ? 0 : deadlines.begin()->first;
+        if (deadline == armedDeadline) return;
+        armedDeadline = deadline;
+
+        struct itimerspec spec;
+        std::memset(&spec, 0, sizeof(spec));
+        if (deadline != 0) {
+            spec.it_value.tv_sec = deadline / 1000000000ull;
+            spec.it_value.tv_nsec = deadline % 1000000000ull;
+        }
+        timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    void onTimerFd() {
+        uint64_t expirations;
+        while (read(timerfd, &expirations, sizeof(expirations)) > 0) {}
+        armedDeadline = 0;
+
+        // Collect first: callbacks may add or cancel timers
+        uint64_t now = nowNs();
+        std::vector<TimerId> due;
+        for (DeadlineMap::iterator it = deadlines.begin();
+             it != deadlines.end() && it->first <= now; ++it) {
+            due.push_back(it->second);
+        }
+
+        for (size_t i = 0; i < due.size(); i++) {
+            std::unordered_map<TimerId, Timer>::iterator it = timers.find(due[i]);
+            if (it == timers.end()) continue;
+
+            TimerCallback cb = it->second.callback;
+            deadlines.erase(it->second.slot);
+            if (it->second.intervalNs > 0) {
+                it->second.slot = deadlines.insert(
+                    std::make_pair(now + it->second.intervalNs, due[i]));
+            } else {
+                timers.erase(it);
+            }
+            cb();
+        }
+        rearm();
+    }
+
+    void onWakeFd() {
+        uint64_t count;
+        while (read(wakefd, &count, sizeof(count)) > 0) {}
+
+        std::vector<std::function<void()> > work;
+        {
+            std::lock_guard<std::mutex> lock(postMutex);
+            work.swap(posted);
+        }
+        for (size_t i = 0; i < work.size(); i++) {
+            work[i]();
+        }
+    }
+
+    void onSignalFd() {
+        struct signalfd_siginfo info;
+        while (read(sigfd, &info, sizeof(info)) == sizeof(info)) {
+            std::unordered_map<int, SignalCallback>::iterator it =
+                signals.find(static_cast<int>(info.ssi_signo));
+            if (it != signals.end()) {
+                it->second(info);
+            }
+        }
+    }
+};
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,147 @@
+#ifndef EVENT_STATS_H
+#define EVENT_STATS_H
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "client_protocol_packets.h"
+#include "latency_histogram.h"
+
+// Per-button latency statistics, keyed by (conn_id, event opcode).
+//
+// For every button event two distributions are kept: the event age reported
+// by flicd in time_diff (ms), and the local dispatch latency from the recv()
+// that delivered the frame until its handler returned (ns). Histograms are
+// created the first time a key is seen.
+class EventStats {
+public:
+    // Dispatch latencies above ~68 s are clamped
+    static const uint64_t kMaxDispatchNs = 1ull << 36;
+
+    struct Entry {
+        LatencyHistogram ageMs;
+        LatencyHistogram dispatchNs;
+
+        Entry() : ageMs(0xffffffffull), dispatchNs(kMaxDispatchNs) {}
+    };
+
+    static bool isButtonEvent(uint8_t opcode) {
+        return opcode == FlicClientProtocol::EVT_BUTTON_UP_OR_DOWN_OPCODE ||
+               opcode == FlicClientProtocol::EVT_BUTTON_CLICK_OR_HOLD_OPCODE ||
+               opcode == FlicClientProtocol::EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OPCODE ||
+               opcode == FlicClientProtocol::EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE;
+    }
+
+    static const char* eventName(uint8_t opcode) {
+        switch (opcode) {
+            case FlicClientProtocol::EVT_BUTTON_UP_OR_DOWN_OPCODE:
+                return "ButtonUpOrDown";
+            case FlicClientProtocol::EVT_BUTTON_CLICK_OR_HOLD_OPCODE:
+                return "ButtonClickOrHold";
+            case FlicClientProtocol::EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OPCODE:
+                return "ButtonSingleOrDoubleClick";
+            case FlicClientProtocol::EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE:
+                return "ButtonSingleOrDoubleClickOrHold";
+            default:
+                return "Unknown";
+        }
+    }
+
+    void record(uint32_t conn_id, uint8_t opcode, uint32_t ageMs, uint64_t dispatchNs) {
+        Entry& entry = entries[key(conn_id, opcode)];
+        entry.ageMs.record(ageMs);
+        entry.dispatchNs.record(dispatchNs);
+    }
+
+    void reset() { entries.clear(); }
+    bool empty() const { return entries.empty(); }
+
+    // Human readable table; ages in ms, dispatch latency in us
+    void writeTable(std::ostream& out) const {
+        std::vector<uint64_t> keys = sortedKeys();
+        if (keys.empty()) {
+            out << "No button events recorded" << std::endl;
+            return;
+        }
+
+        out << std::left << std::setw(10) << "conn_id" << std::setw(33) << "event"
+            << std::right << std::setw(9) << "count" << "  "
+            << std::left << std::setw(30) << "age ms p50/p99/p999/max"
+            << "dispatch us p50/p99/p999/max" << std::endl;
+        for (size_t i = 0; i < keys.size(); i++) {
+            const Entry& e = entries.find(keys[i])->second;
+            out << std::left << std::setw(10) << (keys[i] >> 8)
+                << std::setw(33) << eventName(static_cast<uint8_t>(keys[i]))
+                << std::right << std::setw(9) << e.ageMs.count() << "  "
+                << std::left << std::setw(30) << summary(e.ageMs, 1)
+                << summary(e.dispatchNs, 1000) << std::right << std::endl;
+        }
+    }
+
+    // One JSON object per line and key, for scripts and dashboards
+    void writeJson(std::ostream& out, const std::string& source) const {
+        std::vector<uint64_t> keys = sortedKeys();
+        for (size_t i = 0; i < keys.size(); i++) {
+            const Entry& e = entries.find(keys[i])->second;
+            out << "{\"source\":\"" << source << "\""
+                << ",\"conn_id\":" << (keys[i] >> 8)
+                << ",\"event\":\"" << eventName(static_cast<uint8_t>(keys[i])) << "\""
+                << ",\"count\":" << e.ageMs.count()
+                << ",\"age_ms\":";
+            writeJsonHistogram(out, e.ageMs);
+            out << ",\"dispatch_ns\":";
+            writeJsonHistogram(out, e.dispatchNs);
+            out << "}" << std::endl;
+        }
+    }
+
+private:
+    std::unordered_map<uint64_t, Entry> entries;
+
+    static uint64_t key(uint32_t conn_id, uint8_t opcode) {
+        return (static_cast<uint64_t>(conn_id) << 8) | opcode;
+    }
+
+    std::vector<uint64_t> sortedKeys() const {
+        std::vector<uint64_t> keys;
+        keys.reserve(entries.size());
+        for (std::unordered_map<uint64_t, Entry>::const_iterator it = entries.begin();
+             it != entries.end(); ++it) {
+            keys.push_back(it->first);
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+
+    // "p50/p99/p999/max" with values divided by scale
+    static std::string summary(const LatencyHistogram& h, uint64_t scale) {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(scale > 1 ? 1 : 0)
+           << static_cast<double>(h.percentile(50)) / scale << "/"
+           << static_cast<double>(h.percentile(99)) / scale << "/"
+           << static_cast<double>(h.percentile(99.9)) / scale << "/"
+           << static_cast<double>(h.max()) / scale;
+        return ss.str();
+    }
+
+    static void writeJsonHistogram(std::ostream& out, const LatencyHistogram& h) {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << "{\"min\":" << h.min()
+            << ",\"p50\":" << h.percentile(50)
+            << ",\"p99\":" << h.percentile(99)
+            << ",\"p999\":" << h.percentile(99.9)
+            << ",\"max\":" << h.max()
+            << ",\"mean\":" << std::fixed << std::setprecision(1) << h.mean() << "}";
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
+
+#endif // EVENT_STATS_H
@@ -1,809 +1,1564 @@
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <cstring>
 #include <memory>
-#include <unordered_map>
 #include <vector>
 #include <sstream>
+#include <fstream>
 #include <iomanip>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
 
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <netdb.h>
+#include <sys/stat.h>
 #include <unistd.h>
-#include <poll.h>
-#include <arpa/inet.h>
 
-#include "client_protocol_packets.h"
+#include "flic_client.h"
+#include "action_engine.h"
+#include "event_bus.h"
+#include "event_formatter.h"
+#include "output_buffer.h"
 
 using namespace FlicClientProtocol;
 
-// Helper class for Bluetooth address handling
-class BdAddr {
+// Reads what is available on fd without stdio buffering and calls onLine for
+// every complete line, so lines that arrive together are all handled. A final
+// unterminated line is delivered at EOF. Returns false on EOF/error or when
+// onLine returns false.
+static bool readLines(int fd, std::string& buffer,
+                      const std::function<bool(const std::string&)>& onLine) {
+    char buf[4096];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+        if (!buffer.empty()) {
+            onLine(buffer);
+            buffer.clear();
+        }
+        return false;
+    }
+    buffer.append(buf, static_cast<size_t>(n));
+
+    size_t start = 0;
+    size_t nl;
+    bool keepGoing = true;
+    while (keepGoing && (nl = buffer.find('\n', start)) != std::string::npos) {
+        std::string line = buffer.substr(start, nl - start);
+        start = nl + 1;
+        keepGoing = onLine(line);
+    }
+    buffer.erase(0, start);
+    return keepGoing;
+}
+
+// Console front end for one FlicClient: formats every event into a reusable
+// output buffer, written once per loop iteration, and runs the interactive
+// command set on top of the library
+class ConsoleClient : public FlicClientObserver {
 private:
-    uint8_t addr[6];
+    FlicClient client;
+    std::string inputBuffer;
 
-    static uint8_t hexDigitToInt(char c) {
-        if (c >= '0' && c <= '9') return c - '0';
-        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-        return 0;
+    EventFormatter formatter;
+    OutputBuffer buffer;
+    std::ostream text;  // operator<< into buffer, for command replies
+
+    // Hub mode: every client writes its buffer under a mutex shared by all
+    // workers; human output is prefixed with the source tag line by line
+    std::mutex* outputMutex;
+    OutputBuffer tagged;
+    std::function<void()> disconnectHandler;
+
+    ActionEngine* actions;  // not owned; may be shared by hub clients
+    std::unique_ptr<EventBus> bus;
+
+    std::string buttonInfoPath;
+    EventLoop::TimerId buttonInfoTimer;
+    static const uint64_t kButtonInfoSaveMs = 10000;
+
+    std::string sessionPath;
+    EventLoop::TimerId sessionTimer;
+    uint64_t savedSessionChanges;
+    static const uint64_t kSessionSaveMs = 1000;
+
+    // Console text. With json or binary output, stdout carries only event
+    // records and everything else goes to stderr.
+    std::ostream& out() {
+        if (formatter.format() == EventFormatter::Human) return text;
+        return std::cerr;
     }
 
-    static uint8_t hexToByte(const char* hex) {
-        return (hexDigitToInt(hex[0]) << 4) | hexDigitToInt(hex[1]);
+    bool jsonOutput() const { return formatter.format() == EventFormatter::Json; }
+
+    void onError(const char* what, int err) override {
+        if (err != 0) {
+            std::cerr << what << " (" << client.sourceTag() << "): " << std::strerror(err) << std::endl;
+        } else {
+            std::cerr << what << " (" << client.sourceTag() << ")" << std::endl;
+        }
     }
 
-public:
-    BdAddr() {
-        std::memset(addr, 0, 6);
+    void onConnected() override {
+        if (jsonOutput()) return formatter.lifecycle(buffer, "Connected");
+        out() << "Connected to Flic server at " << client.sourceTag() << std::endl;
     }
 
-    explicit BdAddr(const std::string& addrStr) {
-        fromString(addrStr);
+    void onDisconnected(bool reconnecting) override {
+        if (jsonOutput()) {
+            formatter.lifecycle(buffer, "Disconnected");
+        } else {
+            out() << "Server disconnected" << std::endl;
+        }
+        if (reconnecting) return;
+        flushOutput();
+        if (disconnectHandler) {
+            disconnectHandler();
+        } else {
+            client.eventLoop().stop();
+        }
     }
 
-    explicit BdAddr(const uint8_t* a) {
-        std::memcpy(addr, a, 6);
+    void onReconnectScheduled(uint64_t delayMs, unsigned attempt) override {
+        if (jsonOutput()) {
+            return formatter.lifecycle(buffer, "ReconnectScheduled", "delay_ms", delayMs, "attempt", attempt);
+        }
+        out() << "Reconnecting to " << client.sourceTag() << " in " << delayMs
+              << " ms (attempt " << attempt << ")" << std::endl;
     }
 
-    void fromString(const std::string& addrStr) {
-        // Format: "xx:xx:xx:xx:xx:xx"
-        for (int i = 0, pos = 15; i < 6; i++, pos -= 3) {
-            addr[i] = hexToByte(&addrStr[pos]);
+    void onReconnected(unsigned attempts, uint64_t outageMs,
+                       size_t channels, size_t scanners) override {
+        if (jsonOutput()) {
+            return formatter.lifecycle(buffer, "Reconnected", "attempts", attempts, "outage_ms", outageMs);
         }
+        out() << "Reconnected to " << client.sourceTag() << " after " << attempts
+              << " attempts, " << outageMs << " ms; replaying " << channels
+              << " channels and " << scanners << " scanners" << std::endl;
     }
 
-    std::string toString() const {
-        std::stringstream ss;
-        for (int i = 5; i >= 0; i--) {
-            ss << std::hex << std::setw(2) << std::setfill('0') << (int)addr[i];
-            if (i > 0) ss << ":";
+    void onRecoveryComplete(size_t ready, size_t total, uint64_t elapsedMs) override {
+        if (jsonOutput()) {
+            return formatter.lifecycle(buffer, "RecoveryComplete", "channels_ready", ready, "elapsed_ms", elapsedMs);
         }
-        return ss.str();
+        out() << "Recovery complete: " << ready << "/" << total << " channels ready "
+              << elapsedMs << " ms after disconnect" << std::endl;
     }
 
-    const uint8_t* data() const { return addr; }
-    uint8_t* data() { return addr; }
-};
+    void onProvisioningComplete(size_t ready, size_t total, uint64_t elapsedMs) override {
+        const FlicClient::ProvisioningStatus& status = client.provisioning();
+        if (jsonOutput()) {
+            return formatter.lifecycle(buffer, "ProvisioningComplete", "channels_ready", ready, "elapsed_ms", elapsedMs);
+        }
+        out() << "Provisioning complete: " << ready << "/" << total << " channels ready in "
+              << elapsedMs << " ms (" << status.rejections << " rejected and retried, "
+              << status.parkedNs / 1000000ull << " ms waiting for space)" << std::endl;
+    }
 
-// Main Flic Client class
-class FlicClient {
-private:
-    int sockfd;
-    std::string host;
-    int port;
-    bool connected;
-    
-    std::unordered_map<uint32_t, std::string> connections; // conn_id -> bdaddr
-    std::unordered_map<uint32_t, std::string> scanners;    // scan_id -> name
-
-    // Helper function to write packets
-    bool writePacket(const void* data, size_t len) {
-        uint16_t length = static_cast<uint16_t>(len);
-        
-        // Write length header (little endian)
-        if (write(sockfd, &length, 2) != 2) {
-            std::cerr << "Failed to write packet length" << std::endl;
-            return false;
+    void onBatteryAlert(const BatteryMonitor::Series& series, uint8_t level) override {
+        if (jsonOutput()) return formatter.batteryAlert(buffer, series, level);
+        uint8_t addr[6];
+        unpackAddress(series.addr, addr);
+        out() << "Battery " << EventFormatter::batteryLevelName(level) << ": "
+              << BdAddr(addr).toString() << " at " << static_cast<int>(series.latest().last) << "%";
+        double days = series.daysLeft();
+        if (days >= 0) out() << ", about " << static_cast<int>(days + 0.5) << " days left";
+        out() << std::endl;
+    }
+
+    void onSpeculativeClick(const ClickRecognizer::Speculation& s) override {
+        const ChannelTable::Channel* channel = client.channels().find(s.connId);
+        uint8_t addr[6];
+        if (channel) channel->address(addr);
+        if (actions && channel) {
+            actions->submit(addr, s.connId, s.clickType == ClickTypeButtonHold ?
+                                            ActionEngine::EarlyHold : ActionEngine::EarlyClick);
+        }
+        if (jsonOutput()) return formatter.speculation(buffer, s, channel ? addr : nullptr);
+        out() << "Speculative " << EventFormatter::clickTypeName(s.clickType) << " (conn_id: "
+              << s.connId << ", pressed " << (s.speculatedNs - s.downNs) / 1000000ull << " ms)"
+              << std::endl;
+    }
+
+    void onSpeculationResolved(const ClickRecognizer::Speculation& s) override {
+        if (jsonOutput()) {
+            const ChannelTable::Channel* channel = client.channels().find(s.connId);
+            uint8_t addr[6];
+            if (channel) channel->address(addr);
+            return formatter.speculation(buffer, s, channel ? addr : nullptr);
+        }
+        uint64_t leadMs = (s.resolvedNs - s.speculatedNs) / 1000000ull;
+        out() << "Speculative " << EventFormatter::clickTypeName(s.clickType) << " (conn_id: "
+              << s.connId << ") ";
+        if (s.outcome == ClickRecognizer::Confirmed) {
+            out() << "confirmed, " << leadMs << " ms early";
+        } else if (s.outcome == ClickRecognizer::Retracted) {
+            out() << "retracted: was " << EventFormatter::clickTypeName(s.actualClickType);
+        } else {
+            out() << "expired after " << leadMs << " ms";
+        }
+        out() << std::endl;
+    }
+
+    void onAdvertisementPacket(const EvtAdvertisementPacket& evt) override {
+        formatter.advertisement(buffer, evt);
+    }
+
+    void onAdvertisementChanged(const AdvertisementTable::Entry& entry, unsigned changes) override {
+        formatter.advertisementChange(buffer, entry, changes, EventLoop::nowMs());
+    }
+
+    void onAdvertisementDigest(const AdvertisementTable& table) override {
+        formatter.advertisementDigest(buffer, table, EventLoop::nowMs());
+    }
+
+    void onCreateConnectionChannelResponse(const EvtCreateConnectionChannelResponse& evt) override {
+        formatter.createConnectionChannelResponse(buffer, evt);
+    }
+
+    void onConnectionStatusChanged(const EvtConnectionStatusChanged& evt) override {
+        formatter.connectionStatusChanged(buffer, evt);
+    }
+
+    void onConnectionChannelRemoved(const EvtConnectionChannelRemoved& evt) override {
+        formatter.connectionChannelRemoved(buffer, evt);
+    }
+
+    void onStaleEvent(const EvtButtonUpOrDown& evt, uint64_t ageMs, uint32_t collapsed) override {
+        formatter.staleEvent(buffer, evt, ageMs, collapsed);
+    }
+
+    void onButtonUpOrDown(const EvtButtonUpOrDown& evt) override {
+        formatter.buttonEvent(buffer, evt);
+        submitAction(evt);
+    }
+
+    void onButtonClickOrHold(const EvtButtonClickOrHold& evt) override {
+        formatter.buttonEvent(buffer, reinterpret_cast<const EvtButtonUpOrDown&>(evt));
+        submitAction(reinterpret_cast<const EvtButtonUpOrDown&>(evt));
+    }
+
+    void onButtonSingleOrDoubleClick(const EvtButtonSingleOrDoubleClick& evt) override {
+        formatter.buttonEvent(buffer, reinterpret_cast<const EvtButtonUpOrDown&>(evt));
+    }
+
+    void onButtonSingleOrDoubleClickOrHold(const EvtButtonSingleOrDoubleClickOrHold& evt) override {
+        formatter.buttonEvent(buffer, reinterpret_cast<const EvtButtonUpOrDown&>(evt));
+        submitAction(reinterpret_cast<const EvtButtonUpOrDown&>(evt));
+    }
+
+    // All four button event packets share EvtButtonUpOrDown's layout
+    void submitAction(const EvtButtonUpOrDown& evt) {
+        if (!actions) return;
+        int trigger = ActionEngine::triggerFor(evt.opcode, evt.click_type);
+        const ChannelTable::Channel* channel = client.channels().find(evt.conn_id);
+        if (trigger < 0 || !channel) return;
+        uint8_t addr[6];
+        channel->address(addr);
+        uint64_t nowNs = EventLoop::nowNs();
+        uint64_t ageNs = evt.time_diff * 1000000ull;
+        actions->submit(addr, evt.conn_id, trigger, nowNs > ageNs ? nowNs - ageNs : 1);
+    }
+
+    void onNewVerifiedButton(const EvtNewVerifiedButton& evt) override {
+        formatter.newVerifiedButton(buffer, evt);
+    }
+
+    void onGetInfoResponse(const EvtGetInfoResponse& evt,
+                           const VerifiedButtonList& verifiedButtons) override {
+        formatter.getInfoResponse(buffer, evt, verifiedButtons);
+    }
+
+    void onNoSpaceForNewConnection(const EvtNoSpaceForNewConnection& evt) override {
+        formatter.noSpaceForNewConnection(buffer, evt);
+    }
+
+    void onGotSpaceForNewConnection(const EvtGotSpaceForNewConnection& evt) override {
+        formatter.gotSpaceForNewConnection(buffer, evt);
+    }
+
+    void onBluetoothControllerStateChange(const EvtBluetoothControllerStateChange& evt) override {
+        formatter.bluetoothControllerStateChange(buffer, evt);
+    }
+
+    void onPingResponse(const EvtPingResponse& evt) override {
+        formatter.pingResponse(buffer, evt);
+    }
+
+    void onGetButtonInfoResponse(const EvtGetButtonInfoResponse& evt,
+                                 const ButtonInfoView& info) override {
+        formatter.getButtonInfoResponse(buffer, evt, info);
+    }
+
+    void onScanWizardFoundPrivateButton(const EvtScanWizardFoundPrivateButton& evt) override {
+        formatter.scanWizardFoundPrivateButton(buffer, evt);
+    }
+
+    void onScanWizardFoundPublicButton(const EvtScanWizardFoundPublicButton& evt) override {
+        formatter.scanWizardFoundPublicButton(buffer, evt);
+    }
+
+    void onScanWizardButtonConnected(const EvtScanWizardButtonConnected& evt) override {
+        formatter.scanWizardButtonConnected(buffer, evt);
+    }
+
+    void onScanWizardCompleted(const EvtScanWizardCompleted& evt) override {
+        formatter.scanWizardCompleted(buffer, evt);
+    }
+
+    void onButtonDeleted(const EvtButtonDeleted& evt) override {
+        formatter.buttonDeleted(buffer, evt);
+    }
+
+    void onBatteryStatus(const EvtBatteryStatus& evt) override {
+        formatter.batteryStatus(buffer, evt);
+    }
+
+    void onUnknownPacket(const uint8_t* data, size_t len) override {
+        formatter.unknownPacket(buffer, data, len);
+    }
+
+    void onPacket(const uint8_t* data, size_t len) override {
+        if (!bus || len == 0 || !bus->wants(data[0])) return;
+        EventBus::Event e = EventBus::describe(data, len);
+        uint8_t addr[6];
+        if (!e.addr && e.hasConnId) {
+            if (const ChannelTable::Channel* channel = client.channels().find(e.connId)) {
+                channel->address(addr);
+                e.addr = addr;
+            }
+        }
+        bus->publish(e);
+    }
+
+    void onDispatchDone() override {
+        flushOutput();
+        if (bus) bus->flush();
+    }
+
+    void onStdinReadable() {
+        if (!readLines(STDIN_FILENO, inputBuffer,
+                       [this](const std::string& line) { return handleCommand(line); })) {
+            client.eventLoop().stop();
+        }
+        flushOutput();
+    }
+
+    void printReaderStats() {
+        const ThreadedReader* reader = client.threadedReader();
+        if (!reader) return;
+        const FrameQueue& frames = reader->frames();
+        out() << "Reader thread: " << reader->recvCount() << " recv calls, "
+              << frames.pushCount() << " frames queued, "
+              << reader->dropCount() << " dropped, "
+              << reader->blockedCount() << " blocked waits, high water "
+              << frames.highWaterBytes() << "/" << frames.capacity() << " bytes ("
+              << (reader->overflowPolicy() == ThreadedReader::Block ? "block" : "drop")
+              << " on overflow)" << std::endl;
+    }
+
+    void printReconnectStats() {
+        const LatencyHistogram& reconnectMs = client.reconnectLatency();
+        const LatencyHistogram& channelsReadyMs = client.recoveryLatency();
+        if (reconnectMs.count() == 0) return;
+        out() << "Reconnects: " << reconnectMs.count() << ", reconnect ms p50/max "
+              << reconnectMs.percentile(50) << "/" << reconnectMs.max();
+        if (channelsReadyMs.count() > 0) {
+            out() << ", all channels ready ms p50/max " << channelsReadyMs.percentile(50)
+                  << "/" << channelsReadyMs.max();
+        }
+        out() << std::endl;
+    }
+
+    void printPingStats() {
+        const LatencyHistogram& rtt = client.pingLatency();
+        if (rtt.count() == 0 && client.keepaliveTimeouts() == 0) return;
+        out() << "Pings: " << rtt.count() << ", RTT us p50/p99/max " << rtt.percentile(50)
+              << "/" << rtt.percentile(99) << "/" << rtt.max() << ", timeouts "
+              << client.keepaliveTimeouts() << std::endl;
+    }
+
+    void printActionStats() {
+        if (!actions) {
+            out() << "No action rules (see --actions)" << std::endl;
+            return;
+        }
+        ActionEngine::Stats stats = actions->stats();
+        out() << "Actions: " << actions->ruleCount() << " rules for " << actions->buttonCount()
+              << " buttons and *, " << actions->workerThreads() << " workers, queue "
+              << actions->queueCapacity() << std::endl;
+        out() << "  submitted " << stats.submitted << ", completed " << stats.completed
+              << ", failed " << stats.failed << ", dropped " << stats.dropped << ", expired "
+              << stats.expired << std::endl;
+        out() << "  backlog " << stats.backlog << " (high water " << stats.backlogHighWater << ")"
+              << std::endl;
+        out() << "  queue wait us p50/p99/max " << stats.queueUs.percentile(50) << "/"
+              << stats.queueUs.percentile(99) << "/" << stats.queueUs.max() << std::endl;
+        out() << "  run time us p50/p99/max " << stats.runUs.percentile(50) << "/"
+              << stats.runUs.percentile(99) << "/" << stats.runUs.max() << std::endl;
+    }
+
+    void printBusStats() {
+        if (!bus) {
+            out() << "No event bus (see --bus)" << std::endl;
+            return;
+        }
+        const EventBus::Stats& stats = bus->stats();
+        size_t largest;
+        size_t queued = bus->queuedBytes(&largest);
+        out() << "Event bus " << bus->path() << ": " << bus->subscriberCount() << " subscribers ("
+              << stats.accepted << " accepted, " << stats.rejected << " rejected)" << std::endl;
+        out() << "  published " << stats.published << ", encoded " << stats.encoded << ", queued "
+              << stats.queued << ", dropped " << stats.dropped << std::endl;
+        out() << "  writes " << stats.writes << ", bytes " << stats.bytes << ", waiting " << queued
+              << " bytes (largest queue " << largest << ")" << std::endl;
+    }
+
+    void printFreshnessStats() {
+        if (!client.freshnessPolicy()) return;
+        const FreshnessPolicy::Stats& stats = client.freshnessStats();
+        out() << "Freshness: " << stats.stale << " stale (" << stats.dropped << " dropped, "
+              << stats.flagged << " flagged), " << stats.collapsed << " collapsed, "
+              << stats.reordered << " reordered in " << stats.backlogs << " backlogs";
+        if (stats.lateMs.count() > 0) {
+            out() << ", late ms p50/p99/max " << stats.lateMs.percentile(50) << "/"
+                  << stats.lateMs.percentile(99) << "/" << stats.lateMs.max();
         }
-        
-        // Write packet data
-        if (write(sockfd, data, len) != static_cast<ssize_t>(len)) {
-            std::cerr << "Failed to write packet data" << std::endl;
+        out() << std::endl;
+    }
+
+    void printSpeculationStats() {
+        const ClickRecognizer* recognizer = client.clickRecognizer();
+        if (!recognizer) return;
+        const ClickRecognizer::Stats& stats = recognizer->stats();
+        out() << "Speculation: " << stats.speculations << " guesses, " << stats.confirmed
+              << " confirmed, " << stats.retracted << " retracted, " << stats.expired
+              << " expired, " << stats.missed << " missed";
+        if (stats.leadMs.count() > 0) {
+            out() << ", confirmed lead ms p50/p99/max " << stats.leadMs.percentile(50) << "/"
+                  << stats.leadMs.percentile(99) << "/" << stats.leadMs.max();
+        }
+        out() << std::endl;
+    }
+
+    void printAdvertisements() {
+        const AdvertisementTable& table = client.advertisements();
+        out() << "Advertisements: " << table.size() << " buttons, " << table.packets()
+              << " packets" << std::endl;
+        uint64_t now = EventLoop::nowMs();
+        table.forEach([this, now](const AdvertisementTable::Entry& entry) {
+            out() << "  " << BdAddr(entry.last.bd_addr).toString()
+                  << " RSSI: " << static_cast<int>(entry.rssi()) << " dBm, "
+                  << entry.packets << " packets, last seen " << (now - entry.lastSeenMs)
+                  << " ms ago" << std::endl;
+        });
+    }
+
+    void printBatteries() {
+        const BatteryMonitor& monitor = client.batteries();
+        std::vector<const BatteryMonitor::Series*> sorted;
+        monitor.forEach([&sorted](const BatteryMonitor::Series& series) { sorted.push_back(&series); });
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const BatteryMonitor::Series* a, const BatteryMonitor::Series* b) {
+                      return a->latest().last < b->latest().last;
+                  });
+
+        out() << "Batteries: " << monitor.size() << " buttons, " << monitor.readings()
+              << " readings, alerts at " << monitor.lowThreshold() << "%/"
+              << monitor.criticalThreshold() << "%" << std::endl;
+        if (sorted.empty()) return;
+        out() << std::left << std::setw(19) << "bd_addr" << std::setw(10) << "level"
+              << std::right << std::setw(8) << "percent" << std::setw(12) << "age s"
+              << std::setw(10) << "%/day" << std::setw(11) << "days left" << std::endl;
+        uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+        for (size_t i = 0; i < sorted.size(); i++) {
+            const BatteryMonitor::Series& series = *sorted[i];
+            uint8_t addr[6];
+            unpackAddress(series.addr, addr);
+            char rate[16];
+            char days[16];
+            std::snprintf(rate, sizeof(rate), "%.2f", series.percentPerDay());
+            if (series.daysLeft() >= 0) {
+                std::snprintf(days, sizeof(days), "%.0f", series.daysLeft());
+            } else {
+                std::snprintf(days, sizeof(days), "-");
+            }
+            out() << std::left << std::setw(19) << BdAddr(addr).toString()
+                  << std::setw(10) << EventFormatter::batteryLevelName(series.level)
+                  << std::right << std::setw(8) << static_cast<int>(series.latest().last)
+                  << std::setw(12) << (now > series.latest().end ? now - series.latest().end : 0)
+                  << std::setw(10) << rate << std::setw(11) << days << std::endl;
+        }
+    }
+
+    void printBatteryHistory(const BdAddr& addr) {
+        const BatteryMonitor::Series* series = client.batteries().find(addr.data());
+        if (!series) {
+            out() << "No battery readings for " << addr.toString() << std::endl;
+            return;
+        }
+        out() << addr.toString() << ": " << static_cast<int>(series->count) << " buckets of "
+              << series->windowSeconds << " s" << std::endl;
+        for (size_t i = 0; i < series->count; i++) {
+            const BatteryMonitor::Sample& sample = series->samples[i];
+            out() << "  " << sample.start << "-" << sample.end << "  min "
+                  << static_cast<int>(sample.min) << "  max " << static_cast<int>(sample.max)
+                  << "  last " << static_cast<int>(sample.last) << "  readings "
+                  << static_cast<int>(sample.readings) << std::endl;
+        }
+    }
+
+    void printButtonInfo() {
+        const ButtonInfoCache& cache = client.buttonInfo();
+        std::vector<const ButtonInfoCache::Entry*> sorted;
+        cache.forEach([&sorted](const ButtonInfoCache::Entry& entry) { sorted.push_back(&entry); });
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const ButtonInfoCache::Entry* a, const ButtonInfoCache::Entry* b) {
+                      return a->addr < b->addr;
+                  });
+
+        out() << "Button info: " << cache.size() << " buttons, " << cache.pendingCount()
+              << " requests in flight" << std::endl;
+        if (sorted.empty()) return;
+        out() << std::left << std::setw(19) << "bd_addr" << std::setw(24) << "name"
+              << std::setw(18) << "serial" << std::right << std::setw(6) << "flic"
+              << std::setw(10) << "firmware" << std::setw(12) << "age s" << std::endl;
+        uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+        for (size_t i = 0; i < sorted.size(); i++) {
+            const ButtonInfoCache::Entry& entry = *sorted[i];
+            uint8_t addr[6];
+            unpackAddress(entry.addr, addr);
+            out() << std::left << std::setw(19) << BdAddr(addr).toString()
+                  << std::setw(24) << std::string(entry.name, entry.nameLength)
+                  << std::setw(18) << std::string(entry.serialNumber, entry.serialLength)
+                  << std::right << std::setw(6) << static_cast<int>(entry.flicVersion)
+                  << std::setw(10) << entry.firmwareVersion
+                  << std::setw(12) << (now > entry.fetchedAt ? now - entry.fetchedAt : 0) << std::endl;
+        }
+    }
+
+    // One "bdaddr [conn_id]" per line, '#' starts a comment. Without a
+    // conn_id the next one above every conn_id in use is taken.
+    bool loadButtonFile(const std::string& path, FlicClient::ButtonList& buttons) {
+        std::ifstream file(path.c_str());
+        if (!file) {
+            out() << "Failed to open " << path << std::endl;
             return false;
         }
-        
+        uint32_t nextId = 1;
+        client.channels().forEach([&nextId](const ChannelTable::Channel& channel) {
+            if (channel.connId >= nextId) nextId = channel.connId + 1;
+        });
+
+        std::string line;
+        size_t lineNo = 0;
+        while (std::getline(file, line)) {
+            lineNo++;
+            std::istringstream iss(line);
+            std::string word;
+            if (!(iss >> word) || word[0] == '#') continue;
+            BdAddr addr;
+            uint32_t conn_id = nextId;
+            if (!addr.fromString(word) || (!(iss >> conn_id) && !iss.eof())) {
+                out() << path << ":" << lineNo << ": expected <bdaddr> [conn_id]" << std::endl;
+                return false;
+            }
+            if (conn_id >= nextId) nextId = conn_id + 1;
+            buttons.push_back(std::make_pair(addr, conn_id));
+        }
         return true;
     }
 
-    // Helper function to read packets
-    ssize_t readPacket(void* buffer, size_t maxLen) {
-        uint16_t length;
-        
-        // Read length header
-        ssize_t n = read(sockfd, &length, 2);
-        if (n != 2) {
-            if (n == 0) {
-                std::cout << "Server disconnected" << std::endl;
+    void printProvisioning() {
+        const FlicClient::ProvisioningStatus& status = client.provisioning();
+        if (status.total == 0) {
+            out() << "No connectAll run" << std::endl;
+            return;
+        }
+        out() << "Provisioning " << (status.active ? "in progress" : "complete") << ": "
+              << status.ready << "/" << status.total << " ready, " << status.failed << " failed, "
+              << client.pendingChannels() << " pending, " << client.queuedChannels() << " queued, "
+              << status.rejections << " rejected";
+        if (!status.active) out() << ", took " << status.elapsedMs << " ms";
+        out() << std::endl;
+    }
+
+    void printChannels() {
+        const ChannelTable& table = client.channels();
+        std::vector<const ChannelTable::Channel*> sorted;
+        table.forEach([&sorted](const ChannelTable::Channel& channel) { sorted.push_back(&channel); });
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const ChannelTable::Channel* a, const ChannelTable::Channel* b) {
+                      return a->connId < b->connId;
+                  });
+
+        out() << "Channels: " << table.size() << ", " << client.modeChanges() << " mode changes"
+              << std::endl;
+        if (sorted.empty()) return;
+        out() << std::left << std::setw(10) << "conn_id" << std::setw(19) << "bd_addr"
+              << std::setw(14) << "status" << std::setw(8) << "mode"
+              << std::right << std::setw(10) << "events" << std::setw(16) << "last event ms"
+              << std::setw(13) << "disconnects" << "  name" << std::endl;
+        static const char* const statusNames[] = { "Disconnected", "Connected", "Ready" };
+        static const char* const modeNames[] = { "Normal", "Low", "High" };
+        uint64_t now = EventLoop::nowNs();
+        for (size_t i = 0; i < sorted.size(); i++) {
+            const ChannelTable::Channel& channel = *sorted[i];
+            uint8_t addr[6];
+            channel.address(addr);
+            std::string status = (channel.flags & ChannelTable::Queued) ? "Queued" :
+                                 channel.status < 3 ? statusNames[channel.status] : "Unknown";
+            if (channel.flags & ChannelTable::AwaitingReady) status += "*";
+            out() << std::left << std::setw(10) << channel.connId
+                  << std::setw(19) << BdAddr(addr).toString()
+                  << std::setw(14) << status
+                  << std::setw(8) << (channel.latencyMode < 3 ? modeNames[channel.latencyMode] : "?")
+                  << std::right << std::setw(10) << channel.events << std::setw(16);
+            if (channel.lastEventNs) {
+                out() << (now - channel.lastEventNs) / 1000000ull;
+            } else {
+                out() << "-";
             }
-            return -1;
-        }
-        
-        if (length > maxLen) {
-            std::cerr << "Packet too large: " << length << " bytes" << std::endl;
-            return -1;
-        }
-        
-        // Read packet data
-        n = read(sockfd, buffer, length);
-        if (n != length) {
-            std::cerr << "Failed to read complete packet" << std::endl;
-            return -1;
-        }
-        
-        return length;
-    }
-
-    void handlePacket(const uint8_t* data, size_t len) {
-        if (len < 1) return;
-        
-        uint8_t opcode = data[0];
-        
-        switch (opcode) {
-            case EVT_ADVERTISEMENT_PACKET_OPCODE:
-                handleAdvertisementPacket(reinterpret_cast<const EvtAdvertisementPacket*>(data));
-                break;
-                
-            case EVT_CREATE_CONNECTION_CHANNEL_RESPONSE_OPCODE:
-                handleCreateConnectionChannelResponse(
-                    reinterpret_cast<const EvtCreateConnectionChannelResponse*>(data));
-                break;
-                
-            case EVT_CONNECTION_STATUS_CHANGED_OPCODE:
-                handleConnectionStatusChanged(
-                    reinterpret_cast<const EvtConnectionStatusChanged*>(data));
-                break;
-                
-            case EVT_CONNECTION_CHANNEL_REMOVED_OPCODE:
-                handleConnectionChannelRemoved(
-                    reinterpret_cast<const EvtConnectionChannelRemoved*>(data));
-                break;
-                
-            case EVT_BUTTON_UP_OR_DOWN_OPCODE:
-                handleButtonEvent(reinterpret_cast<const EvtButtonUpOrDown*>(data));
-                break;
-                
-            case EVT_BUTTON_CLICK_OR_HOLD_OPCODE:
-                handleButtonClickOrHold(reinterpret_cast<const EvtButtonClickOrHold*>(data));
-                break;
-                
-            case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OPCODE:
-                handleButtonSingleOrDoubleClick(
-                    reinterpret_cast<const EvtButtonSingleOrDoubleClick*>(data));
-                break;
-                
-            case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE:
-                handleButtonSingleOrDoubleClickOrHold(
-                    reinterpret_cast<const EvtButtonSingleOrDoubleClickOrHold*>(data));
-                break;
-                
-            case EVT_NEW_VERIFIED_BUTTON_OPCODE:
-                handleNewVerifiedButton(reinterpret_cast<const EvtNewVerifiedButton*>(data));
-                break;
-                
-            case EVT_GET_INFO_RESPONSE_OPCODE:
-                handleGetInfoResponse(reinterpret_cast<const EvtGetInfoResponse*>(data), len);
-                break;
-                
-            case EVT_NO_SPACE_FOR_NEW_CONNECTION_OPCODE:
-                std::cout << "No space for new connection" << std::endl;
-                break;
-                
-            case EVT_GOT_SPACE_FOR_NEW_CONNECTION_OPCODE:
-                std::cout << "Got space for new connection" << std::endl;
-                break;
-                
-            case EVT_BLUETOOTH_CONTROLLER_STATE_CHANGE_OPCODE:
-                handleBluetoothControllerStateChange(
-                    reinterpret_cast<const EvtBluetoothControllerStateChange*>(data));
-                break;
-                
-            case EVT_SCAN_WIZARD_FOUND_PRIVATE_BUTTON_OPCODE:
-                std::cout << "Scan wizard found private button" << std::endl;
-                break;
-                
-            case EVT_SCAN_WIZARD_FOUND_PUBLIC_BUTTON_OPCODE:
-                handleScanWizardFoundPublicButton(
-                    reinterpret_cast<const EvtScanWizardFoundPublicButton*>(data));
-                break;
-                
-            case EVT_SCAN_WIZARD_BUTTON_CONNECTED_OPCODE:
-                std::cout << "Scan wizard: Button connected!" << std::endl;
-                break;
-                
-            case EVT_SCAN_WIZARD_COMPLETED_OPCODE:
-                handleScanWizardCompleted(reinterpret_cast<const EvtScanWizardCompleted*>(data));
-                break;
-                
-            default:
-                std::cout << "Unknown opcode: " << static_cast<int>(opcode) << std::endl;
-                break;
-        }
-    }
-
-    void handleAdvertisementPacket(const EvtAdvertisementPacket* evt) {
-        BdAddr addr(evt->bd_addr);
-        std::string name(evt->name, evt->name + evt->name_length);
-        
-        std::cout << "Advertisement: " << addr.toString() 
-                  << " Name: " << name
-                  << " RSSI: " << static_cast<int>(evt->rssi) << " dBm"
-                  << " Private: " << (evt->is_private ? "yes" : "no")
-                  << std::endl;
-    }
-
-    void handleCreateConnectionChannelResponse(const EvtCreateConnectionChannelResponse* evt) {
-        std::cout << "Create connection channel response: ";
-        switch (evt->error) {
-            case NoError:
-                std::cout << "Success";
-                break;
-            case MaxPendingConnectionsReached:
-                std::cout << "Max pending connections reached";
-                break;
-            default:
-                std::cout << "Unknown error";
-                break;
-        }
-        std::cout << " (conn_id: " << evt->conn_id << ")" << std::endl;
-    }
-
-    void handleConnectionStatusChanged(const EvtConnectionStatusChanged* evt) {
-        BdAddr addr(evt->bd_addr);
-        std::cout << "Connection status changed for " << addr.toString() 
-                  << " (conn_id: " << evt->conn_id << "): ";
-        
-        switch (evt->connection_status) {
-            case Disconnected:
-                std::cout << "Disconnected";
-                if (evt->connection_status == Disconnected) {
-                    std::cout << " - Reason: ";
-                    switch (evt->disconnect_reason) {
-                        case Unspecified:
-                            std::cout << "Unspecified";
-                            break;
-                        case ConnectionEstablishmentFailed:
-                            std::cout << "Connection establishment failed";
-                            break;
-                        case TimedOut:
-                            std::cout << "Timed out";
-                            break;
-                        case BondingKeysMismatch:
-                            std::cout << "Bonding keys mismatch";
-                            break;
-                        default:
-                            std::cout << "Unknown";
-                            break;
-                    }
-                }
-                break;
-            case Connected:
-                std::cout << "Connected";
-                break;
-            case Ready:
-                std::cout << "Ready";
-                break;
-            default:
-                std::cout << "Unknown";
-                break;
-        }
-        std::cout << std::endl;
-    }
-
-    void handleConnectionChannelRemoved(const EvtConnectionChannelRemoved* evt) {
-        std::cout << "Connection channel removed (conn_id: " << evt->conn_id << "): ";
-        
-        switch (evt->removed_reason) {
-            case RemovedByThisClient:
-                std::cout << "Removed by this client";
-                break;
-            case ForceDisconnectedByThisClient:
-                std::cout << "Force disconnected by this client";
-                break;
-            case ForceDisconnectedByOtherClient:
-                std::cout << "Force disconnected by other client";
-                break;
-            case ButtonIsPrivate:
-                std::cout << "Button is private";
-                break;
-            case VerifyTimeout:
-                std::cout << "Verify timeout";
-                break;
-            case InternetBackendError:
-                std::cout << "Internet backend error";
-                break;
-            case InvalidData:
-                std::cout << "Invalid data";
-                break;
-            case CouldntLoadDevice:
-                std::cout << "Couldn't load device";
-                break;
-            case DeletedByThisClient:
-                std::cout << "Deleted by this client";
-                break;
-            case DeletedByOtherClient:
-                std::cout << "Deleted by other client";
-                break;
-            case ButtonBelongsToOtherPartner:
-                std::cout << "Button belongs to other partner";
-                break;
-            case DeletedFromButton:
-                std::cout << "Deleted from button";
-                break;
-            default:
-                std::cout << "Unknown reason";
-                break;
-        }
-        std::cout << std::endl;
-        
-        connections.erase(evt->conn_id);
-    }
-
-    void handleButtonEvent(const EvtButtonUpOrDown* evt) {
-        std::cout << "Button " << (evt->click_type == ClickTypeButtonDown ? "DOWN" : "UP")
-                  << " (conn_id: " << evt->conn_id 
-                  << ", age: " << evt->time_diff << " ms)" << std::endl;
-    }
-
-    void handleButtonClickOrHold(const EvtButtonClickOrHold* evt) {
-        std::cout << "Button " 
-                  << (evt->click_type == ClickTypeButtonClick ? "CLICK" : "HOLD")
-                  << " (conn_id: " << evt->conn_id 
-                  << ", age: " << evt->time_diff << " ms)" << std::endl;
-    }
-
-    void handleButtonSingleOrDoubleClick(const EvtButtonSingleOrDoubleClick* evt) {
-        std::cout << "Button ";
-        switch (evt->click_type) {
-            case ClickTypeButtonSingleClick:
-                std::cout << "SINGLE CLICK";
-                break;
-            case ClickTypeButtonDoubleClick:
-                std::cout << "DOUBLE CLICK";
-                break;
-            default:
-                std::cout << "UNKNOWN";
-                break;
-        }
-        std::cout << " (conn_id: " << evt->conn_id 
-                  << ", age: " << evt->time_diff << " ms)" << std::endl;
-    }
-
-    void handleButtonSingleOrDoubleClickOrHold(const EvtButtonSingleOrDoubleClickOrHold* evt) {
-        std::cout << "Button ";
-        switch (evt->click_type) {
-            case ClickTypeButtonSingleClick:
-                std::cout << "SINGLE CLICK";
-                break;
-            case ClickTypeButtonDoubleClick:
-                std::cout << "DOUBLE CLICK";
-                break;
-            case ClickTypeButtonHold:
-                std::cout << "HOLD";
-                break;
-            default:
-                std::cout << "UNKNOWN";
-                break;
-        }
-        std::cout << " (conn_id: " << evt->conn_id 
-                  << ", age: " << evt->time_diff << " ms)" << std::endl;
-    }
-
-    void handleNewVerifiedButton(const EvtNewVerifiedButton* evt) {
-        BdAddr addr(evt->bd_addr);
-        std::cout << "New verified button: " << addr.toString() << std::endl;
-    }
-
-    void handleGetInfoResponse(const EvtGetInfoResponse* evt, size_t len) {
-        BdAddr myAddr(evt->my_bd_addr);
-        
-        std::cout << "\n=== Server Info ===" << std::endl;
-        std::cout << "Bluetooth controller state: ";
-        switch (evt->bluetooth_controller_state) {
-            case Detached:
-                std::cout << "Detached";
-                break;
-            case Resetting:
-                std::cout << "Resetting";
-                break;
-            case Attached:
-                std::cout << "Attached";
-                break;
-            default:
-                std::cout << "Unknown";
-                break;
-        }
-        std::cout << std::endl;
-        
-        std::cout << "My BD Address: " << myAddr.toString() << " (";
-        switch (evt->my_bd_addr_type) {
-            case PublicBdAddrType:
-                std::cout << "Public";
-                break;
-            case RandomBdAddrType:
-                std::cout << "Random";
-                break;
-            default:
-                std::cout << "Unknown";
-                break;
-        }
-        std::cout << ")" << std::endl;
-        
-        std::cout << "Max pending connections: " << (int)evt->max_pending_connections << std::endl;
-        std::cout << "Max concurrent connections: " << evt->max_concurrently_connected_buttons << std::endl;
-        std::cout << "Current pending connections: " << (int)evt->current_pending_connection_count << std::endl;
-        std::cout << "Currently no space for new connections: " 
-                  << (evt->currently_no_space_for_new_connection ? "yes" : "no") << std::endl;
-        
-        // Parse verified buttons
-        size_t offset = sizeof(EvtGetInfoResponse);
-        std::cout << "\nVerified buttons:" << std::endl;
-        
-        uint16_t nb_verified_buttons;
-        std::memcpy(&nb_verified_buttons, 
-                    reinterpret_cast<const uint8_t*>(evt) + offset, 2);
-        offset += 2;
-        
-        if (nb_verified_buttons == 0) {
-            std::cout << "  (none)" << std::endl;
-        } else {
-            for (int i = 0; i < nb_verified_buttons; i++) {
-                BdAddr buttonAddr(reinterpret_cast<const uint8_t*>(evt) + offset);
-                std::cout << "  " << buttonAddr.toString() << std::endl;
-                offset += 6;
+            out() << std::setw(13) << channel.disconnects;
+            if (const ButtonInfoCache::Entry* info = client.buttonInfo().find(addr)) {
+                out() << "  " << std::string(info->name, info->nameLength);
             }
-        }
-        std::cout << "==================\n" << std::endl;
-    }
-
-    void handleBluetoothControllerStateChange(const EvtBluetoothControllerStateChange* evt) {
-        std::cout << "Bluetooth controller state changed to: ";
-        switch (evt->state) {
-            case Detached:
-                std::cout << "Detached";
-                break;
-            case Resetting:
-                std::cout << "Resetting";
-                break;
-            case Attached:
-                std::cout << "Attached";
-                break;
-            default:
-                std::cout << "Unknown";
-                break;
-        }
-        std::cout << std::endl;
-    }
-
-    void handleScanWizardFoundPublicButton(const EvtScanWizardFoundPublicButton* evt) {
-        BdAddr addr(evt->bd_addr);
-        std::string name(evt->name, evt->name + evt->name_length);
-        
-        std::cout << "Scan wizard found button: " << addr.toString() 
-                  << " Name: " << name << std::endl;
-    }
-
-    void handleScanWizardCompleted(const EvtScanWizardCompleted* evt) {
-        std::cout << "Scan wizard completed: ";
-        
-        switch (evt->result) {
-            case WizardSuccess:
-                std::cout << "Success!" << std::endl;
-                break;
-            case WizardCancelledByUser:
-                std::cout << "Cancelled by user" << std::endl;
-                break;
-            case WizardFailedTimeout:
-                std::cout << "Failed (timeout)" << std::endl;
-                break;
-            case WizardButtonIsPrivate:
-                std::cout << "Button is private" << std::endl;
-                break;
-            case WizardBluetoothUnavailable:
-                std::cout << "Bluetooth unavailable" << std::endl;
-                break;
-            case WizardInternetBackendError:
-                std::cout << "Internet backend error" << std::endl;
-                break;
-            case WizardInvalidData:
-                std::cout << "Invalid data" << std::endl;
-                break;
-            case WizardButtonBelongsToOtherPartner:
-                std::cout << "Button belongs to other partner" << std::endl;
-                break;
-            case WizardButtonAlreadyConnectedToOtherDevice:
-                std::cout << "Button already connected to other device" << std::endl;
-                break;
-            default:
-                std::cout << "Unknown result" << std::endl;
-                break;
+            out() << std::endl;
         }
     }
 
     void printHelp() {
-        std::cout << "\n=== Available Commands ===" << std::endl;
-        std::cout << "getInfo                                  - Get server info" << std::endl;
-        std::cout << "startScanWizard                          - Start scan wizard (pair new button)" << std::endl;
-        std::cout << "cancelScanWizard                         - Cancel scan wizard" << std::endl;
-        std::cout << "startScan                                - Start raw button scanning" << std::endl;
-        std::cout << "stopScan                                 - Stop raw button scanning" << std::endl;
-        std::cout << "connect <bdaddr> <conn_id>               - Connect to button" << std::endl;
-        std::cout << "disconnect <conn_id>                     - Disconnect button" << std::endl;
-        std::cout << "forceDisconnect <bdaddr>                 - Force disconnect button" << std::endl;
-        std::cout << "getButtonInfo <bdaddr>                   - Get button info" << std::endl;
-        std::cout << "deleteButton <bdaddr>                    - Delete button pairing" << std::endl;
-        std::cout << "help                                     - Show this help" << std::endl;
-        std::cout << "quit                                     - Exit client" << std::endl;
-        std::cout << "==========================\n" << std::endl;
+        out() << "\n=== Available Commands ===" << std::endl;
+        out() << "getInfo                                  - Get server info" << std::endl;
+        out() << "startScanWizard                          - Start scan wizard (pair new button)" << std::endl;
+        out() << "cancelScanWizard                         - Cancel scan wizard" << std::endl;
+        out() << "startScan                                - Start raw button scanning" << std::endl;
+        out() << "stopScan                                 - Stop raw button scanning" << std::endl;
+        out() << "advertisements                           - Show the aggregated advertisement table" << std::endl;
+        out() << "connect <bdaddr> <conn_id>               - Connect to button" << std::endl;
+        out() << "disconnect <conn_id|bdaddr>              - Disconnect button" << std::endl;
+        out() << "channels                                 - List connection channels and their state" << std::endl;
+        out() << "connectAll [file]                        - Connect every button in file, or show progress" << std::endl;
+        out() << "setMode <conn_id|bdaddr> <low|normal|high> [auto_disconnect] - Change latency mode" << std::endl;
+        out() << "battery [bdaddr]                         - Battery levels, or one button's history" << std::endl;
+        out() << "forceDisconnect <bdaddr>                 - Force disconnect button" << std::endl;
+        out() << "getButtonInfo <bdaddr>                   - Get button info" << std::endl;
+        out() << "buttons                                  - List cached button info" << std::endl;
+        out() << "deleteButton <bdaddr>                    - Delete button pairing" << std::endl;
+        out() << "beginBatch                               - Queue commands until commit" << std::endl;
+        out() << "commit                                   - Send queued commands in one write" << std::endl;
+        out() << "stats [json|dump <file>|reset]           - Per-button event age and dispatch latency" << std::endl;
+        out() << "actions                                  - Action rule counters and timings" << std::endl;
+        out() << "bus                                      - Event bus subscribers and counters" << std::endl;
+        out() << "help                                     - Show this help" << std::endl;
+        out() << "quit                                     - Exit client" << std::endl;
+        out() << "==========================\n" << std::endl;
     }
 
 public:
-    FlicClient(const std::string& host, int port = 5551)
-        : sockfd(-1), host(host), port(port), connected(false) {}
+    // Pass externalLoop to share one event loop between several clients
+    ConsoleClient(const std::string& host, int port = 5551, EventLoop* externalLoop = nullptr)
+        : client(host, port, externalLoop), text(&buffer), outputMutex(nullptr), actions(nullptr), buttonInfoTimer(0),
+          sessionTimer(0), savedSessionChanges(0) {
+        client.setObserver(this);
+        formatter.setSource(client.sourceTag(), 0);
+    }
 
-    ~FlicClient() {
-        disconnect();
+    ~ConsoleClient() {
+        if (buttonInfoTimer) client.eventLoop().cancelTimer(buttonInfoTimer);
+        saveButtonInfo();
+        if (sessionTimer) client.eventLoop().cancelTimer(sessionTimer);
+        saveSession();
     }
 
-    bool connect() {
-        // Create socket
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockfd < 0) {
-            std::cerr << "Failed to create socket" << std::endl;
-            return false;
+    FlicClient& session() { return client; }
+    uint16_t sourceId() const { return formatter.sourceIndex(); }
+
+    // Event output format (human, json, binary)
+    void setFormat(EventFormatter::Format format) {
+        formatter.setFormat(format);
+    }
+
+    // Serializes writes to stdout through mutex and prefixes human output
+    // lines with "[host:port] "; sourceId tags binary records. Used when
+    // several clients share a process.
+    void setTaggedOutput(std::mutex* mutex, uint16_t sourceId) {
+        outputMutex = mutex;
+        formatter.setSource(client.sourceTag(), sourceId);
+    }
+
+    // Loads the button info snapshot at path, has the client fetch info for
+    // buttons not in it, and writes it back when changed, every few seconds
+    // and on exit
+    void setButtonInfoFile(const std::string& path) {
+        std::string error;
+        if (!client.buttonInfo().load(path, &error)) {
+            std::cerr << "Button info cache not loaded: " << error << std::endl;
         }
+        buttonInfoPath = path;
+        client.setButtonInfoFetch(true);
+        if (!buttonInfoTimer) {
+            buttonInfoTimer = client.eventLoop().addPeriodicTimer(kButtonInfoSaveMs,
+                                                                  [this]() { saveButtonInfo(); });
+        }
+    }
 
-        // Resolve hostname
-        struct hostent* server = gethostbyname(host.c_str());
-        if (server == nullptr) {
-            std::cerr << "Failed to resolve host: " << host << std::endl;
-            close(sockfd);
-            sockfd = -1;
-            return false;
+    void saveButtonInfo() {
+        if (buttonInfoPath.empty() || !client.buttonInfo().dirty()) return;
+        std::string error;
+        if (!client.buttonInfo().save(buttonInfoPath, &error)) {
+            std::cerr << "Button info cache not saved: " << error << std::endl;
         }
+    }
 
-        // Setup server address
-        struct sockaddr_in serv_addr;
-        std::memset(&serv_addr, 0, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        std::memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-        serv_addr.sin_port = htons(port);
+    // Restores the session snapshot at path (channels, scanners, battery
+    // listeners) before the client connects, and writes the session back
+    // to it within a second of any change and on exit
+    void setSessionFile(const std::string& path) {
+        SessionSnapshot snapshot;
+        std::string error;
+        if (!snapshot.load(path, &error)) {
+            std::cerr << "Session not restored: " << error << std::endl;
+        } else if (!snapshot.empty()) {
+            client.restoreSession(snapshot);
+            out() << "Restored session from " << path << ": " << snapshot.channels.size()
+                  << " channels, " << snapshot.scanners.size() << " scanners"
+                  << (snapshot.batteryMonitoring ? ", battery monitoring" : "") << std::endl;
+        }
+        sessionPath = path;
+        savedSessionChanges = client.sessionChanges();
+        if (!sessionTimer) {
+            sessionTimer = client.eventLoop().addPeriodicTimer(kSessionSaveMs,
+                                                               [this]() { saveSession(); });
+        }
+    }
 
-        // Connect
-        if (::connect(sockfd, reinterpret_cast<struct sockaddr*>(&serv_addr), 
-                      sizeof(serv_addr)) < 0) {
-            std::cerr << "Failed to connect to " << host << ":" << port << std::endl;
-            close(sockfd);
-            sockfd = -1;
-            return false;
+    void saveSession() {
+        if (sessionPath.empty() || client.sessionChanges() == savedSessionChanges) return;
+        std::string error;
+        if (!client.snapshotSession().save(sessionPath, &error)) {
+            std::cerr << "Session not saved: " << error << std::endl;
+            return;
         }
+        savedSessionChanges = client.sessionChanges();
+    }
+
+    // Button events are handed to engine's workers; null turns that off
+    void setActionEngine(ActionEngine* engine) {
+        actions = engine;
+    }
 
-        connected = true;
-        std::cout << "Connected to Flic server at " << host << ":" << port << std::endl;
-        
-        // Immediately request server info
-        getInfo();
-        
+    // Publishes every event packet to subscribers of a UNIX socket at path
+    bool setEventBus(const std::string& path) {
+        std::unique_ptr<EventBus> created(new EventBus(client.eventLoop()));
+        std::string error;
+        if (!created->listen(path, &error)) {
+            std::cerr << "Event bus not started: " << error << std::endl;
+            return false;
+        }
+        created->setSource(client.sourceTag(), formatter.sourceIndex());
+        bus = std::move(created);
         return true;
     }
 
-    void disconnect() {
-        if (sockfd >= 0) {
-            close(sockfd);
-            sockfd = -1;
-        }
-        connected = false;
-    }
-
-    void getInfo() {
-        CmdGetInfo cmd;
-        cmd.opcode = CMD_GET_INFO_OPCODE;
-        writePacket(&cmd, sizeof(cmd));
-    }
-
-    void startScanWizard(uint32_t scan_wizard_id = 0) {
-        CmdCreateScanWizard cmd;
-        cmd.opcode = CMD_CREATE_SCAN_WIZARD_OPCODE;
-        cmd.scan_wizard_id = scan_wizard_id;
-        writePacket(&cmd, sizeof(cmd));
-        std::cout << "Scan wizard started. Press and hold your Flic button..." << std::endl;
-    }
-
-    void cancelScanWizard(uint32_t scan_wizard_id = 0) {
-        CmdCancelScanWizard cmd;
-        cmd.opcode = CMD_CANCEL_SCAN_WIZARD_OPCODE;
-        cmd.scan_wizard_id = scan_wizard_id;
-        writePacket(&cmd, sizeof(cmd));
-    }
-
-    void startScan(uint32_t scan_id = 0) {
-        CmdCreateScanner cmd;
-        cmd.opcode = CMD_CREATE_SCANNER_OPCODE;
-        cmd.scan_id = scan_id;
-        writePacket(&cmd, sizeof(cmd));
-        scanners[scan_id] = "scanner";
-        std::cout << "Started scanning..." << std::endl;
-    }
-
-    void stopScan(uint32_t scan_id = 0) {
-        CmdRemoveScanner cmd;
-        cmd.opcode = CMD_REMOVE_SCANNER_OPCODE;
-        cmd.scan_id = scan_id;
-        writePacket(&cmd, sizeof(cmd));
-        scanners.erase(scan_id);
-        std::cout << "Stopped scanning" << std::endl;
-    }
-
-    void connectButton(const std::string& bdaddr, uint32_t conn_id) {
-        CmdCreateConnectionChannel cmd;
-        cmd.opcode = CMD_CREATE_CONNECTION_CHANNEL_OPCODE;
-        
-        BdAddr addr(bdaddr);
-        std::memcpy(cmd.bd_addr, addr.data(), 6);
-        
-        cmd.conn_id = conn_id;
-        cmd.latency_mode = NormalLatency;
-        cmd.auto_disconnect_time = 0x1ff;
-        
-        writePacket(&cmd, sizeof(cmd));
-        connections[conn_id] = bdaddr;
-        std::cout << "Connecting to " << bdaddr << "..." << std::endl;
-    }
-
-    void disconnectButton(uint32_t conn_id) {
-        CmdRemoveConnectionChannel cmd;
-        cmd.opcode = CMD_REMOVE_CONNECTION_CHANNEL_OPCODE;
-        cmd.conn_id = conn_id;
-        writePacket(&cmd, sizeof(cmd));
-    }
-
-    void forceDisconnect(const std::string& bdaddr) {
-        CmdForceDisconnect cmd;
-        cmd.opcode = CMD_FORCE_DISCONNECT_OPCODE;
-        
-        BdAddr addr(bdaddr);
-        std::memcpy(cmd.bd_addr, addr.data(), 6);
-        
-        writePacket(&cmd, sizeof(cmd));
-        std::cout << "Force disconnecting " << bdaddr << std::endl;
-    }
-
-    void getButtonInfo(const std::string& bdaddr) {
-        CmdGetButtonInfo cmd;
-        cmd.opcode = CMD_GET_BUTTON_INFO_OPCODE;
-        
-        BdAddr addr(bdaddr);
-        std::memcpy(cmd.bd_addr, addr.data(), 6);
-        
-        writePacket(&cmd, sizeof(cmd));
-    }
-
-    void deleteButton(const std::string& bdaddr) {
-        CmdDeleteButton cmd;
-        cmd.opcode = CMD_DELETE_BUTTON_OPCODE;
-        
-        BdAddr addr(bdaddr);
-        std::memcpy(cmd.bd_addr, addr.data(), 6);
-        
-        writePacket(&cmd, sizeof(cmd));
-        std::cout << "Deleting button " << bdaddr << std::endl;
+    // Called on the loop thread after the server connection is lost and
+    // reconnect is disabled. Without a handler the loop is stopped.
+    void setDisconnectHandler(std::function<void()> handler) {
+        disconnectHandler = handler;
+    }
+
+    // Writes everything buffered since the last flush with one write();
+    // called once per loop iteration
+    void flushOutput() {
+        if (buffer.empty()) return;
+        if (!outputMutex) {
+            buffer.writeTo(STDOUT_FILENO);
+            return;
+        }
+
+        OutputBuffer* pending = &buffer;
+        if (formatter.format() == EventFormatter::Human) {
+            const char* start = buffer.bytes();
+            const char* end = start + buffer.size();
+            const std::string& tag = client.sourceTag();
+            while (start < end) {
+                const char* nl = static_cast<const char*>(std::memchr(start, '\n', end - start));
+                const char* lineEnd = nl ? nl + 1 : end;
+                tagged.append('[');
+                tagged.append(tag.data(), tag.size());
+                tagged.append("] ");
+                tagged.append(start, lineEnd - start);
+                start = lineEnd;
+            }
+            if (tagged.bytes()[tagged.size() - 1] != '\n') tagged.append('\n');
+            buffer.clear();
+            pending = &tagged;
+        }
+
+        std::lock_guard<std::mutex> lock(*outputMutex);
+        pending->writeTo(STDOUT_FILENO);
+    }
+
+    // Executes one REPL line. Returns false when the user asked to quit.
+    bool handleCommand(const std::string& line) {
+        std::istringstream iss(line);
+        std::string cmd;
+        iss >> cmd;
+        bool sent = true;
+
+        if (cmd == "quit" || cmd == "exit") {
+            return false;
+        } else if (cmd == "help") {
+            printHelp();
+        } else if (cmd == "beginBatch") {
+            client.beginBatch();
+        } else if (cmd == "commit") {
+            sent = client.commit();
+        } else if (cmd == "getInfo") {
+            sent = client.getInfo();
+        } else if (cmd == "startScanWizard") {
+            sent = client.startScanWizard();
+            if (sent) out() << "Scan wizard started. Press and hold your Flic button..." << std::endl;
+        } else if (cmd == "cancelScanWizard") {
+            sent = client.cancelScanWizard();
+        } else if (cmd == "startScan") {
+            sent = client.startScan();
+            if (sent) out() << "Started scanning..." << std::endl;
+        } else if (cmd == "stopScan") {
+            sent = client.stopScan();
+            if (sent) out() << "Stopped scanning" << std::endl;
+        } else if (cmd == "advertisements") {
+            printAdvertisements();
+        } else if (cmd == "connect") {
+            std::string bdaddr;
+            uint32_t conn_id;
+            BdAddr addr;
+            if (iss >> bdaddr >> conn_id && addr.fromString(bdaddr)) {
+                // Remembered and created on reconnect even if the server is away
+                client.connectButton(addr, conn_id);
+                out() << "Connecting to " << bdaddr << "..." << std::endl;
+            } else {
+                out() << "Usage: connect <bdaddr> <conn_id>" << std::endl;
+            }
+        } else if (cmd == "disconnect") {
+            std::string target;
+            BdAddr addr;
+            char* end = nullptr;
+            iss >> target;
+            unsigned long conn_id = std::strtoul(target.c_str(), &end, 10);
+            if (addr.fromString(target)) {
+                if (!client.disconnectButton(addr)) {
+                    out() << "No channel to " << target << std::endl;
+                }
+            } else if (!target.empty() && *end == '\0') {
+                client.disconnectButton(static_cast<uint32_t>(conn_id));
+            } else {
+                out() << "Usage: disconnect <conn_id|bdaddr>" << std::endl;
+            }
+        } else if (cmd == "channels") {
+            printChannels();
+        } else if (cmd == "connectAll") {
+            std::string path;
+            FlicClient::ButtonList buttons;
+            if (!(iss >> path)) {
+                printProvisioning();
+            } else if (loadButtonFile(path, buttons)) {
+                client.connectAll(buttons);
+                out() << "Connecting " << buttons.size() << " buttons ("
+                      << client.pendingChannels() << " sent, " << client.queuedChannels()
+                      << " queued)" << std::endl;
+            }
+        } else if (cmd == "setMode") {
+            std::string target, modeName;
+            uint8_t mode;
+            int autoDisconnect = -1;
+            BdAddr addr;
+            const ChannelTable::Channel* channel = nullptr;
+            if (iss >> target >> modeName && LatencyPolicy::parseMode(modeName, mode) &&
+                (iss >> autoDisconnect || iss.eof()) && autoDisconnect <= 511) {
+                char* end = nullptr;
+                unsigned long conn_id = std::strtoul(target.c_str(), &end, 10);
+                channel = addr.fromString(target) ? client.channels().findByAddr(addr.data()) :
+                          *end == '\0' ? client.channels().find(static_cast<uint32_t>(conn_id)) :
+                          nullptr;
+                if (!channel) {
+                    out() << "No channel " << target << std::endl;
+                } else {
+                    int16_t timeout = autoDisconnect >= 0 ? static_cast<int16_t>(autoDisconnect) :
+                                      channel->autoDisconnectTime;
+                    client.changeModeParameters(channel->connId, mode, timeout);
+                }
+            } else {
+                out() << "Usage: setMode <conn_id|bdaddr> <low|normal|high> [auto_disconnect]" << std::endl;
+            }
+        } else if (cmd == "battery") {
+            std::string bdaddr;
+            BdAddr addr;
+            if (!(iss >> bdaddr)) {
+                printBatteries();
+            } else if (addr.fromString(bdaddr)) {
+                printBatteryHistory(addr);
+            } else {
+                out() << "Usage: battery [bdaddr]" << std::endl;
+            }
+        } else if (cmd == "forceDisconnect") {
+            std::string bdaddr;
+            BdAddr addr;
+            if (iss >> bdaddr && addr.fromString(bdaddr)) {
+                sent = client.forceDisconnect(addr);
+                if (sent) out() << "Force disconnecting " << bdaddr << std::endl;
+            } else {
+                out() << "Usage: forceDisconnect <bdaddr>" << std::endl;
+            }
+        } else if (cmd == "getButtonInfo") {
+            std::string bdaddr;
+            BdAddr addr;
+            if (iss >> bdaddr && addr.fromString(bdaddr)) {
+                sent = client.getButtonInfo(addr);
+            } else {
+                out() << "Usage: getButtonInfo <bdaddr>" << std::endl;
+            }
+        } else if (cmd == "buttons") {
+            printButtonInfo();
+        } else if (cmd == "deleteButton") {
+            std::string bdaddr;
+            BdAddr addr;
+            if (iss >> bdaddr && addr.fromString(bdaddr)) {
+                sent = client.deleteButton(addr);
+                if (sent) out() << "Deleting button " << bdaddr << std::endl;
+            } else {
+                out() << "Usage: deleteButton <bdaddr>" << std::endl;
+            }
+        } else if (cmd == "stats") {
+            EventStats& stats = client.eventStats();
+            std::string mode;
+            iss >> mode;
+            if (mode.empty()) {
+                stats.writeTable(out());
+                printReaderStats();
+                printReconnectStats();
+                printPingStats();
+                printSpeculationStats();
+                printFreshnessStats();
+            } else if (mode == "json") {
+                stats.writeJson(out(), client.sourceTag());
+            } else if (mode == "dump") {
+                std::string path;
+                iss >> path;
+                std::ofstream file(path.c_str(), std::ios::app);
+                if (path.empty() || !file) {
+                    out() << "Usage: stats dump <file>" << std::endl;
+                } else {
+                    stats.writeJson(file, client.sourceTag());
+                    out() << "Stats appended to " << path << std::endl;
+                }
+            } else if (mode == "reset") {
+                stats.reset();
+            } else {
+                out() << "Usage: stats [json|dump <file>|reset]" << std::endl;
+            }
+        } else if (cmd == "actions") {
+            printActionStats();
+        } else if (cmd == "bus") {
+            printBusStats();
+        } else if (!cmd.empty()) {
+            out() << "Unknown command: " << cmd << std::endl;
+            out() << "Type 'help' for available commands" << std::endl;
+        }
+
+        if (!sent && !client.isConnected()) {
+            out() << "Not connected to server" << std::endl;
+        }
+        return true;
     }
 
     void run() {
-        if (!connected) {
+        if (!client.isConnected()) {
             std::cerr << "Not connected" << std::endl;
             return;
         }
 
         printHelp();
+        flushOutput();
 
-        // Main loop with poll
-        struct pollfd fds[2];
-        fds[0].fd = sockfd;
-        fds[0].events = POLLIN;
-        fds[1].fd = STDIN_FILENO;
-        fds[1].events = POLLIN;
-
-        uint8_t buffer[1024];
-        std::string inputLine;
-
-        while (connected) {
-            int ret = poll(fds, 2, -1);
-            
-            if (ret < 0) {
-                perror("poll");
-                break;
-            }
+        if (!client.start()) return;
+        EventLoop& loop = client.eventLoop();
+        loop.addFd(STDIN_FILENO, EPOLLIN, [this](uint32_t) { onStdinReadable(); });
+
+        EventLoop::SignalCallback onSignal = [&loop](const struct signalfd_siginfo&) {
+            loop.stop();
+        };
+        loop.addSignal(SIGINT, onSignal);
+        loop.addSignal(SIGTERM, onSignal);
 
-            // Handle server messages
-            if (fds[0].revents & POLLIN) {
-                ssize_t len = readPacket(buffer, sizeof(buffer));
-                if (len < 0) {
-                    break;
+        loop.run();
+
+        loop.removeFd(STDIN_FILENO);
+        client.cancelReconnect();
+        client.disconnect();
+        out() << "Disconnecting..." << std::endl;
+        flushOutput();
+    }
+};
+
+// Runs many flicd sessions in one process. Endpoints are sharded round-robin
+// over a fixed number of worker threads, each with its own event loop, and a
+// client is only ever touched from its worker's thread. The main thread reads
+// stdin and forwards "@<target> <command>" lines to the owning worker.
+class FlicHub {
+public:
+    struct Endpoint {
+        std::string host;
+        int port;
+    };
+
+    // configure is applied to every client before it connects
+    FlicHub(const std::vector<Endpoint>& endpoints, unsigned threads,
+            const std::function<void(ConsoleClient&)>& configure) {
+        if (threads == 0) threads = 1;
+        if (threads > endpoints.size()) threads = endpoints.size();
+
+        for (unsigned i = 0; i < threads; i++) {
+            workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        }
+        for (size_t i = 0; i < endpoints.size(); i++) {
+            Worker& worker = *workers[i % workers.size()];
+            std::unique_ptr<ConsoleClient> client(
+                new ConsoleClient(endpoints[i].host, endpoints[i].port, &worker.loop));
+            client->setTaggedOutput(&outputMutex, static_cast<uint16_t>(i));
+            client->setDisconnectHandler([]() {});
+            configure(*client);
+            clients.push_back(std::move(client));
+            shards.push_back(i % workers.size());
+        }
+    }
+
+    ~FlicHub() {
+        stopWorkers();
+    }
+
+    void run() {
+        // Signals must be blocked before the workers inherit the mask
+        EventLoop::SignalCallback onSignal = [this](const struct signalfd_siginfo&) {
+            loop.stop();
+        };
+        loop.addSignal(SIGINT, onSignal);
+        loop.addSignal(SIGTERM, onSignal);
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            EventLoop* workerLoop = &workers[i]->loop;
+            workers[i]->thread = std::thread([workerLoop]() { workerLoop->run(); });
+        }
+        std::cout << "Hub: " << clients.size() << " endpoints on "
+                  << workers.size() << " worker threads" << std::endl;
+
+        for (size_t i = 0; i < clients.size(); i++) {
+            ConsoleClient* console = clients[i].get();
+            post(i, [console]() {
+                FlicClient& client = console->session();
+                if (client.connect()) {
+                    client.start();
+                } else {
+                    client.retryConnect();
                 }
-                handlePacket(buffer, len);
+                console->flushOutput();
+            });
+        }
+
+        printHelp();
+        loop.addFd(STDIN_FILENO, EPOLLIN, [this](uint32_t) {
+            if (!readLines(STDIN_FILENO, inputBuffer,
+                           [this](const std::string& line) { return handleCommand(line); })) {
+                loop.stop();
             }
+        });
+        loop.run();
+        loop.removeFd(STDIN_FILENO);
 
-            // Handle user input
-            if (fds[1].revents & POLLIN) {
-                std::string line;
-                if (!std::getline(std::cin, line)) {
-                    break;
-                }
+        std::cout << "Disconnecting..." << std::endl;
+        stopWorkers();
+    }
 
-                std::istringstream iss(line);
-                std::string cmd;
-                iss >> cmd;
-
-                if (cmd == "quit" || cmd == "exit") {
-                    break;
-                } else if (cmd == "help") {
-                    printHelp();
-                } else if (cmd == "getInfo") {
-                    getInfo();
-                } else if (cmd == "startScanWizard") {
-                    startScanWizard();
-                } else if (cmd == "cancelScanWizard") {
-                    cancelScanWizard();
-                } else if (cmd == "startScan") {
-                    startScan();
-                } else if (cmd == "stopScan") {
-                    stopScan();
-                } else if (cmd == "connect") {
-                    std::string bdaddr;
-                    uint32_t conn_id;
-                    if (iss >> bdaddr >> conn_id) {
-                        connectButton(bdaddr, conn_id);
-                    } else {
-                        std::cout << "Usage: connect <bdaddr> <conn_id>" << std::endl;
-                    }
-                } else if (cmd == "disconnect") {
-                    uint32_t conn_id;
-                    if (iss >> conn_id) {
-                        disconnectButton(conn_id);
-                    } else {
-                        std::cout << "Usage: disconnect <conn_id>" << std::endl;
-                    }
-                } else if (cmd == "forceDisconnect") {
-                    std::string bdaddr;
-                    if (iss >> bdaddr) {
-                        forceDisconnect(bdaddr);
-                    } else {
-                        std::cout << "Usage: forceDisconnect <bdaddr>" << std::endl;
-                    }
-                } else if (cmd == "getButtonInfo") {
-                    std::string bdaddr;
-                    if (iss >> bdaddr) {
-                        getButtonInfo(bdaddr);
-                    } else {
-                        std::cout << "Usage: getButtonInfo <bdaddr>" << std::endl;
-                    }
-                } else if (cmd == "deleteButton") {
-                    std::string bdaddr;
-                    if (iss >> bdaddr) {
-                        deleteButton(bdaddr);
-                    } else {
-                        std::cout << "Usage: deleteButton <bdaddr>" << std::endl;
-                    }
-                } else if (!cmd.empty()) {
-                    std::cout << "Unknown command: " << cmd << std::endl;
-                    std::cout << "Type 'help' for available commands" << std::endl;
-                }
+private:
+    struct Worker {
+        EventLoop loop;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<std::unique_ptr<ConsoleClient> > clients;
+    std::vector<size_t> shards; // client index -> worker index
+    std::mutex outputMutex;
+
+    EventLoop loop;
+    std::string inputBuffer;
+
+    void post(size_t clientIndex, std::function<void()> fn) {
+        workers[shards[clientIndex]]->loop.post(fn);
+    }
+
+    void stopWorkers() {
+        for (size_t i = 0; i < workers.size(); i++) {
+            if (!workers[i]->thread.joinable()) continue;
+            EventLoop* workerLoop = &workers[i]->loop;
+            workerLoop->post([workerLoop]() { workerLoop->stop(); });
+            workers[i]->thread.join();
+        }
+    }
+
+    // Resolves "all", an index from "list", or "host:port"
+    std::vector<size_t> resolveTarget(const std::string& target) {
+        std::vector<size_t> result;
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (target == "all" || target == std::to_string(i) ||
+                target == clients[i]->session().sourceTag()) {
+                result.push_back(i);
             }
         }
+        return result;
+    }
 
-        std::cout << "Disconnecting..." << std::endl;
+    bool handleCommand(const std::string& line) {
+        std::istringstream iss(line);
+        std::string cmd;
+        iss >> cmd;
+
+        if (cmd == "quit" || cmd == "exit") {
+            return false;
+        } else if (cmd == "help") {
+            printHelp();
+        } else if (cmd == "list") {
+            for (size_t i = 0; i < clients.size(); i++) {
+                FlicClient* client = &clients[i]->session();
+                size_t shard = shards[i];
+                post(i, [this, client, i, shard]() {
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    std::cout << "  " << i << ": " << client->sourceTag()
+                              << " (worker " << shard << ") "
+                              << (client->isConnected() ? "connected" :
+                                  client->isReconnecting() ? "reconnecting" : "disconnected")
+                              << std::endl;
+                });
+            }
+        } else if (!cmd.empty() && cmd[0] == '@') {
+            std::string rest;
+            std::getline(iss >> std::ws, rest);
+            std::vector<size_t> targets = resolveTarget(cmd.substr(1));
+            if (targets.empty() || rest.empty()) {
+                std::cout << "Usage: @<index|host:port|all> <command>" << std::endl;
+                return true;
+            }
+            for (size_t i = 0; i < targets.size(); i++) {
+                ConsoleClient* console = clients[targets[i]].get();
+                post(targets[i], [console, rest]() {
+                    console->handleCommand(rest);
+                    console->flushOutput();
+                });
+            }
+        } else if (!cmd.empty()) {
+            std::cout << "Unknown command: " << cmd << std::endl;
+            std::cout << "Type 'help' for available commands" << std::endl;
+        }
+        return true;
+    }
+
+    void printHelp() {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << "\n=== Hub Commands ===" << std::endl;
+        std::cout << "list                                     - List endpoints and their state" << std::endl;
+        std::cout << "@<index|host:port|all> <command>         - Run a client command on endpoints" << std::endl;
+        std::cout << "help                                     - Show this help" << std::endl;
+        std::cout << "quit                                     - Exit hub" << std::endl;
+        std::cout << "Client commands: see '@0 help'" << std::endl;
+        std::cout << "====================\n" << std::endl;
     }
 };
 
+static bool parseEndpoint(const std::string& text, FlicHub::Endpoint& endpoint) {
+    size_t colon = text.rfind(':');
+    endpoint.host = text.substr(0, colon);
+    endpoint.port = 5551;
+    if (colon != std::string::npos) {
+        endpoint.port = std::atoi(text.c_str() + colon + 1);
+    }
+    return !endpoint.host.empty() && endpoint.port > 0 && endpoint.port < 65536;
+}
+
+static void printUsage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " [options] <host> [port]" << std::endl;
+    std::cerr << "       " << argv0 << " --replay DIR [options]" << std::endl;
+    std::cerr << "       " << argv0 << " --hub [options] [--threads N] [--hub-file FILE] [host[:port]...]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --threaded            Read the socket on a dedicated I/O thread" << std::endl;
+    std::cerr << "  --queue-kb N          Reader queue size in KiB (default 1024)" << std::endl;
+    std::cerr << "  --overflow drop|block Reader queue overflow policy (default drop)" << std::endl;
+    std::cerr << "  --format human|json|binary  Event output format (default human)" << std::endl;
+    std::cerr << "  --adv raw|changes|digest    Advertisement reporting (default changes)" << std::endl;
+    std::cerr << "  --adv-interval-ms N   Per-button RSSI report interval, or digest period (default 1000)" << std::endl;
+    std::cerr << "  --battery             Track battery levels of every channel" << std::endl;
+    std::cerr << "  --battery-alert L:C   Low and critical battery alert percentages (default 20:10)" << std::endl;
+    std::cerr << "  --latency-policy FILE Switch channel latency modes by button activity" << std::endl;
+    std::cerr << "  --button-cache FILE   Fetch info for every ready button, kept in FILE across runs" << std::endl;
+    std::cerr << "                        (hub mode: a directory with one file per endpoint)" << std::endl;
+    std::cerr << "  --freshness FILE      Drop, flag or collapse button events older than the" << std::endl;
+    std::cerr << "                        per button deadlines in FILE" << std::endl;
+    std::cerr << "  --speculate FILE      Report single clicks and holds from raw up/down events," << std::endl;
+    std::cerr << "                        per button profiles in FILE" << std::endl;
+    std::cerr << "  --actions FILE        Run the actions in rule file FILE for button events" << std::endl;
+    std::cerr << "  --bus PATH            Publish events to subscribers of a UNIX socket at PATH" << std::endl;
+    std::cerr << "                        (hub mode: a directory with one socket per endpoint)" << std::endl;
+    std::cerr << "  --session FILE        Restore channels, scanners and battery listeners from FILE" << std::endl;
+    std::cerr << "                        on start and keep it up to date (hub mode: a directory)" << std::endl;
+    std::cerr << "  --journal DIR         Record every received frame to a segmented journal in DIR" << std::endl;
+    std::cerr << "                        (hub mode: one subdirectory per endpoint)" << std::endl;
+    std::cerr << "  --journal-segment-mb N  Journal segment size (default 64)" << std::endl;
+    std::cerr << "  --journal-segments N  Journal segments kept, 0 for all (default 16)" << std::endl;
+    std::cerr << "  --replay DIR          Feed a journal through the event handlers instead of connecting" << std::endl;
+    std::cerr << "  --replay-speed X      Replay at X times the recorded pace, 0 for as fast as possible (default 1)" << std::endl;
+    std::cerr << "  --no-reconnect        Exit (or stay down in hub mode) when the server goes away" << std::endl;
+    std::cerr << "  --backoff-ms MIN:MAX  Reconnect backoff range (default 250:30000)" << std::endl;
+    std::cerr << "  --keepalive-ms N[:T]  Ping every N ms, reconnect after T ms without an answer" << std::endl;
+    std::cerr << "                        (default 5000:15000, 0 to disable)" << std::endl;
+    std::cerr << "Example: " << argv0 << " localhost 5551" << std::endl;
+}
+
+// Settings shared by single-server and hub mode
+struct Options {
+    bool hub;
+    unsigned threads;
+    std::vector<FlicHub::Endpoint> endpoints;
+    size_t readerQueueBytes;
+    ThreadedReader::OverflowPolicy readerPolicy;
+    bool reconnect;
+    uint64_t backoffMinMs;
+    uint64_t backoffMaxMs;
+    EventFormatter::Format format;
+    FlicClient::AdvertisementMode advMode;
+    uint64_t advIntervalMs;
+    bool latencyPolicyEnabled;
+    LatencyPolicy latencyPolicy;
+    bool speculate;
+    ClickRecognizer clickRecognizer;
+    bool freshnessEnabled;
+    FreshnessPolicy freshnessPolicy;
+    uint64_t keepaliveMs;
+    uint64_t keepaliveTimeoutMs;
+    bool battery;
+    int batteryLow;
+    int batteryCritical;
+    std::string journalDir;
+    EventJournal::Options journalOptions;
+    std::string replayDir;
+    double replaySpeed;
+    std::string buttonInfoPath;
+    std::string sessionPath;
+    std::string busPath;
+    std::shared_ptr<ActionEngine> actions;  // one worker pool for every client
+
+    Options()
+        : hub(false), threads(1), readerQueueBytes(0),
+          readerPolicy(ThreadedReader::DropNewest), reconnect(true),
+          backoffMinMs(250), backoffMaxMs(30000), format(EventFormatter::Human),
+          advMode(FlicClient::AdvertisementChanges), advIntervalMs(1000),
+          latencyPolicyEnabled(false), speculate(false), freshnessEnabled(false), keepaliveMs(5000), keepaliveTimeoutMs(15000),
+          battery(false), batteryLow(20), batteryCritical(10), replaySpeed(1.0) {}
+
+    void apply(ConsoleClient& console) const {
+        console.setFormat(format);
+        FlicClient& client = console.session();
+        client.setThreadedReader(readerQueueBytes, readerPolicy);
+        client.setReconnect(reconnect, backoffMinMs, backoffMaxMs);
+        client.setKeepalive(keepaliveMs, keepaliveTimeoutMs);
+        client.setAdvertisementMode(advMode, advIntervalMs);
+        if (latencyPolicyEnabled) client.setLatencyPolicy(latencyPolicy);
+        if (speculate) client.setClickRecognizer(clickRecognizer);
+        if (freshnessEnabled) client.setFreshnessPolicy(freshnessPolicy);
+        client.batteries().setThresholds(batteryLow, batteryCritical);
+        if (battery) client.setBatteryMonitoring(true);
+        if (!journalDir.empty()) openJournal(console);
+        if (!buttonInfoPath.empty()) console.setButtonInfoFile(endpointPath(client, buttonInfoPath));
+        if (!sessionPath.empty()) console.setSessionFile(endpointPath(client, sessionPath));
+        console.setActionEngine(actions.get());
+        if (!busPath.empty()) console.setEventBus(endpointPath(client, busPath));
+    }
+
+    // In hub mode path is a directory with one file per endpoint
+    std::string endpointPath(const FlicClient& client, const std::string& path) const {
+        if (!hub) return path;
+        mkdir(path.c_str(), 0755);
+        std::string name = client.sourceTag();
+        std::replace(name.begin(), name.end(), ':', '_');
+        return path + "/" + name;
+    }
+
+    void openJournal(ConsoleClient& console) const {
+        FlicClient& client = console.session();
+        std::string dir = endpointPath(client, journalDir);
+        std::string error;
+        if (!client.openJournal(dir, console.sourceId(), journalOptions, &error)) {
+            std::cerr << "Journal disabled for " << client.sourceTag() << ": " << error << std::endl;
+        }
+    }
+};
+
+static bool loadHubFile(const char* path, std::vector<FlicHub::Endpoint>& endpoints) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        std::string word;
+        if (!(iss >> word) || word[0] == '#') continue;
+        FlicHub::Endpoint endpoint;
+        if (!parseEndpoint(word, endpoint)) {
+            std::cerr << "Invalid endpoint: " << word << std::endl;
+            return false;
+        }
+        endpoints.push_back(endpoint);
+    }
+    return true;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options) {
+    std::vector<std::string> positional;
+    size_t queueKb = 1024;
+    bool threaded = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--hub") {
+            options.hub = true;
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (arg == "--hub-file" && hasValue) {
+            if (!loadHubFile(argv[++i], options.endpoints)) return false;
+        } else if (arg == "--threaded") {
+            threaded = true;
+        } else if (arg == "--queue-kb" && hasValue) {
+            queueKb = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--overflow" && hasValue) {
+            std::string policy = argv[++i];
+            if (policy == "drop") {
+                options.readerPolicy = ThreadedReader::DropNewest;
+            } else if (policy == "block") {
+                options.readerPolicy = ThreadedReader::Block;
+            } else {
+                return false;
+            }
+        } else if (arg == "--format" && hasValue) {
+            if (!EventFormatter::parseFormat(argv[++i], options.format)) return false;
+        } else if (arg == "--adv" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "raw") {
+                options.advMode = FlicClient::AdvertisementRaw;
+            } else if (mode == "changes") {
+                options.advMode = FlicClient::AdvertisementChanges;
+            } else if (mode == "digest") {
+                options.advMode = FlicClient::AdvertisementDigest;
+            } else {
+                return false;
+            }
+        } else if (arg == "--adv-interval-ms" && hasValue) {
+            options.advIntervalMs = std::strtoull(argv[++i], nullptr, 10);
+            if (options.advIntervalMs == 0) return false;
+        } else if (arg == "--battery") {
+            options.battery = true;
+        } else if (arg == "--battery-alert" && hasValue) {
+            char* end;
+            options.batteryLow = static_cast<int>(std::strtol(argv[++i], &end, 10));
+            if (*end != ':') return false;
+            options.batteryCritical = static_cast<int>(std::strtol(end + 1, &end, 10));
+            if (*end != '\0') return false;
+            options.battery = true;
+        } else if (arg == "--latency-policy" && hasValue) {
+            std::string error;
+            if (!options.latencyPolicy.load(argv[++i], &error)) {
+                std::cerr << error << std::endl;
+                return false;
+            }
+            options.latencyPolicyEnabled = true;
+        } else if (arg == "--button-cache" && hasValue) {
+            options.buttonInfoPath = argv[++i];
+        } else if (arg == "--freshness" && hasValue) {
+            std::string error;
+            if (!options.freshnessPolicy.load(argv[++i], &error)) {
+                std::cerr << error << std::endl;
+                return false;
+            }
+            options.freshnessEnabled = true;
+        } else if (arg == "--speculate" && hasValue) {
+            std::string error;
+            if (!options.clickRecognizer.load(argv[++i], &error)) {
+                std::cerr << error << std::endl;
+                return false;
+            }
+            options.speculate = true;
+        } else if (arg == "--actions" && hasValue) {
+            std::string error;
+            options.actions.reset(new ActionEngine());
+            if (!options.actions->load(argv[++i], &error)) {
+                std::cerr << error << std::endl;
+                return false;
+            }
+        } else if (arg == "--session" && hasValue) {
+            options.sessionPath = argv[++i];
+        } else if (arg == "--bus" && hasValue) {
+            options.busPath = argv[++i];
+        } else if (arg == "--journal" && hasValue) {
+            options.journalDir = argv[++i];
+        } else if (arg == "--journal-segment-mb" && hasValue) {
+            options.journalOptions.segmentBytes = std::strtoull(argv[++i], nullptr, 10) << 20;
+            if (options.journalOptions.segmentBytes == 0) return false;
+        } else if (arg == "--journal-segments" && hasValue) {
+            options.journalOptions.maxSegments = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--replay" && hasValue) {
+            options.replayDir = argv[++i];
+        } else if (arg == "--replay-speed" && hasValue) {
+            char* end;
+            options.replaySpeed = std::strtod(argv[++i], &end);
+            if (*end != '\0' || options.replaySpeed < 0) return false;
+        } else if (arg == "--no-reconnect") {
+            options.reconnect = false;
+        } else if (arg == "--backoff-ms" && hasValue) {
+            char* end;
+            options.backoffMinMs = std::strtoull(argv[++i], &end, 10);
+            if (*end != ':') return false;
+            options.backoffMaxMs = std::strtoull(end + 1, nullptr, 10);
+        } else if (arg == "--keepalive-ms" && hasValue) {
+            char* end;
+            options.keepaliveMs = std::strtoull(argv[++i], &end, 10);
+            if (*end == ':') {
+                options.keepaliveTimeoutMs = std::strtoull(end + 1, &end, 10);
+            } else {
+                options.keepaliveTimeoutMs = options.keepaliveMs * 3;
+            }
+            if (*end != '\0') return false;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (threaded) {
+        options.readerQueueBytes = queueKb * 1024;
+    }
+
+    if (options.hub) {
+        for (size_t i = 0; i < positional.size(); i++) {
+            FlicHub::Endpoint endpoint;
+            if (!parseEndpoint(positional[i], endpoint)) {
+                std::cerr << "Invalid endpoint: " << positional[i] << std::endl;
+                return false;
+            }
+            options.endpoints.push_back(endpoint);
+        }
+        return !options.endpoints.empty();
+    }
+
+    if (!options.replayDir.empty()) return positional.empty();
+    if (positional.empty() || positional.size() > 2) return false;
+    FlicHub::Endpoint endpoint;
+    endpoint.host = positional[0];
+    endpoint.port = (positional.size() == 2) ? std::atoi(positional[1].c_str()) : 5551;
+    options.endpoints.push_back(endpoint);
+    return true;
+}
+
+// Feeds a journal through a client's handlers: frames recorded in the same
+// wakeup are dispatched together, at the recorded pace scaled by speed or,
+// with speed 0, back to back
+static int runReplay(const Options& options) {
+    JournalReader reader;
+    JournalReader::Record record;
+    std::string error;
+    if (!reader.open(options.replayDir, &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (!reader.next(record)) {
+        std::cerr << "No frames in " << options.replayDir << std::endl;
+        return 1;
+    }
+
+    // Report events under the recorded server's name
+    FlicHub::Endpoint endpoint;
+    if (!parseEndpoint(reader.source(), endpoint)) {
+        endpoint.host = reader.source();
+        endpoint.port = 0;
+    }
+    ConsoleClient console(endpoint.host, endpoint.port);
+    Options replayOptions = options;
+    replayOptions.journalDir.clear();
+    replayOptions.buttonInfoPath.clear();
+    replayOptions.sessionPath.clear();
+    replayOptions.actions.reset();
+    replayOptions.apply(console);
+    FlicClient& client = console.session();
+
+    uint64_t startNs = EventLoop::nowNs();
+    uint64_t firstWallNs = record.wallNs;
+    uint64_t groupWallNs = record.wallNs;
+    uint64_t frames = 0;
+    do {
+        if (record.wallNs != groupWallNs) {
+            client.injectDone();
+            groupWallNs = record.wallNs;
+            if (options.replaySpeed > 0 && record.wallNs > firstWallNs) {
+                uint64_t due = startNs + static_cast<uint64_t>((record.wallNs - firstWallNs) /
+                                                               options.replaySpeed);
+                struct timespec ts;
+                ts.tv_sec = static_cast<time_t>(due / 1000000000ull);
+                ts.tv_nsec = static_cast<long>(due % 1000000000ull);
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+            }
+        }
+        client.injectFrame(record.data, record.len);
+        frames++;
+    } while (reader.next(record));
+    client.injectDone();
+
+    uint64_t elapsedNs = EventLoop::nowNs() - startNs;
+    std::cerr << "Replayed " << frames << " frames from " << reader.segmentCount()
+              << " segments in " << elapsedNs / 1000000ull << " ms ("
+              << (elapsedNs ? frames * 1000000000ull / elapsedNs : 0) << " frames/s, "
+              << (frames ? elapsedNs / frames : 0) << " ns/frame)" << std::endl;
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <host> [port]" << std::endl;
-        std::cerr << "Example: " << argv[0] << " localhost 5551" << std::endl;
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
         return 1;
     }
 
-    std::string host = argv[1];
-    int port = (argc >= 3) ? std::atoi(argv[2]) : 5551;
+    if (!options.replayDir.empty() && !options.hub) {
+        return runReplay(options);
+    }
+    if (options.actions) options.actions->start();
+
+    if (options.hub) {
+        FlicHub hub(options.endpoints, options.threads,
+                    [&options](ConsoleClient& console) { options.apply(console); });
+        hub.run();
+        return 0;
+    }
+
+    ConsoleClient console(options.endpoints[0].host, options.endpoints[0].port);
+    options.apply(console);
 
-    FlicClient client(host, port);
-    
-    if (!client.connect()) {
+    if (!console.session().connect()) {
         return 1;
     }
 
-    client.run();
+    console.run();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,529 @@
+#ifndef FLIC_CLIENT_H
+#define FLIC_CLIENT_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#include "client_protocol_packets.h"
+#include "advertisement_table.h"
+#include "backoff.h"
+#include "battery_monitor.h"
+#include "bd_addr.h"
+#include "button_info_cache.h"
+#include "channel_table.h"
+#include "click_recognizer.h"
+#include "command_writer.h"
+#include "event_journal.h"
+#include "event_loop.h"
+#include "event_stats.h"
+#include "frame_decoder.h"
+#include "freshness_policy.h"
+#include "latency_histogram.h"
+#include "latency_policy.h"
+#include "packet_views.h"
+#include "session_snapshot.h"
+#include "threaded_reader.h"
+
+// Receives everything a FlicClient reports, on the client's event loop
+// thread. There is one callback per event packet; the packet struct and any
+// view of its variable-length part are only valid for the duration of the
+// call. Every method has an empty default, so observers override just what
+// they need.
+class FlicClientObserver {
+public:
+    virtual ~FlicClientObserver() {}
+
+    // Session lifecycle
+    virtual void onConnected() {}
+    // reconnecting is false when the client gives up (reconnect disabled)
+    virtual void onDisconnected(bool reconnecting) { (void)reconnecting; }
+    virtual void onReconnectScheduled(uint64_t delayMs, unsigned attempt) {
+        (void)delayMs; (void)attempt;
+    }
+    // The socket is back; channels and scanners are being re-created
+    virtual void onReconnected(unsigned attempts, uint64_t outageMs,
+                               size_t channels, size_t scanners) {
+        (void)attempts; (void)outageMs; (void)channels; (void)scanners;
+    }
+    // Every replayed channel is Ready (or failed)
+    virtual void onRecoveryComplete(size_t ready, size_t total, uint64_t elapsedMs) {
+        (void)ready; (void)total; (void)elapsedMs;
+    }
+    // Every channel of a connectAll() run is Ready or failed
+    virtual void onProvisioningComplete(size_t ready, size_t total, uint64_t elapsedMs) {
+        (void)ready; (void)total; (void)elapsedMs;
+    }
+    // err is an errno value, or 0 when there is none
+    virtual void onError(const char* what, int err) { (void)what; (void)err; }
+
+    // Aggregated advertisements (see FlicClient::setAdvertisementMode). The
+    // digest is delivered once per interval if any button advertised in it;
+    // Entry::windowPackets tells which ones did.
+    virtual void onAdvertisementChanged(const AdvertisementTable::Entry& entry, unsigned changes) {
+        (void)entry; (void)changes;
+    }
+    virtual void onAdvertisementDigest(const AdvertisementTable& table) { (void)table; }
+
+    // A button's battery alert level (FlicClientProtocol::BatteryStatus)
+    // changed; see FlicClient::setBatteryMonitoring
+    virtual void onBatteryAlert(const BatteryMonitor::Series& series, uint8_t level) {
+        (void)series; (void)level;
+    }
+
+    // A click recognizer guessed a single click or hold from ButtonUpOrDown
+    // (see FlicClient::setClickRecognizer), and later flicd's verdict on it
+    // or its expiry. speculation.outcome tells which.
+    virtual void onSpeculativeClick(const ClickRecognizer::Speculation& speculation) {
+        (void)speculation;
+    }
+    virtual void onSpeculationResolved(const ClickRecognizer::Speculation& speculation) {
+        (void)speculation;
+    }
+
+    // A button event past its deadline is about to be delivered anyway
+    // (see FlicClient::setFreshnessPolicy). Its own callback follows right
+    // after; collapsed counts the older stale events of the same kind it
+    // replaces.
+    virtual void onStaleEvent(const FlicClientProtocol::EvtButtonUpOrDown& evt, uint64_t ageMs,
+                              uint32_t collapsed) {
+        (void)evt; (void)ageMs; (void)collapsed;
+    }
+
+    // Every event packet, just before its own callback below
+    virtual void onPacket(const uint8_t* data, size_t len) { (void)data; (void)len; }
+
+    // Event packets
+    virtual void onAdvertisementPacket(const FlicClientProtocol::EvtAdvertisementPacket& evt) { (void)evt; }
+    virtual void onCreateConnectionChannelResponse(const FlicClientProtocol::EvtCreateConnectionChannelResponse& evt) { (void)evt; }
+    virtual void onConnectionStatusChanged(const FlicClientProtocol::EvtConnectionStatusChanged& evt) { (void)evt; }
+    virtual void onConnectionChannelRemoved(const FlicClientProtocol::EvtConnectionChannelRemoved& evt) { (void)evt; }
+    virtual void onButtonUpOrDown(const FlicClientProtocol::EvtButtonUpOrDown& evt) { (void)evt; }
+    virtual void onButtonClickOrHold(const FlicClientProtocol::EvtButtonClickOrHold& evt) { (void)evt; }
+    virtual void onButtonSingleOrDoubleClick(const FlicClientProtocol::EvtButtonSingleOrDoubleClick& evt) { (void)evt; }
+    virtual void onButtonSingleOrDoubleClickOrHold(const FlicClientProtocol::EvtButtonSingleOrDoubleClickOrHold& evt) { (void)evt; }
+    virtual void onNewVerifiedButton(const FlicClientProtocol::EvtNewVerifiedButton& evt) { (void)evt; }
+    virtual void onGetInfoResponse(const FlicClientProtocol::EvtGetInfoResponse& evt,
+                                   const VerifiedButtonList& verifiedButtons) {
+        (void)evt; (void)verifiedButtons;
+    }
+    virtual void onNoSpaceForNewConnection(const FlicClientProtocol::EvtNoSpaceForNewConnection& evt) { (void)evt; }
+    virtual void onGotSpaceForNewConnection(const FlicClientProtocol::EvtGotSpaceForNewConnection& evt) { (void)evt; }
+    virtual void onBluetoothControllerStateChange(const FlicClientProtocol::EvtBluetoothControllerStateChange& evt) { (void)evt; }
+    virtual void onPingResponse(const FlicClientProtocol::EvtPingResponse& evt) { (void)evt; }
+    virtual void onGetButtonInfoResponse(const FlicClientProtocol::EvtGetButtonInfoResponse& evt,
+                                         const ButtonInfoView& info) {
+        (void)evt; (void)info;
+    }
+    virtual void onScanWizardFoundPrivateButton(const FlicClientProtocol::EvtScanWizardFoundPrivateButton& evt) { (void)evt; }
+    virtual void onScanWizardFoundPublicButton(const FlicClientProtocol::EvtScanWizardFoundPublicButton& evt) { (void)evt; }
+    virtual void onScanWizardButtonConnected(const FlicClientProtocol::EvtScanWizardButtonConnected& evt) { (void)evt; }
+    virtual void onScanWizardCompleted(const FlicClientProtocol::EvtScanWizardCompleted& evt) { (void)evt; }
+    virtual void onButtonDeleted(const FlicClientProtocol::EvtButtonDeleted& evt) { (void)evt; }
+    virtual void onBatteryStatus(const FlicClientProtocol::EvtBatteryStatus& evt) { (void)evt; }
+
+    // Unknown opcodes and packets too short for their struct
+    virtual void onUnknownPacket(const uint8_t* data, size_t len) { (void)data; (void)len; }
+
+    // Called once after all events from one socket wakeup were delivered,
+    // e.g. to flush output or commit a batch of commands
+    virtual void onDispatchDone() {}
+};
+
+// Protocol engine for one flicd connection.
+//
+// Owns the socket, framing, command batching, optional reader thread and
+// reconnect logic, and reports decoded events to a FlicClientObserver. All
+// methods must be called on the thread that runs eventLoop().
+class FlicClient {
+public:
+    typedef std::unordered_set<uint32_t> ScannerSet;
+    typedef std::vector<std::pair<BdAddr, uint32_t> > ButtonList;  // address, conn_id
+
+    // Progress of the current (or last) connectAll() run
+    struct ProvisioningStatus {
+        bool active;
+        size_t total;
+        size_t ready;
+        size_t failed;
+        size_t rejections;    // MaxPendingConnectionsReached answers, retried
+        uint64_t startNs;
+        uint64_t parkedNs;    // time spent waiting for GotSpaceForNewConnection
+        uint64_t elapsedMs;   // start to completion, once finished
+    };
+
+    // How advertisements reach the observer: every packet through
+    // onAdvertisementPacket (Raw, the default), or folded into
+    // advertisements() and reported as state changes or a periodic digest
+    enum AdvertisementMode {
+        AdvertisementRaw,
+        AdvertisementChanges,
+        AdvertisementDigest
+    };
+
+    // Pass externalLoop to share one event loop between several clients
+    FlicClient(const std::string& host, int port = 5551, EventLoop* externalLoop = nullptr);
+    ~FlicClient();
+
+    // Not owned; may be null
+    void setObserver(FlicClientObserver* observer);
+
+    // Blocking connect followed by GetInfo, with the scanners of a restored
+    // session in the same write. Socket reads start with start().
+    bool connect();
+    void disconnect();
+
+    // Registers the connected socket with the event loop
+    bool start();
+
+    // Reconnect with backoff between minMs and maxMs after the server goes
+    // away (default on, 250 ms to 30 s)
+    void setReconnect(bool enable, uint64_t minMs, uint64_t maxMs);
+
+    // Keeps retrying in the background after the initial connect() failed.
+    // Returns false if reconnect is disabled.
+    bool retryConnect();
+
+    // Stops a pending reconnect attempt; the client stays disconnected
+    void cancelReconnect();
+
+    // Sends a ping every intervalMs while connected and tears the session
+    // down (reconnecting if enabled) when one stays unanswered for timeoutMs,
+    // so a half-open connection is noticed. Round trips go to pingLatency().
+    // intervalMs == 0 turns it off (the default).
+    void setKeepalive(uint64_t intervalMs, uint64_t timeoutMs);
+
+    // Must be called before connect()
+    void setNoDelay(bool enable);
+
+    // Moves socket reads to a dedicated I/O thread that queues frames for
+    // the event loop thread, which runs the handlers. queueBytes == 0 keeps
+    // reading and dispatch inline. Must be called before start().
+    void setThreadedReader(size_t queueBytes, ThreadedReader::OverflowPolicy policy);
+
+    // intervalMs is the minimum time between RSSI reports per button in
+    // Changes mode and the digest period in Digest mode. Lost buttons are
+    // reported through onAdvertisementChanged in both.
+    void setAdvertisementMode(AdvertisementMode mode, uint64_t intervalMs = 1000);
+
+    // Lets policy pick each channel's latency mode from its button activity
+    // (see LatencyPolicy). Existing channels get their profile now and are
+    // moved to the idle mode once quiet; new channels start idle. Without a
+    // policy channels are created in NormalLatency and never changed.
+    void setLatencyPolicy(const LatencyPolicy& policy);
+    void clearLatencyPolicy();
+
+    // Reports single clicks and holds as soon as ButtonUpOrDown shows them,
+    // ahead of flicd's ButtonSingleOrDoubleClickOrHold, for the buttons
+    // recognizer's profiles enable (see ClickRecognizer). Queued events are
+    // not guessed from.
+    void setClickRecognizer(const ClickRecognizer& recognizer);
+    void clearClickRecognizer();
+    // Null unless a recognizer is set
+    const ClickRecognizer* clickRecognizer() const { return recognizer.get(); }
+
+    // Gives button events the deadlines of policy's profiles (see
+    // FreshnessPolicy) and drops, flags or collapses the ones dispatched
+    // after it. Button events that arrive together are dispatched earliest
+    // deadline first, those already past it last; each button's events
+    // keep their order.
+    void setFreshnessPolicy(const FreshnessPolicy& policy);
+    void clearFreshnessPolicy();
+    // Null unless a policy is set
+    const FreshnessPolicy* freshnessPolicy() const { return freshness.get(); }
+    const FreshnessPolicy::Stats& freshnessStats() const { return freshnessCounters; }
+
+    // Registers a battery status listener for every channel, in one write,
+    // and for each channel created from now on together with it. Readings
+    // go into batteries() and alert level changes to onBatteryAlert.
+    // Listener ids are the channels' conn_ids.
+    void setBatteryMonitoring(bool enable);
+
+    // Requests button info for every channel that becomes Ready while its
+    // address is not in buttonInfo() yet. Off by default; responses go into
+    // buttonInfo() either way.
+    void setButtonInfoFetch(bool enable);
+
+    // The channels (with their mode parameters), scanners and battery
+    // monitoring setting asked for so far, for restoreSession() in a later
+    // run. sessionChanges() counts changes to them, so a caller can tell
+    // whether a saved snapshot is stale.
+    SessionSnapshot snapshotSession() const;
+    uint64_t sessionChanges() const { return sessionChangeCount; }
+
+    // Queues everything in snapshot like connectAll() (reported through
+    // onProvisioningComplete) and keeps each channel's saved mode unless a
+    // latency policy is set. Meant to be called before connect(): the
+    // scanners then go out together with the first GetInfo, and the channels
+    // and their battery listeners in one write as soon as it is answered.
+    void restoreSession(const SessionSnapshot& snapshot);
+
+    // Appends every frame received from the server to a segmented journal
+    // in dir, tagged with the source tag and sourceId, for replay with
+    // injectFrame(). A write failure is reported through onError and stops
+    // journaling.
+    bool openJournal(const std::string& dir, uint16_t sourceId,
+                     const EventJournal::Options& options, std::string* error);
+    void closeJournal();
+    const EventJournal* journal() const { return eventJournal.get(); }
+
+    // Runs the handlers for a frame that did not come from the socket, e.g.
+    // one read back from a journal, as if it had just been received. Call
+    // injectDone() after each group of frames that arrived together.
+    void injectFrame(const uint8_t* frame, size_t len);
+    void injectDone();
+
+    // Commands issued between beginBatch() and commit() go out in one write
+    void beginBatch();
+    bool commit();
+
+    // Commands return false if they could not be queued (e.g. not connected)
+    bool getInfo();
+    bool startScanWizard(uint32_t scan_wizard_id = 0);
+    bool cancelScanWizard(uint32_t scan_wizard_id = 0);
+    bool startScan(uint32_t scan_id = 0);
+    bool stopScan(uint32_t scan_id = 0);
+    // Channel creation goes through admission control: requests are queued
+    // and sent while this client's pending channels stay below the server's
+    // limit (from GetInfo) and the server has space for new connections.
+    // Returns true once the request is queued, also while the server is away.
+    bool connectButton(const BdAddr& addr, uint32_t conn_id);
+    // Queues many channels at once and reports through
+    // onProvisioningComplete when all of them are Ready or failed
+    void connectAll(const ButtonList& buttons);
+    // Sends CmdChangeModeParameters for an existing channel and keeps the
+    // new mode for later re-creation. A queued channel is only updated
+    // locally. With a latency policy set, the policy may change the mode
+    // again on the next press or once the channel is idle.
+    bool changeModeParameters(uint32_t conn_id, uint8_t latencyMode, int16_t autoDisconnectTime);
+    bool disconnectButton(uint32_t conn_id);
+    // Removes the channel to addr found through channels().findByAddr()
+    bool disconnectButton(const BdAddr& addr);
+    bool forceDisconnect(const BdAddr& addr);
+    // Asks the server even when addr is cached; a request already in flight
+    // for addr answers this one too
+    bool getButtonInfo(const BdAddr& addr);
+    // Like getButtonInfo() but returns true without sending when addr is
+    // already in buttonInfo()
+    bool requestButtonInfo(const BdAddr& addr);
+    bool deleteButton(const BdAddr& addr);
+
+    EventLoop& eventLoop() { return *loop; }
+    const std::string& sourceTag() const { return source; }
+    bool isConnected() const { return connected; }
+    bool isReconnecting() const { return !connected && (reconnectTimer || pendingFd >= 0); }
+
+    // Channels requested through connectButton() with their last known state
+    const ChannelTable& channels() const { return connections; }
+    const ScannerSet& activeScanners() const { return scanners; }
+    AdvertisementTable& advertisements() { return advTable; }
+    BatteryMonitor& batteries() { return batteryMonitor; }
+    ButtonInfoCache& buttonInfo() { return buttonInfoCache; }
+    const ProvisioningStatus& provisioning() const { return provision; }
+    // Channels waiting for admission, and on the server but not yet connected
+    size_t queuedChannels() const { return queuedCount; }
+    size_t pendingChannels() const { return pendingCount; }
+    // CmdChangeModeParameters sent, by the policy or changeModeParameters()
+    uint64_t modeChanges() const { return modeChangeCount; }
+
+    // Per-button event age and dispatch latency
+    EventStats& eventStats() { return stats; }
+    // Null unless the threaded reader is running
+    const ThreadedReader* threadedReader() const { return reader.get(); }
+    // Outage until the socket was back, and until all replayed channels were Ready
+    const LatencyHistogram& reconnectLatency() const { return reconnectMs; }
+    const LatencyHistogram& recoveryLatency() const { return channelsReadyMs; }
+    // Keepalive ping round trips in microseconds, and sessions torn down
+    // because a ping went unanswered
+    const LatencyHistogram& pingLatency() const { return pingRttUs; }
+    uint64_t keepaliveTimeouts() const { return keepaliveTimeoutCount; }
+
+private:
+    int sockfd;
+    std::string host;
+    int port;
+    bool connected;
+    FlicClientObserver* observer;
+    FlicClientObserver nullObserver;
+
+    ChannelTable connections;
+    ScannerSet scanners;
+    uint64_t sessionChangeCount;                 // see sessionChanges()
+
+    AdvertisementTable advTable;
+    AdvertisementMode advMode;
+    uint64_t advIntervalMs;
+    EventLoop::TimerId advTimer;  // armed while the table has entries
+
+    FrameDecoder decoder;
+    EventStats stats;
+    std::unique_ptr<EventJournal> eventJournal;
+
+    std::unique_ptr<ThreadedReader> reader;
+    size_t readerQueueBytes;
+    ThreadedReader::OverflowPolicy readerPolicy;
+    CommandWriter writer;
+    bool noDelay;
+    bool wantWrite;
+
+    std::unique_ptr<EventLoop> ownLoop;
+    EventLoop* loop;
+    std::string source;  // "host:port"
+    EventLoop::TimerId teardownTimer;  // handleDisconnect after a write error
+
+    // Reconnect: after the server goes away, non-blocking connects are retried
+    // with jittered exponential backoff and the channels and scanners of the
+    // previous session are re-created in one batch
+    bool autoReconnect;
+    Backoff backoff;
+    EventLoop::TimerId reconnectTimer;
+    int pendingFd;                               // connect() in progress
+    uint64_t outageStartNs;
+    size_t awaitingReady;                        // channels flagged AwaitingReady
+    size_t replayedChannels;
+    size_t replayFailed;
+    LatencyHistogram reconnectMs;
+    LatencyHistogram channelsReadyMs;
+
+    // Admission control for channel creation. The limit is the server's
+    // max_pending_connections minus what other clients had pending at the
+    // last GetInfo, capped at what was in flight when the server answered
+    // MaxPendingConnectionsReached anyway.
+    std::deque<uint32_t> admissionQueue;         // conn_ids; stale entries skipped
+    size_t queuedCount;                          // channels flagged Queued
+    size_t pendingCount;                         // channels flagged Pending
+    bool serverInfoKnown;
+    bool infoRequested;
+    bool noSpace;
+    uint64_t noSpaceSinceNs;
+    size_t pendingLimit;
+    size_t pendingCap;                           // after a rejection; SIZE_MAX = none
+    bool admissionWanted;                        // run admitChannels() after dispatch
+    EventLoop::TimerId admissionTimer;           // GetInfo poll while blocked
+    ProvisioningStatus provision;
+
+    // Keepalive pings in flight, oldest first. flicd answers in order, so
+    // the front is the one that times out first.
+    struct OutstandingPing {
+        uint32_t pingId;
+        uint64_t sentNs;
+    };
+    std::deque<OutstandingPing> outstandingPings;
+    uint64_t keepaliveIntervalMs;
+    uint64_t keepaliveTimeoutMs;
+    EventLoop::TimerId keepaliveTimer;
+    uint32_t nextPingId;
+    uint64_t keepaliveTimeoutCount;
+    LatencyHistogram pingRttUs;
+
+    BatteryMonitor batteryMonitor;
+    bool batteryMonitoring;
+
+    ButtonInfoCache buttonInfoCache;
+    bool buttonInfoFetch;
+
+    std::unique_ptr<ClickRecognizer> recognizer;
+
+    // Button events of the current dispatch, held back for deadline order
+    // while a freshness policy is set. Events are copied because threaded
+    // mode's frame queue reuses its slots.
+    struct DeferredEvent {
+        uint64_t deadlineNs;
+        uint64_t orderNs;             // deadline, raised to the button's previous one
+        uint64_t recvNs;
+        uint32_t seq;                 // arrival order
+        uint32_t collapsed;
+        uint8_t stale;                // FreshnessPolicy::StaleAction
+        bool replaced;                // collapsed into a later slot; skipped
+        bool missed;                  // past the deadline, or after a missed one of its button
+        FlicClientProtocol::EvtButtonUpOrDown evt;
+    };
+    std::unique_ptr<FreshnessPolicy> freshness;
+    FreshnessPolicy::Stats freshnessCounters;
+    std::vector<DeferredEvent> deferred;
+    std::unordered_map<uint64_t, size_t> deferredIndex;  // collapse key or conn_id -> deferred slot
+
+    LatencyPolicy latencyPolicy;
+    bool latencyPolicyEnabled;
+    EventLoop::TimerId latencyTimer;             // idle check while a policy is set
+    uint64_t modeChangeCount;
+
+    static const uint64_t kConnectTimeoutMs = 5000;
+    static const uint64_t kAdmissionPollMs = 1000;
+    static const size_t kMaxOutstandingPings = 64;
+
+    FlicClient(const FlicClient&);
+    FlicClient& operator=(const FlicClient&);
+
+    bool writePacket(const void* data, size_t len);
+    void failConnection(const char* what);
+
+    bool readPackets();
+    void dispatchQueued();
+    void dispatchFrame(const uint8_t* frame, size_t len, uint64_t recvNs);
+    void deliverFrame(const uint8_t* frame, size_t len, uint64_t recvNs);
+    void deferButtonEvent(const FlicClientProtocol::EvtButtonUpOrDown& evt, uint64_t recvNs);
+    void flushDeferred();
+    void journalFrame(const uint8_t* frame, size_t len, uint64_t recvNs);
+    void handlePacket(const uint8_t* data, size_t len);
+    void handleAdvertisement(const FlicClientProtocol::EvtAdvertisementPacket& evt);
+    void onAdvertisementTimer();
+
+    void onSocketEvent(uint32_t events);
+    void handleDisconnect();
+    void syncWriteInterest();
+
+    void scheduleReconnect();
+    void attemptReconnect();
+    void abandonPendingConnect();
+    void onReconnectComplete();
+    void replaySession();
+    void replaySettled(uint32_t conn_id, bool ready);
+    void completeRecovery();
+
+    void enqueueChannel(ChannelTable::Channel& channel, bool front);
+    void admitChannels();
+    void finishDispatch();
+    void setPending(ChannelTable::Channel& channel, bool pending);
+    void setNoSpace(bool full);
+    ChannelTable::Channel& provisionChannel(const uint8_t* address, uint32_t conn_id);
+    void provisionSettled(ChannelTable::Channel& channel, bool ready);
+    void forgetChannel(ChannelTable::Channel& channel);
+    void onGetInfoResponse(const FlicClientProtocol::EvtGetInfoResponse& evt);
+    void onCreateChannelFailed(const FlicClientProtocol::EvtCreateConnectionChannelResponse& evt);
+
+    void handleBatteryStatus(const FlicClientProtocol::EvtBatteryStatus& evt);
+    bool sendBatteryListener(ChannelTable::Channel& channel, bool create);
+
+    void onChannelReady(ChannelTable::Channel& channel);
+    void handleButtonInfo(const FlicClientProtocol::EvtGetButtonInfoResponse& evt,
+                          const ButtonInfoView& info);
+
+    void onKeepaliveTimer();
+    bool consumePingResponse(uint32_t pingId);
+
+    void recognizeClick(const ChannelTable::Channel& channel, uint8_t opcode,
+                        const FlicClientProtocol::EvtButtonUpOrDown& evt, uint64_t recvNs);
+    void speculated(const ClickRecognizer::Speculation& speculation);
+    void cancelRecognizerTimer(EventLoop::TimerId* timer);
+    void onHoldTimer(uint32_t conn_id);
+    void onConfirmTimer(uint32_t conn_id);
+
+    void initChannelMode(ChannelTable::Channel& channel);
+    void setChannelMode(ChannelTable::Channel& channel, uint8_t latencyMode, int16_t autoDisconnectTime);
+    void onLatencyTimer();
+
+    bool sendCreateScanner(uint32_t scan_id);
+    bool sendCreateConnectionChannel(const ChannelTable::Channel& channel);
+    bool resolve(struct sockaddr_in& serv_addr);
+    void attachSocket();
+};
+
+#endif // FLIC_CLIENT_H
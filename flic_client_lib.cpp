@@ -0,0 +1,1476 @@
+#include "flic_client.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+using namespace FlicClientProtocol;
+
+FlicClient::FlicClient(const std::string& host, int port, EventLoop* externalLoop)
+    : sockfd(-1), host(host), port(port), connected(false), observer(&nullObserver),
+      sessionChangeCount(0),
+      advMode(AdvertisementRaw), advIntervalMs(1000), advTimer(0),
+      readerQueueBytes(0), readerPolicy(ThreadedReader::DropNewest),
+      noDelay(true), wantWrite(false), loop(externalLoop),
+      source(host + ":" + std::to_string(port)), teardownTimer(0),
+      autoReconnect(true), reconnectTimer(0), pendingFd(-1), outageStartNs(0),
+      awaitingReady(0), replayedChannels(0), replayFailed(0), reconnectMs(3600000), channelsReadyMs(3600000),
+      queuedCount(0), pendingCount(0), serverInfoKnown(false), infoRequested(false), noSpace(false),
+      noSpaceSinceNs(0), pendingLimit(0), pendingCap(SIZE_MAX), admissionWanted(false),
+      admissionTimer(0), keepaliveIntervalMs(0), keepaliveTimeoutMs(0), keepaliveTimer(0),
+      nextPingId(0x80000000u), keepaliveTimeoutCount(0), pingRttUs(60000000),
+      batteryMonitoring(false), buttonInfoFetch(false), latencyPolicyEnabled(false), latencyTimer(0), modeChangeCount(0) {
+    std::memset(&provision, 0, sizeof(provision));
+    if (!loop) {
+        ownLoop.reset(new EventLoop());
+        loop = ownLoop.get();
+    }
+}
+
+FlicClient::~FlicClient() {
+    if (advTimer) loop->cancelTimer(advTimer);
+    if (admissionTimer) loop->cancelTimer(admissionTimer);
+    if (latencyTimer) loop->cancelTimer(latencyTimer);
+    if (keepaliveTimer) loop->cancelTimer(keepaliveTimer);
+    if (teardownTimer) loop->cancelTimer(teardownTimer);
+    clearClickRecognizer();
+    cancelReconnect();
+    disconnect();
+}
+
+void FlicClient::setObserver(FlicClientObserver* obs) {
+    observer = obs ? obs : &nullObserver;
+}
+
+bool FlicClient::connect() {
+    // Create socket
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        observer->onError("Failed to create socket", errno);
+        return false;
+    }
+
+    // Resolve hostname
+    struct sockaddr_in serv_addr;
+    if (!resolve(serv_addr)) {
+        close(sockfd);
+        sockfd = -1;
+        return false;
+    }
+
+    // Connect
+    if (::connect(sockfd, reinterpret_cast<struct sockaddr*>(&serv_addr),
+                  sizeof(serv_addr)) < 0) {
+        observer->onError("Failed to connect", errno);
+        close(sockfd);
+        sockfd = -1;
+        return false;
+    }
+
+    attachSocket();
+    observer->onConnected();
+
+    // Immediately request server info; scanners restored before connecting
+    // go out in the same write
+    beginBatch();
+    getInfo();
+    for (ScannerSet::const_iterator it = scanners.begin(); it != scanners.end(); ++it) {
+        sendCreateScanner(*it);
+    }
+    commit();
+
+    return true;
+}
+
+// Also drops the loop's entries for the socket and the reader, which an
+// external loop would otherwise keep calling into a destroyed client
+void FlicClient::disconnect() {
+    if (reader) {
+        loop->removeFd(reader->notifyFd());
+        reader->stop();
+        reader.reset();
+    }
+    if (sockfd >= 0) {
+        loop->removeFd(sockfd);
+        close(sockfd);
+        sockfd = -1;
+    }
+    connected = false;
+}
+
+bool FlicClient::start() {
+    if (!connected) return false;
+    wantWrite = false;
+
+    if (readerQueueBytes > 0) {
+        reader.reset(new ThreadedReader(readerQueueBytes, readerPolicy));
+        if (!reader->start(sockfd) ||
+            !loop->addFd(reader->notifyFd(), EPOLLIN, [this](uint32_t) { dispatchQueued(); })) {
+            reader.reset();
+            return false;
+        }
+    } else if (!loop->addFd(sockfd, EPOLLIN, [this](uint32_t events) { onSocketEvent(events); })) {
+        return false;
+    }
+    syncWriteInterest();
+    return true;
+}
+
+void FlicClient::setReconnect(bool enable, uint64_t minMs, uint64_t maxMs) {
+    autoReconnect = enable;
+    backoff.setRange(minMs, maxMs);
+}
+
+bool FlicClient::retryConnect() {
+    if (!autoReconnect || connected || reconnectTimer || pendingFd >= 0) return false;
+    outageStartNs = EventLoop::nowNs();
+    scheduleReconnect();
+    return true;
+}
+
+void FlicClient::cancelReconnect() {
+    if (reconnectTimer) {
+        loop->cancelTimer(reconnectTimer);
+        reconnectTimer = 0;
+    }
+    abandonPendingConnect();
+}
+
+void FlicClient::setKeepalive(uint64_t intervalMs, uint64_t timeoutMs) {
+    keepaliveIntervalMs = intervalMs;
+    keepaliveTimeoutMs = timeoutMs > intervalMs ? timeoutMs : intervalMs;
+    outstandingPings.clear();
+    if (keepaliveTimer) {
+        loop->cancelTimer(keepaliveTimer);
+        keepaliveTimer = 0;
+    }
+    if (intervalMs > 0) {
+        keepaliveTimer = loop->addPeriodicTimer(intervalMs, [this]() { onKeepaliveTimer(); });
+    }
+}
+
+void FlicClient::setNoDelay(bool enable) {
+    noDelay = enable;
+}
+
+void FlicClient::setThreadedReader(size_t queueBytes, ThreadedReader::OverflowPolicy policy) {
+    readerQueueBytes = queueBytes;
+    readerPolicy = policy;
+}
+
+void FlicClient::setAdvertisementMode(AdvertisementMode mode, uint64_t intervalMs) {
+    advMode = mode;
+    advIntervalMs = intervalMs > 0 ? intervalMs : 1;
+    advTable.setMinInterval(mode == AdvertisementChanges ? advIntervalMs : 0);
+    if (advTimer) {
+        loop->cancelTimer(advTimer);
+        advTimer = 0;
+    }
+    if (mode == AdvertisementRaw) advTable.clear();
+}
+
+void FlicClient::setLatencyPolicy(const LatencyPolicy& policy) {
+    latencyPolicy = policy;
+    latencyPolicyEnabled = true;
+    connections.forEach([this](ChannelTable::Channel& channel) {
+        uint8_t addr[6];
+        channel.address(addr);
+        channel.profile = latencyPolicy.profileFor(addr);
+        channel.burstPresses = 0;
+    });
+    if (latencyTimer) loop->cancelTimer(latencyTimer);
+    latencyTimer = loop->addPeriodicTimer(latencyPolicy.tickMs(), [this]() { onLatencyTimer(); });
+}
+
+void FlicClient::setClickRecognizer(const ClickRecognizer& r) {
+    clearClickRecognizer();
+    recognizer.reset(new ClickRecognizer(r));
+}
+
+void FlicClient::clearClickRecognizer() {
+    if (!recognizer) return;
+    recognizer->clear([this](EventLoop::TimerId timer) { loop->cancelTimer(timer); });
+    recognizer.reset();
+}
+
+void FlicClient::setFreshnessPolicy(const FreshnessPolicy& policy) {
+    freshness.reset(new FreshnessPolicy(policy));
+}
+
+void FlicClient::clearFreshnessPolicy() {
+    freshness.reset();
+}
+
+void FlicClient::setBatteryMonitoring(bool enable) {
+    if (enable != batteryMonitoring) sessionChangeCount++;
+    batteryMonitoring = enable;
+    beginBatch();
+    connections.forEach([this, enable](ChannelTable::Channel& channel) {
+        if (channel.flags & ChannelTable::Queued) return;
+        if (enable != ((channel.flags & ChannelTable::BatteryListener) != 0)) {
+            sendBatteryListener(channel, enable);
+        }
+    });
+    commit();
+}
+
+void FlicClient::setButtonInfoFetch(bool enable) {
+    buttonInfoFetch = enable;
+}
+
+void FlicClient::clearLatencyPolicy() {
+    latencyPolicyEnabled = false;
+    if (latencyTimer) {
+        loop->cancelTimer(latencyTimer);
+        latencyTimer = 0;
+    }
+}
+
+void FlicClient::beginBatch() {
+    writer.beginBatch();
+}
+
+bool FlicClient::commit() {
+    if (!connected) {
+        writer.commit();
+        return false;
+    }
+    if (!writer.commit()) {
+        failConnection("Failed to write packet");
+        return false;
+    }
+    syncWriteInterest();
+    return true;
+}
+
+bool FlicClient::getInfo() {
+    CmdGetInfo cmd;
+    cmd.opcode = CMD_GET_INFO_OPCODE;
+    if (!writePacket(&cmd, sizeof(cmd))) return false;
+    infoRequested = true;
+    return true;
+}
+
+bool FlicClient::startScanWizard(uint32_t scan_wizard_id) {
+    CmdCreateScanWizard cmd;
+    cmd.opcode = CMD_CREATE_SCAN_WIZARD_OPCODE;
+    cmd.scan_wizard_id = scan_wizard_id;
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+bool FlicClient::cancelScanWizard(uint32_t scan_wizard_id) {
+    CmdCancelScanWizard cmd;
+    cmd.opcode = CMD_CANCEL_SCAN_WIZARD_OPCODE;
+    cmd.scan_wizard_id = scan_wizard_id;
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+bool FlicClient::startScan(uint32_t scan_id) {
+    if (scanners.insert(scan_id).second) sessionChangeCount++;
+    return sendCreateScanner(scan_id);
+}
+
+bool FlicClient::stopScan(uint32_t scan_id) {
+    if (scanners.erase(scan_id)) sessionChangeCount++;
+    CmdRemoveScanner cmd;
+    cmd.opcode = CMD_REMOVE_SCANNER_OPCODE;
+    cmd.scan_id = scan_id;
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+bool FlicClient::connectButton(const BdAddr& addr, uint32_t conn_id) {
+    if (ChannelTable::Channel* old = connections.find(conn_id)) {
+        forgetChannel(*old);
+    }
+    ChannelTable::Channel& channel = connections.insert(conn_id, addr.data());
+    channel.status = Disconnected;
+    initChannelMode(channel);
+    enqueueChannel(channel, false);
+    sessionChangeCount++;
+    admitChannels();
+    return true;
+}
+
+void FlicClient::connectAll(const ButtonList& buttons) {
+    connections.reserve(connections.size() + buttons.size());
+    for (size_t i = 0; i < buttons.size(); i++) {
+        provisionChannel(buttons[i].first.data(), buttons[i].second);
+    }
+    admitChannels();
+}
+
+SessionSnapshot FlicClient::snapshotSession() const {
+    SessionSnapshot snapshot;
+    snapshot.channels.reserve(connections.size());
+    connections.forEach([&snapshot](const ChannelTable::Channel& channel) {
+        uint8_t addr[6];
+        channel.address(addr);
+        snapshot.addChannel(addr, channel.connId, channel.latencyMode, channel.autoDisconnectTime);
+    });
+    snapshot.scanners.assign(scanners.begin(), scanners.end());
+    snapshot.batteryMonitoring = batteryMonitoring;
+    return snapshot;
+}
+
+void FlicClient::restoreSession(const SessionSnapshot& snapshot) {
+    if (snapshot.batteryMonitoring) setBatteryMonitoring(true);
+
+    beginBatch();
+    for (size_t i = 0; i < snapshot.scanners.size(); i++) {
+        if (scanners.count(snapshot.scanners[i])) continue;
+        startScan(snapshot.scanners[i]);
+    }
+    commit();
+
+    connections.reserve(connections.size() + snapshot.channels.size());
+    for (size_t i = 0; i < snapshot.channels.size(); i++) {
+        const SessionSnapshot::Channel& saved = snapshot.channels[i];
+        ChannelTable::Channel& channel = provisionChannel(saved.address, saved.connId);
+        if (!latencyPolicyEnabled) {
+            channel.latencyMode = saved.latencyMode;
+            channel.autoDisconnectTime = saved.autoDisconnectTime;
+        }
+    }
+    admitChannels();
+}
+
+bool FlicClient::changeModeParameters(uint32_t conn_id, uint8_t latencyMode,
+                                      int16_t autoDisconnectTime) {
+    ChannelTable::Channel* channel = connections.find(conn_id);
+    if (!channel) return false;
+    setChannelMode(*channel, latencyMode, autoDisconnectTime);
+    sessionChangeCount++;
+    return true;
+}
+
+bool FlicClient::disconnectButton(uint32_t conn_id) {
+    ChannelTable::Channel* channel = connections.find(conn_id);
+    if (!connected || (channel && (channel->flags & ChannelTable::Queued))) {
+        // Nothing to remove on the server; just don't create or replay it
+        if (!channel) return false;
+        forgetChannel(*channel);
+        sessionChangeCount++;
+        return connections.erase(conn_id);
+    }
+    CmdRemoveConnectionChannel cmd;
+    cmd.opcode = CMD_REMOVE_CONNECTION_CHANNEL_OPCODE;
+    cmd.conn_id = conn_id;
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+bool FlicClient::disconnectButton(const BdAddr& addr) {
+    const ChannelTable::Channel* channel = connections.findByAddr(addr.data());
+    return channel && disconnectButton(channel->connId);
+}
+
+bool FlicClient::forceDisconnect(const BdAddr& addr) {
+    CmdForceDisconnect cmd;
+    cmd.opcode = CMD_FORCE_DISCONNECT_OPCODE;
+    std::memcpy(cmd.bd_addr, addr.data(), 6);
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+bool FlicClient::getButtonInfo(const BdAddr& addr) {
+    if (!connected) return false;
+    if (!buttonInfoCache.beginFetch(addr.data())) return true;
+    CmdGetButtonInfo cmd;
+    cmd.opcode = CMD_GET_BUTTON_INFO_OPCODE;
+    std::memcpy(cmd.bd_addr, addr.data(), 6);
+    if (writePacket(&cmd, sizeof(cmd))) return true;
+    buttonInfoCache.endFetch(addr.data());
+    return false;
+}
+
+bool FlicClient::requestButtonInfo(const BdAddr& addr) {
+    return buttonInfoCache.find(addr.data()) || getButtonInfo(addr);
+}
+
+bool FlicClient::deleteButton(const BdAddr& addr) {
+    CmdDeleteButton cmd;
+    cmd.opcode = CMD_DELETE_BUTTON_OPCODE;
+    std::memcpy(cmd.bd_addr, addr.data(), 6);
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+// Queues a command; flushed immediately unless a batch is open
+bool FlicClient::writePacket(const void* data, size_t len) {
+    if (!connected) {
+        return false;
+    }
+    if (!writer.send(data, len)) {
+        failConnection("Failed to write packet");
+        return false;
+    }
+    syncWriteInterest();
+    return true;
+}
+
+// Write errors can happen inside a handler; the session is torn down on
+// the next loop iteration rather than under the caller's feet
+void FlicClient::failConnection(const char* what) {
+    observer->onError(what, errno);
+    connected = false;
+    if (teardownTimer) return;
+    teardownTimer = loop->addTimer(0, [this]() {
+        teardownTimer = 0;
+        if (sockfd >= 0 && !connected) handleDisconnect();
+    });
+}
+
+// Drains the socket with a single recv() and dispatches every complete
+// frame. Partial frames are kept by the decoder until the next wakeup.
+bool FlicClient::readPackets() {
+    ssize_t n = decoder.fill(sockfd);
+    if (n == 0) {
+        return false;
+    }
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return true;
+        }
+        observer->onError("recv", errno);
+        return false;
+    }
+
+    // One timestamp per wakeup; dispatch latency is measured from here
+    uint64_t recvNs = EventLoop::nowNs();
+
+    const uint8_t* frame;
+    size_t len;
+    while (decoder.next(frame, len)) {
+        if (eventJournal) journalFrame(frame, len, recvNs);
+        dispatchFrame(frame, len, recvNs);
+    }
+    flushDeferred();
+    return true;
+}
+
+// Threaded mode: runs the handlers for everything the reader queued
+void FlicClient::dispatchQueued() {
+    reader->clearNotify();
+
+    FrameQueue& frames = reader->frames();
+    const uint8_t* frame;
+    size_t len;
+    uint64_t recvNs;
+    while (frames.front(frame, len, recvNs)) {
+        if (eventJournal) journalFrame(frame, len, recvNs);
+        dispatchFrame(frame, len, recvNs);
+        frames.pop();
+    }
+    flushDeferred();
+
+    if (reader->isFinished() && frames.empty()) {
+        connected = false;
+        handleDisconnect();
+        return;
+    }
+    finishDispatch();
+}
+
+void FlicClient::dispatchFrame(const uint8_t* frame, size_t len, uint64_t recvNs) {
+    if (freshness && len > 0 && EventStats::isButtonEvent(frame[0])) {
+        if (const EvtButtonUpOrDown* evt = packetAs<EvtButtonUpOrDown>(frame, len)) {
+            deferButtonEvent(*evt, recvNs);
+            return;
+        }
+    }
+    // Anything else goes after the button events that came before it
+    flushDeferred();
+    deliverFrame(frame, len, recvNs);
+}
+
+void FlicClient::deferButtonEvent(const EvtButtonUpOrDown& evt, uint64_t recvNs) {
+    static const FreshnessPolicy::Profile noDeadline;
+    const FreshnessPolicy::Profile* profile = &noDeadline;
+    if (const ChannelTable::Channel* channel = connections.find(evt.conn_id)) {
+        uint8_t addr[6];
+        channel->address(addr);
+        profile = &freshness->profile(freshness->profileFor(addr));
+    }
+    uint64_t deadlineNs = FreshnessPolicy::deadlineNs(*profile, recvNs, evt.time_diff);
+
+    DeferredEvent d;
+    d.deadlineNs = deadlineNs;
+    d.orderNs = deadlineNs;
+    d.recvNs = recvNs;
+    d.seq = static_cast<uint32_t>(deferred.size());
+    d.collapsed = 0;
+    d.stale = profile->stale;
+    d.replaced = false;
+    d.missed = false;
+    d.evt = evt;
+
+    // A stale event to collapse replaces the held one of its kind. It takes
+    // a new slot, so it still comes after the button's events in between.
+    if (profile->stale == FreshnessPolicy::Collapse && EventLoop::nowNs() > deadlineNs) {
+        uint64_t key = static_cast<uint64_t>(evt.conn_id) << 16 | evt.opcode << 8 | evt.click_type;
+        std::pair<std::unordered_map<uint64_t, size_t>::iterator, bool> slot =
+            deferredIndex.insert(std::make_pair(key, deferred.size()));
+        if (!slot.second) {
+            DeferredEvent& held = deferred[slot.first->second];
+            stats.record(held.evt.conn_id, held.evt.opcode, held.evt.time_diff,
+                         EventLoop::nowNs() - held.recvNs);
+            held.replaced = true;
+            d.collapsed = held.collapsed + 1;
+            slot.first->second = deferred.size();
+            freshnessCounters.collapsed++;
+        }
+    }
+    deferred.push_back(d);
+}
+
+// Delivers the held button events earliest deadline first. Events past
+// their deadline go last, or not at all.
+void FlicClient::flushDeferred() {
+    if (deferred.empty()) return;
+    uint64_t nowNs = EventLoop::nowNs();
+    deferred.erase(std::remove_if(deferred.begin(), deferred.end(),
+                                  [](const DeferredEvent& d) { return d.replaced; }),
+                   deferred.end());
+
+    // Each event sorts no earlier than its button's previous one
+    deferredIndex.clear();
+    for (size_t i = 0; i < deferred.size(); i++) {
+        DeferredEvent& d = deferred[i];
+        d.missed = nowNs > d.deadlineNs;
+        std::pair<std::unordered_map<uint64_t, size_t>::iterator, bool> prev =
+            deferredIndex.insert(std::make_pair(d.evt.conn_id, i));
+        if (prev.second) continue;
+        const DeferredEvent& p = deferred[prev.first->second];
+        d.missed = d.missed || p.missed;
+        d.orderNs = std::max(d.orderNs, p.orderNs);
+        prev.first->second = i;
+    }
+    deferredIndex.clear();
+
+    if (deferred.size() > 1) {
+        freshnessCounters.backlogs++;
+        std::sort(deferred.begin(), deferred.end(), [](const DeferredEvent& a, const DeferredEvent& b) {
+            if (a.missed != b.missed) return b.missed;
+            if (a.orderNs != b.orderNs) return a.orderNs < b.orderNs;
+            return a.seq < b.seq;
+        });
+        uint32_t earliest = UINT32_MAX;
+        for (size_t i = deferred.size(); i-- > 0;) {
+            if (deferred[i].seq > earliest) freshnessCounters.reordered++;
+            earliest = std::min(earliest, deferred[i].seq);
+        }
+    }
+
+    for (size_t i = 0; i < deferred.size(); i++) {
+        const DeferredEvent& d = deferred[i];
+        const uint8_t* frame = reinterpret_cast<const uint8_t*>(&d.evt);
+        if (nowNs > d.deadlineNs) {
+            freshnessCounters.stale++;
+            freshnessCounters.lateMs.record((nowNs - d.deadlineNs) / 1000000);
+            if (d.stale == FreshnessPolicy::Drop) {
+                freshnessCounters.dropped++;
+                stats.record(d.evt.conn_id, d.evt.opcode, d.evt.time_diff, nowNs - d.recvNs);
+                continue;
+            }
+            freshnessCounters.flagged++;
+            observer->onStaleEvent(d.evt, d.evt.time_diff + (nowNs - d.recvNs) / 1000000, d.collapsed);
+        }
+        deliverFrame(frame, sizeof(d.evt), d.recvNs);
+    }
+    deferred.clear();
+}
+
+void FlicClient::deliverFrame(const uint8_t* frame, size_t len, uint64_t recvNs) {
+    observer->onPacket(frame, len);
+    handlePacket(frame, len);
+
+    // All button events share the EvtButtonUpOrDown layout
+    const EvtButtonUpOrDown* evt = packetAs<EvtButtonUpOrDown>(frame, len);
+    if (evt && EventStats::isButtonEvent(frame[0])) {
+        stats.record(evt->conn_id, frame[0], evt->time_diff, EventLoop::nowNs() - recvNs);
+        if (ChannelTable::Channel* channel = connections.find(evt->conn_id)) {
+            channel->events++;
+            channel->lastEventNs = recvNs;
+            if (recognizer) recognizeClick(*channel, frame[0], *evt, recvNs);
+            if (latencyPolicyEnabled && frame[0] == EVT_BUTTON_UP_OR_DOWN_OPCODE &&
+                evt->click_type == ClickTypeButtonDown) {
+                int mode = latencyPolicy.onPress(*channel, recvNs);
+                if (mode != LatencyPolicy::kKeepMode) {
+                    setChannelMode(*channel, static_cast<uint8_t>(mode),
+                                   latencyPolicy.profile(channel->profile).autoDisconnectTime);
+                }
+            }
+        }
+    }
+}
+
+void FlicClient::journalFrame(const uint8_t* frame, size_t len, uint64_t recvNs) {
+    if (eventJournal->append(frame, len, recvNs)) return;
+    observer->onError("Journal write failed, journaling stopped", errno);
+    eventJournal.reset();
+}
+
+bool FlicClient::openJournal(const std::string& dir, uint16_t sourceId,
+                             const EventJournal::Options& options, std::string* error) {
+    std::unique_ptr<EventJournal> journal(new EventJournal());
+    if (!journal->open(dir, source, sourceId, options, error)) return false;
+    eventJournal = std::move(journal);
+    return true;
+}
+
+void FlicClient::closeJournal() {
+    eventJournal.reset();
+}
+
+void FlicClient::injectFrame(const uint8_t* frame, size_t len) {
+    dispatchFrame(frame, len, EventLoop::nowNs());
+}
+
+void FlicClient::injectDone() {
+    flushDeferred();
+    finishDispatch();
+}
+
+void FlicClient::handlePacket(const uint8_t* data, size_t len) {
+    if (len < 1) return;
+
+    switch (data[0]) {
+        case EVT_ADVERTISEMENT_PACKET_OPCODE:
+            if (const EvtAdvertisementPacket* evt = packetAs<EvtAdvertisementPacket>(data, len)) {
+                handleAdvertisement(*evt);
+                return;
+            }
+            break;
+
+        case EVT_CREATE_CONNECTION_CHANNEL_RESPONSE_OPCODE:
+            if (const EvtCreateConnectionChannelResponse* evt =
+                    packetAs<EvtCreateConnectionChannelResponse>(data, len)) {
+                observer->onCreateConnectionChannelResponse(*evt);
+                if (evt->error != NoError) {
+                    onCreateChannelFailed(*evt);
+                } else if (ChannelTable::Channel* channel = connections.find(evt->conn_id)) {
+                    // The button may already be connected through another client
+                    channel->status = evt->connection_status;
+                    setPending(*channel, evt->connection_status == Disconnected);
+                    if (evt->connection_status == Ready) onChannelReady(*channel);
+                }
+                return;
+            }
+            break;
+
+        case EVT_CONNECTION_STATUS_CHANGED_OPCODE:
+            if (const EvtConnectionStatusChanged* evt =
+                    packetAs<EvtConnectionStatusChanged>(data, len)) {
+                observer->onConnectionStatusChanged(*evt);
+                if (ChannelTable::Channel* channel = connections.find(evt->conn_id)) {
+                    if (evt->connection_status == Disconnected && channel->status != Disconnected) {
+                        channel->disconnects++;
+                    }
+                    channel->status = evt->connection_status;
+                    // flicd keeps a disconnected channel pending until it reconnects
+                    setPending(*channel, evt->connection_status == Disconnected);
+                    if (evt->connection_status == Ready) onChannelReady(*channel);
+                }
+                if (evt->connection_status == Ready) {
+                    replaySettled(evt->conn_id, true);
+                }
+                return;
+            }
+            break;
+
+        case EVT_CONNECTION_CHANNEL_REMOVED_OPCODE:
+            if (const EvtConnectionChannelRemoved* evt =
+                    packetAs<EvtConnectionChannelRemoved>(data, len)) {
+                observer->onConnectionChannelRemoved(*evt);
+                replaySettled(evt->conn_id, false);
+                if (ChannelTable::Channel* channel = connections.find(evt->conn_id)) {
+                    forgetChannel(*channel);
+                    connections.erase(evt->conn_id);
+                    sessionChangeCount++;
+                }
+                return;
+            }
+            break;
+
+        case EVT_BUTTON_UP_OR_DOWN_OPCODE:
+            if (const EvtButtonUpOrDown* evt = packetAs<EvtButtonUpOrDown>(data, len)) {
+                observer->onButtonUpOrDown(*evt);
+                return;
+            }
+            break;
+
+        case EVT_BUTTON_CLICK_OR_HOLD_OPCODE:
+            if (const EvtButtonClickOrHold* evt = packetAs<EvtButtonClickOrHold>(data, len)) {
+                observer->onButtonClickOrHold(*evt);
+                return;
+            }
+            break;
+
+        case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OPCODE:
+            if (const EvtButtonSingleOrDoubleClick* evt =
+                    packetAs<EvtButtonSingleOrDoubleClick>(data, len)) {
+                observer->onButtonSingleOrDoubleClick(*evt);
+                return;
+            }
+            break;
+
+        case EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE:
+            if (const EvtButtonSingleOrDoubleClickOrHold* evt =
+                    packetAs<EvtButtonSingleOrDoubleClickOrHold>(data, len)) {
+                observer->onButtonSingleOrDoubleClickOrHold(*evt);
+                return;
+            }
+            break;
+
+        case EVT_NEW_VERIFIED_BUTTON_OPCODE:
+            if (const EvtNewVerifiedButton* evt = packetAs<EvtNewVerifiedButton>(data, len)) {
+                observer->onNewVerifiedButton(*evt);
+                return;
+            }
+            break;
+
+        case EVT_GET_INFO_RESPONSE_OPCODE:
+            if (const EvtGetInfoResponse* evt = packetAs<EvtGetInfoResponse>(data, len)) {
+                VerifiedButtonList buttons;
+                if (buttons.parse(data + sizeof(*evt), len - sizeof(*evt))) {
+                    observer->onGetInfoResponse(*evt, buttons);
+                    onGetInfoResponse(*evt);
+                    return;
+                }
+            }
+            break;
+
+        case EVT_NO_SPACE_FOR_NEW_CONNECTION_OPCODE:
+            if (const EvtNoSpaceForNewConnection* evt =
+                    packetAs<EvtNoSpaceForNewConnection>(data, len)) {
+                observer->onNoSpaceForNewConnection(*evt);
+                setNoSpace(true);
+                return;
+            }
+            break;
+
+        case EVT_GOT_SPACE_FOR_NEW_CONNECTION_OPCODE:
+            if (const EvtGotSpaceForNewConnection* evt =
+                    packetAs<EvtGotSpaceForNewConnection>(data, len)) {
+                observer->onGotSpaceForNewConnection(*evt);
+                setNoSpace(false);
+                return;
+            }
+            break;
+
+        case EVT_BLUETOOTH_CONTROLLER_STATE_CHANGE_OPCODE:
+            if (const EvtBluetoothControllerStateChange* evt =
+                    packetAs<EvtBluetoothControllerStateChange>(data, len)) {
+                observer->onBluetoothControllerStateChange(*evt);
+                return;
+            }
+            break;
+
+        case EVT_PING_RESPONSE_OPCODE:
+            if (const EvtPingResponse* evt = packetAs<EvtPingResponse>(data, len)) {
+                if (!consumePingResponse(evt->ping_id)) observer->onPingResponse(*evt);
+                return;
+            }
+            break;
+
+        case EVT_GET_BUTTON_INFO_RESPONSE_OPCODE:
+            if (const EvtGetButtonInfoResponse* evt =
+                    packetAs<EvtGetButtonInfoResponse>(data, len)) {
+                ButtonInfoView info;
+                if (info.parse(data + sizeof(*evt), len - sizeof(*evt))) {
+                    observer->onGetButtonInfoResponse(*evt, info);
+                    handleButtonInfo(*evt, info);
+                    return;
+                }
+            }
+            break;
+
+        case EVT_SCAN_WIZARD_FOUND_PRIVATE_BUTTON_OPCODE:
+            if (const EvtScanWizardFoundPrivateButton* evt =
+                    packetAs<EvtScanWizardFoundPrivateButton>(data, len)) {
+                observer->onScanWizardFoundPrivateButton(*evt);
+                return;
+            }
+            break;
+
+        case EVT_SCAN_WIZARD_FOUND_PUBLIC_BUTTON_OPCODE:
+            if (const EvtScanWizardFoundPublicButton* evt =
+                    packetAs<EvtScanWizardFoundPublicButton>(data, len)) {
+                observer->onScanWizardFoundPublicButton(*evt);
+                return;
+            }
+            break;
+
+        case EVT_SCAN_WIZARD_BUTTON_CONNECTED_OPCODE:
+            if (const EvtScanWizardButtonConnected* evt =
+                    packetAs<EvtScanWizardButtonConnected>(data, len)) {
+                observer->onScanWizardButtonConnected(*evt);
+                return;
+            }
+            break;
+
+        case EVT_SCAN_WIZARD_COMPLETED_OPCODE:
+            if (const EvtScanWizardCompleted* evt = packetAs<EvtScanWizardCompleted>(data, len)) {
+                observer->onScanWizardCompleted(*evt);
+                return;
+            }
+            break;
+
+        case EVT_BUTTON_DELETED_OPCODE:
+            if (const EvtButtonDeleted* evt = packetAs<EvtButtonDeleted>(data, len)) {
+                observer->onButtonDeleted(*evt);
+                buttonInfoCache.erase(evt->bd_addr);
+                return;
+            }
+            break;
+
+        case EVT_BATTERY_STATUS_OPCODE:
+            if (const EvtBatteryStatus* evt = packetAs<EvtBatteryStatus>(data, len)) {
+                observer->onBatteryStatus(*evt);
+                handleBatteryStatus(*evt);
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+    observer->onUnknownPacket(data, len);
+}
+
+void FlicClient::handleAdvertisement(const EvtAdvertisementPacket& evt) {
+    if (advMode == AdvertisementRaw) {
+        observer->onAdvertisementPacket(evt);
+        return;
+    }
+
+    const AdvertisementTable::Entry* entry;
+    unsigned changes = advTable.update(evt, EventLoop::nowMs(), entry);
+    if (changes != 0 && advMode == AdvertisementChanges) {
+        observer->onAdvertisementChanged(*entry, changes);
+    }
+    if (!advTimer) {
+        advTimer = loop->addPeriodicTimer(advIntervalMs, [this]() { onAdvertisementTimer(); });
+    }
+}
+
+// Expires lost buttons and delivers the digest; the timer stops once the
+// table is empty and is re-armed by the next advertisement
+void FlicClient::onAdvertisementTimer() {
+    FlicClientObserver* obs = observer;
+    advTable.expire(EventLoop::nowMs(), [obs](const AdvertisementTable::Entry& entry) {
+        obs->onAdvertisementChanged(entry, AdvertisementTable::Lost);
+    });
+
+    if (advMode == AdvertisementDigest) {
+        bool active = false;
+        advTable.forEach([&active](const AdvertisementTable::Entry& entry) {
+            if (entry.windowPackets > 0) active = true;
+        });
+        if (active) observer->onAdvertisementDigest(advTable);
+        advTable.resetWindow();
+    }
+
+    if (advTable.empty()) {
+        loop->cancelTimer(advTimer);
+        advTimer = 0;
+    }
+    observer->onDispatchDone();
+}
+
+void FlicClient::onSocketEvent(uint32_t events) {
+    // Resume queued commands once the socket drains
+    if (events & EPOLLOUT) {
+        if (!writer.flush()) {
+            failConnection("Failed to write packet");
+        }
+    }
+
+    // Handle server messages
+    if (events & EPOLLIN) {
+        if (!readPackets()) {
+            connected = false;
+        }
+    } else if ((events & (EPOLLHUP | EPOLLERR)) && !reader) {
+        // In threaded mode the reader thread reports the disconnect
+        connected = false;
+    }
+
+    if (!connected) {
+        handleDisconnect();
+        return;
+    }
+    finishDispatch();
+}
+
+// Channel admissions freed up by this wakeup's events go out in one write
+void FlicClient::finishDispatch() {
+    if (admissionWanted) admitChannels();
+    syncWriteInterest();
+    observer->onDispatchDone();
+}
+
+void FlicClient::handleDisconnect() {
+    connections.forEach([](ChannelTable::Channel& channel) {
+        if (channel.status != Disconnected) channel.disconnects++;
+        channel.status = Disconnected;
+        channel.flags &= ~(ChannelTable::Pending | ChannelTable::BatteryListener);
+    });
+    pendingCount = 0;
+    serverInfoKnown = false;
+    infoRequested = false;
+    pendingLimit = 0;
+    pendingCap = SIZE_MAX;
+    outstandingPings.clear();
+    buttonInfoCache.clearPending();
+    if (recognizer) recognizer->releaseAll();
+    disconnect();
+
+    observer->onDisconnected(autoReconnect);
+    if (autoReconnect) {
+        outageStartNs = EventLoop::nowNs();
+        backoff.reset();
+        scheduleReconnect();
+    }
+    observer->onDispatchDone();
+}
+
+// Asks for EPOLLOUT only while the writer holds unsent bytes
+void FlicClient::syncWriteInterest() {
+    bool want = writer.pending();
+    if (want == wantWrite || sockfd < 0) return;
+    wantWrite = want;
+    if (!reader) {
+        loop->modifyFd(sockfd, want ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+    } else if (want) {
+        // The reader thread owns EPOLLIN; the loop only waits for POLLOUT
+        loop->addFd(sockfd, EPOLLOUT, [this](uint32_t events) { onSocketEvent(events); });
+    } else {
+        loop->removeFd(sockfd);
+    }
+}
+
+void FlicClient::scheduleReconnect() {
+    uint64_t delay = backoff.nextDelayMs();
+    observer->onReconnectScheduled(delay, backoff.attempts());
+    reconnectTimer = loop->addTimer(delay, [this]() {
+        attemptReconnect();
+        observer->onDispatchDone();
+    });
+}
+
+// Starts a non-blocking connect; the loop reports completion as EPOLLOUT
+void FlicClient::attemptReconnect() {
+    reconnectTimer = 0;
+    struct sockaddr_in addr;
+    if (!resolve(addr)) {
+        scheduleReconnect();
+        return;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        observer->onError("socket", errno);
+        scheduleReconnect();
+        return;
+    }
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 &&
+        errno != EINPROGRESS) {
+        close(fd);
+        scheduleReconnect();
+        return;
+    }
+
+    pendingFd = fd;
+    loop->addFd(fd, EPOLLOUT, [this](uint32_t) {
+        onReconnectComplete();
+        observer->onDispatchDone();
+    });
+    reconnectTimer = loop->addTimer(kConnectTimeoutMs, [this]() {
+        reconnectTimer = 0;
+        abandonPendingConnect();
+        scheduleReconnect();
+        observer->onDispatchDone();
+    });
+}
+
+void FlicClient::abandonPendingConnect() {
+    if (pendingFd < 0) return;
+    loop->removeFd(pendingFd);
+    close(pendingFd);
+    pendingFd = -1;
+}
+
+void FlicClient::onReconnectComplete() {
+    if (reconnectTimer) {
+        loop->cancelTimer(reconnectTimer);
+        reconnectTimer = 0;
+    }
+    int err = 0;
+    socklen_t errLen = sizeof(err);
+    if (getsockopt(pendingFd, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0 || err != 0) {
+        abandonPendingConnect();
+        scheduleReconnect();
+        return;
+    }
+
+    loop->removeFd(pendingFd);
+    sockfd = pendingFd;
+    pendingFd = -1;
+    attachSocket();
+    if (!start()) {
+        handleDisconnect();
+        return;
+    }
+
+    uint64_t elapsedMs = (EventLoop::nowNs() - outageStartNs) / 1000000ull;
+    reconnectMs.record(elapsedMs);
+    observer->onConnected();
+    observer->onReconnected(backoff.attempts(), elapsedMs, connections.size() - queuedCount,
+                            scanners.size());
+    backoff.reset();
+    replaySession();
+}
+
+// Re-creates the previous session's scanners in one write with GetInfo.
+// Its channels go to the front of the admission queue and are sent, as
+// many as the new session's pending limit allows, once GetInfo is answered.
+void FlicClient::replaySession() {
+    awaitingReady = connections.size() - queuedCount;
+    replayedChannels = awaitingReady;
+    replayFailed = 0;
+
+    beginBatch();
+    getInfo();
+    for (ScannerSet::const_iterator it = scanners.begin(); it != scanners.end(); ++it) {
+        sendCreateScanner(*it);
+    }
+    commit();
+
+    connections.forEach([this](ChannelTable::Channel& channel) {
+        if (channel.flags & ChannelTable::Queued) return;
+        channel.flags |= ChannelTable::AwaitingReady;
+        enqueueChannel(channel, true);
+    });
+    // Nothing to wait for: no channels, or only ones still queued from
+    // before the outage
+    if (awaitingReady == 0) completeRecovery();
+}
+
+// Tracks replayed channels until each one is Ready or failed; recovery is
+// complete when the last one settles
+void FlicClient::replaySettled(uint32_t conn_id, bool ready) {
+    ChannelTable::Channel* channel = connections.find(conn_id);
+    if (!channel || !(channel->flags & ChannelTable::AwaitingReady)) return;
+    channel->flags &= ~ChannelTable::AwaitingReady;
+    awaitingReady--;
+    if (!ready) replayFailed++;
+    if (awaitingReady == 0) completeRecovery();
+}
+
+void FlicClient::completeRecovery() {
+    uint64_t elapsedMs = (EventLoop::nowNs() - outageStartNs) / 1000000ull;
+    channelsReadyMs.record(elapsedMs);
+    observer->onRecoveryComplete(replayedChannels - replayFailed, replayedChannels, elapsedMs);
+}
+
+void FlicClient::enqueueChannel(ChannelTable::Channel& channel, bool front) {
+    if (!(channel.flags & ChannelTable::Queued)) {
+        channel.flags |= ChannelTable::Queued;
+        queuedCount++;
+    }
+    if (front) {
+        admissionQueue.push_front(channel.connId);
+    } else {
+        admissionQueue.push_back(channel.connId);
+    }
+}
+
+// Sends queued channel creations while the pending limit allows, in one
+// write. Until the first GetInfo response of a session nothing is admitted.
+void FlicClient::admitChannels() {
+    admissionWanted = false;
+    if (!connected || !serverInfoKnown) return;
+
+    beginBatch();
+    size_t limit = pendingLimit < pendingCap ? pendingLimit : pendingCap;
+    while (!admissionQueue.empty() && !noSpace && pendingCount < limit) {
+        uint32_t conn_id = admissionQueue.front();
+        admissionQueue.pop_front();
+        ChannelTable::Channel* channel = connections.find(conn_id);
+        if (!channel || !(channel->flags & ChannelTable::Queued)) continue;
+        channel->flags &= ~ChannelTable::Queued;
+        queuedCount--;
+        setPending(*channel, true);
+        sendCreateConnectionChannel(*channel);
+        if (batteryMonitoring) sendBatteryListener(*channel, true);
+    }
+    commit();
+
+    // Nothing of ours in flight will free a slot: other clients hold them,
+    // so poll the server until its count goes down
+    if (queuedCount > 0 && pendingCount == 0 && !noSpace && !admissionTimer) {
+        admissionTimer = loop->addTimer(kAdmissionPollMs, [this]() {
+            admissionTimer = 0;
+            if (!infoRequested) getInfo();
+        });
+    }
+}
+
+void FlicClient::setPending(ChannelTable::Channel& channel, bool pending) {
+    bool was = (channel.flags & ChannelTable::Pending) != 0;
+    if (pending == was) return;
+    if (pending) {
+        channel.flags |= ChannelTable::Pending;
+        pendingCount++;
+    } else {
+        channel.flags &= ~ChannelTable::Pending;
+        pendingCount--;
+        if (pendingCount == 0) pendingCap = SIZE_MAX;
+        admissionWanted = queuedCount > 0;
+    }
+}
+
+void FlicClient::setNoSpace(bool full) {
+    if (full == noSpace) return;
+    noSpace = full;
+    uint64_t now = EventLoop::nowNs();
+    if (full) {
+        noSpaceSinceNs = now;
+    } else {
+        if (provision.active) provision.parkedNs += now - noSpaceSinceNs;
+        admissionWanted = queuedCount > 0;
+    }
+}
+
+void FlicClient::onGetInfoResponse(const EvtGetInfoResponse& evt) {
+    infoRequested = false;
+    serverInfoKnown = true;
+    // The server's count includes ours that it had processed; treat the
+    // rest as held by other clients
+    size_t serverPending = evt.current_pending_connection_count;
+    size_t others = serverPending > pendingCount ? serverPending - pendingCount : 0;
+    size_t max = evt.max_pending_connections;
+    pendingLimit = max > others ? max - others : 0;
+    if (pendingCount == 0) pendingCap = SIZE_MAX;
+    setNoSpace(evt.currently_no_space_for_new_connection != 0);
+    admissionWanted = queuedCount > 0;
+}
+
+void FlicClient::onCreateChannelFailed(const EvtCreateConnectionChannelResponse& evt) {
+    ChannelTable::Channel* channel = connections.find(evt.conn_id);
+    if (!channel) return;
+    setPending(*channel, false);
+    if (evt.error != MaxPendingConnectionsReached) {
+        replaySettled(evt.conn_id, false);
+        provisionSettled(*channel, false);
+        return;
+    }
+    // The server is fuller than it reported: retry this one first, and keep
+    // at most what is in flight now until all of ours have left the pending
+    // state, so a stale or inconsistent GetInfo cannot cause a retry storm
+    pendingCap = pendingCount;
+    provision.rejections += (channel->flags & ChannelTable::Provisioning) ? 1 : 0;
+    enqueueChannel(*channel, true);
+    admissionWanted = false;
+}
+
+// Adds a queued channel to the current provisioning run, starting one if
+// none is active
+ChannelTable::Channel& FlicClient::provisionChannel(const uint8_t* address, uint32_t conn_id) {
+    if (!provision.active) {
+        std::memset(&provision, 0, sizeof(provision));
+        provision.active = true;
+        provision.startNs = EventLoop::nowNs();
+        if (noSpace) noSpaceSinceNs = provision.startNs;
+    }
+    if (ChannelTable::Channel* old = connections.find(conn_id)) {
+        forgetChannel(*old);
+    }
+    ChannelTable::Channel& channel = connections.insert(conn_id, address);
+    channel.status = Disconnected;
+    initChannelMode(channel);
+    channel.flags |= ChannelTable::Provisioning;
+    provision.total++;
+    enqueueChannel(channel, false);
+    sessionChangeCount++;
+    return channel;
+}
+
+void FlicClient::provisionSettled(ChannelTable::Channel& channel, bool ready) {
+    if (!(channel.flags & ChannelTable::Provisioning)) return;
+    channel.flags &= ~ChannelTable::Provisioning;
+    if (ready) {
+        provision.ready++;
+    } else {
+        provision.failed++;
+    }
+    if (provision.ready + provision.failed < provision.total) return;
+
+    uint64_t now = EventLoop::nowNs();
+    if (noSpace) provision.parkedNs += now - noSpaceSinceNs;
+    provision.active = false;
+    provision.elapsedMs = (now - provision.startNs) / 1000000ull;
+    observer->onProvisioningComplete(provision.ready, provision.total, provision.elapsedMs);
+}
+
+// Declares the server dead if the oldest ping is overdue, otherwise sends
+// the next one. Any answer proves the whole path (socket, flicd's event
+// loop and our reader) is alive, which TCP keepalive alone would not.
+void FlicClient::onKeepaliveTimer() {
+    if (!connected) {
+        outstandingPings.clear();
+        return;
+    }
+    uint64_t now = EventLoop::nowNs();
+    if (!outstandingPings.empty() &&
+        now - outstandingPings.front().sentNs >= keepaliveTimeoutMs * 1000000ull) {
+        keepaliveTimeoutCount++;
+        observer->onError("Server stopped answering pings", ETIMEDOUT);
+        connected = false;
+        handleDisconnect();
+        return;
+    }
+    if (outstandingPings.size() >= kMaxOutstandingPings) return;
+
+    CmdPing cmd;
+    cmd.opcode = CMD_PING_OPCODE;
+    cmd.ping_id = nextPingId++;
+    if (nextPingId == 0) nextPingId = 0x80000000u;
+    if (!writePacket(&cmd, sizeof(cmd))) return;
+    OutstandingPing ping = { cmd.ping_id, now };
+    outstandingPings.push_back(ping);
+    observer->onDispatchDone();
+}
+
+// Records the round trip of a keepalive ping. Returns false for pings the
+// application sent itself, which are passed on to the observer.
+bool FlicClient::consumePingResponse(uint32_t pingId) {
+    for (std::deque<OutstandingPing>::iterator it = outstandingPings.begin();
+         it != outstandingPings.end(); ++it) {
+        if (it->pingId != pingId) continue;
+        pingRttUs.record((EventLoop::nowNs() - it->sentNs) / 1000);
+        // Anything sent earlier was answered before this one or never will be
+        outstandingPings.erase(outstandingPings.begin(), it + 1);
+        return true;
+    }
+    return false;
+}
+
+// Feeds the recognizer after the observer has seen the event, so a guess is
+// reported right behind the ButtonUpOrDown it came from
+void FlicClient::recognizeClick(const ChannelTable::Channel& channel, uint8_t opcode,
+                                const EvtButtonUpOrDown& evt, uint64_t recvNs) {
+    uint32_t conn_id = channel.connId;
+    if (opcode == EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE) {
+        const ClickRecognizer::Speculation* s = recognizer->onClassified(conn_id, evt.click_type, recvNs);
+        if (!s) return;
+        cancelRecognizerTimer(recognizer->confirmTimer(conn_id));
+        observer->onSpeculationResolved(*s);
+        return;
+    }
+    if (opcode != EVT_BUTTON_UP_OR_DOWN_OPCODE || evt.was_queued) return;
+
+    if (evt.click_type == ClickTypeButtonDown) {
+        uint8_t addr[6];
+        channel.address(addr);
+        uint32_t holdMs = recognizer->onDown(conn_id, addr, recvNs);
+        if (holdMs == 0) return;
+        EventLoop::TimerId* timer = recognizer->holdTimer(conn_id);
+        cancelRecognizerTimer(timer);
+        *timer = loop->addTimer(holdMs, [this, conn_id]() { onHoldTimer(conn_id); });
+    } else if (evt.click_type == ClickTypeButtonUp) {
+        const ClickRecognizer::Speculation* s = recognizer->onUp(conn_id, recvNs);
+        cancelRecognizerTimer(recognizer->holdTimer(conn_id));
+        if (s) speculated(*s);
+    }
+}
+
+void FlicClient::cancelRecognizerTimer(EventLoop::TimerId* timer) {
+    if (!timer || !*timer) return;
+    loop->cancelTimer(*timer);
+    *timer = 0;
+}
+
+// Arms the confirm timer for a new guess and reports it
+void FlicClient::speculated(const ClickRecognizer::Speculation& s) {
+    uint32_t conn_id = s.connId;
+    EventLoop::TimerId* timer = recognizer->confirmTimer(conn_id);
+    cancelRecognizerTimer(timer);
+    *timer = loop->addTimer(recognizer->profileOf(conn_id).confirmMs,
+                            [this, conn_id]() { onConfirmTimer(conn_id); });
+    observer->onSpeculativeClick(s);
+}
+
+void FlicClient::onHoldTimer(uint32_t conn_id) {
+    *recognizer->holdTimer(conn_id) = 0;
+    if (const ClickRecognizer::Speculation* s = recognizer->onHoldTimer(conn_id, EventLoop::nowNs())) {
+        speculated(*s);
+        observer->onDispatchDone();
+    }
+}
+
+void FlicClient::onConfirmTimer(uint32_t conn_id) {
+    *recognizer->confirmTimer(conn_id) = 0;
+    if (const ClickRecognizer::Speculation* s = recognizer->onConfirmTimer(conn_id, EventLoop::nowNs())) {
+        observer->onSpeculationResolved(*s);
+        observer->onDispatchDone();
+    }
+}
+
+// Mode a new channel is created in: the idle mode of its policy profile,
+// or NormalLatency without a policy
+void FlicClient::initChannelMode(ChannelTable::Channel& channel) {
+    channel.modeChangedNs = EventLoop::nowNs();
+    if (!latencyPolicyEnabled) {
+        channel.latencyMode = NormalLatency;
+        channel.autoDisconnectTime = 0x1ff;
+        return;
+    }
+    uint8_t addr[6];
+    channel.address(addr);
+    channel.profile = latencyPolicy.profileFor(addr);
+    const LatencyPolicy::Profile& profile = latencyPolicy.profile(channel.profile);
+    channel.latencyMode = profile.idleMode;
+    channel.autoDisconnectTime = profile.autoDisconnectTime;
+}
+
+// Records the mode and tells the server unless the channel is still queued;
+// a queued or replayed channel is created with the recorded mode
+void FlicClient::setChannelMode(ChannelTable::Channel& channel, uint8_t latencyMode,
+                                int16_t autoDisconnectTime) {
+    channel.latencyMode = latencyMode;
+    channel.autoDisconnectTime = autoDisconnectTime;
+    channel.modeChangedNs = EventLoop::nowNs();
+    channel.burstPresses = 0;
+    if (!connected || (channel.flags & ChannelTable::Queued)) return;
+
+    CmdChangeModeParameters cmd;
+    cmd.opcode = CMD_CHANGE_MODE_PARAMETERS_OPCODE;
+    cmd.conn_id = channel.connId;
+    cmd.latency_mode = latencyMode;
+    cmd.auto_disconnect_time = autoDisconnectTime;
+    if (writePacket(&cmd, sizeof(cmd))) modeChangeCount++;
+}
+
+// Moves channels that have been quiet for their hold time back to the idle
+// mode, all in one write
+void FlicClient::onLatencyTimer() {
+    uint64_t now = EventLoop::nowNs();
+    beginBatch();
+    connections.forEach([this, now](ChannelTable::Channel& channel) {
+        int mode = latencyPolicy.onTick(channel, now);
+        if (mode != LatencyPolicy::kKeepMode) {
+            setChannelMode(channel, static_cast<uint8_t>(mode),
+                           latencyPolicy.profile(channel.profile).autoDisconnectTime);
+        }
+    });
+    commit();
+    observer->onDispatchDone();
+}
+
+// Drops the admission and recovery bookkeeping of a channel that is being
+// removed or replaced
+void FlicClient::forgetChannel(ChannelTable::Channel& channel) {
+    replaySettled(channel.connId, false);
+    if (channel.flags & ChannelTable::Queued) {
+        channel.flags &= ~ChannelTable::Queued;
+        queuedCount--;
+    }
+    setPending(channel, false);
+    provisionSettled(channel, false);
+    if (recognizer) {
+        recognizer->forget(channel.connId, [this](EventLoop::TimerId timer) { loop->cancelTimer(timer); });
+    }
+    if (channel.flags & ChannelTable::BatteryListener) sendBatteryListener(channel, false);
+}
+
+void FlicClient::onChannelReady(ChannelTable::Channel& channel) {
+    provisionSettled(channel, true);
+    if (!buttonInfoFetch) return;
+    uint8_t addr[6];
+    channel.address(addr);
+    requestButtonInfo(BdAddr(addr));
+}
+
+void FlicClient::handleButtonInfo(const EvtGetButtonInfoResponse& evt, const ButtonInfoView& info) {
+    buttonInfoCache.store(evt.bd_addr, info, static_cast<uint32_t>(std::time(nullptr)));
+}
+
+void FlicClient::handleBatteryStatus(const EvtBatteryStatus& evt) {
+    ChannelTable::Channel* channel = connections.find(evt.listener_id);
+    if (!channel || !(channel->flags & ChannelTable::BatteryListener)) return;
+    uint8_t addr[6];
+    channel->address(addr);
+    const BatteryMonitor::Series* series;
+    int level = batteryMonitor.update(addr, evt.battery_percentage, evt.timestamp, series);
+    if (level >= 0) observer->onBatteryAlert(*series, static_cast<uint8_t>(level));
+}
+
+// Creates or removes the channel's battery listener. The flag follows what
+// the server knows: set once the create is queued, cleared on removal even
+// when not connected, since a new session starts without listeners.
+bool FlicClient::sendBatteryListener(ChannelTable::Channel& channel, bool create) {
+    if (create) {
+        CmdCreateBatteryStatusListener cmd;
+        cmd.opcode = CMD_CREATE_BATTERY_STATUS_LISTENER_OPCODE;
+        cmd.listener_id = channel.connId;
+        channel.address(cmd.bd_addr);
+        if (!writePacket(&cmd, sizeof(cmd))) return false;
+        channel.flags |= ChannelTable::BatteryListener;
+        return true;
+    }
+    channel.flags &= ~ChannelTable::BatteryListener;
+    CmdRemoveBatteryStatusListener cmd;
+    cmd.opcode = CMD_REMOVE_BATTERY_STATUS_LISTENER_OPCODE;
+    cmd.listener_id = channel.connId;
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+bool FlicClient::sendCreateScanner(uint32_t scan_id) {
+    CmdCreateScanner cmd;
+    cmd.opcode = CMD_CREATE_SCANNER_OPCODE;
+    cmd.scan_id = scan_id;
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+bool FlicClient::sendCreateConnectionChannel(const ChannelTable::Channel& channel) {
+    CmdCreateConnectionChannel cmd;
+    cmd.opcode = CMD_CREATE_CONNECTION_CHANNEL_OPCODE;
+    channel.address(cmd.bd_addr);
+    cmd.conn_id = channel.connId;
+    cmd.latency_mode = channel.latencyMode;
+    cmd.auto_disconnect_time = channel.autoDisconnectTime;
+    return writePacket(&cmd, sizeof(cmd));
+}
+
+bool FlicClient::resolve(struct sockaddr_in& serv_addr) {
+    struct hostent* server = gethostbyname(host.c_str());
+    if (server == nullptr) {
+        observer->onError("Failed to resolve host", 0);
+        return false;
+    }
+    std::memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    std::memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    serv_addr.sin_port = htons(port);
+    return true;
+}
+
+// Socket options and per-connection state for a freshly connected sockfd
+void FlicClient::attachSocket() {
+    // Commands are coalesced by the writer, so Nagle only adds latency
+    int flag = noDelay ? 1 : 0;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+    decoder.reset();
+    writer.attach(sockfd);
+    connected = true;
+}
@@ -0,0 +1,738 @@
+// flicd_sim - local stand-in for flicd used for load and latency testing.
+//
+// Speaks the client protocol from client_protocol_packets.h over TCP and
+// drives any number of virtual buttons:
+// - CmdGetInfo is answered with the virtual buttons as verified buttons
+// - CmdPing is answered immediately, queued behind any events already sent,
+//   so the client's ping RTT measures end-to-end latency under load
+// - CmdCreateConnectionChannel creates a channel that becomes Ready after a
+//   configurable delay and then emits clicks (EvtButtonUpOrDown down/up
+//   followed by EvtButtonSingleOrDoubleClickOrHold) at a fixed rate; with
+//   --double-click-ms the classification waits out a double click window
+//   like flicd, and --double-clicks makes a share of them double clicks
+// - CmdCreateScanner emits EvtAdvertisementPacket for the virtual buttons
+// - CmdChangeModeParameters updates the channel's latency mode; the stats
+//   line shows how many channels are in LowLatency
+// - CmdCreateBatteryStatusListener is answered with the button's battery
+//   level; levels drain slowly (a random 1% step per --battery-ms) and jump
+//   back to 100 when empty, and every change is sent to its listeners
+// - CmdGetButtonInfo is answered with a uuid, name ("Flic <index>"), color,
+//   serial number and firmware version made up from the button index
+// - With --max-connected, channels beyond the limit stay pending and the
+//   client gets EvtNoSpaceForNewConnection, then EvtGotSpaceForNewConnection
+//   once a connected channel is removed
+//
+// Events are generated on a 10 ms tick. A client that cannot keep up is not
+// buffered without bound: once its backlog exceeds a limit, the tick's events
+// are skipped and counted as stalls.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "client_protocol_packets.h"
+#include "frame_decoder.h"
+#include "command_writer.h"
+#include "event_loop.h"
+#include "packet_views.h"
+
+using namespace FlicClientProtocol;
+
+struct SimConfig {
+    int port;
+    uint32_t buttons;
+    double clickRate;       // clicks per second per ready channel
+    double advRate;         // advertisements per second per scanner
+    uint32_t ageMs;         // time_diff reported in button events
+    uint32_t connectDelayMs;
+    uint32_t maxPending;
+    uint32_t maxConnected;  // 0 = unlimited
+    uint32_t autoConnect;   // channels created implicitly for each client
+    uint32_t statsMs;
+    uint32_t batteryMs;     // battery drain step interval, 0 = constant levels
+    uint32_t doubleClickMs; // delay of EvtButtonSingleOrDoubleClickOrHold after the release
+    uint32_t doubleClickPct;
+
+    SimConfig()
+        : port(5551), buttons(1000), clickRate(1.0), advRate(100.0), ageMs(0),
+          connectDelayMs(20), maxPending(128), maxConnected(0), autoConnect(0), statsMs(1000),
+          batteryMs(60000), doubleClickMs(0), doubleClickPct(0) {}
+};
+
+class FlicdSim {
+public:
+    explicit FlicdSim(const SimConfig& config)
+        : config(config), listenfd(-1), nextSessionId(1), lastTickNs(0), rngState(0x12345678u) {
+        std::memset(&totals, 0, sizeof(totals));
+        std::memset(&interval, 0, sizeof(interval));
+        batteryLevels.resize(config.buttons);
+        batteryChanged.resize(config.buttons);
+        for (uint32_t i = 0; i < config.buttons; i++) {
+            batteryLevels[i] = static_cast<int8_t>(100 - (i * 37) % 90);
+        }
+    }
+
+    ~FlicdSim() {
+        if (listenfd >= 0) close(listenfd);
+    }
+
+    bool listen() {
+        listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (listenfd < 0) {
+            perror("socket");
+            return false;
+        }
+        int one = 1;
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(config.port);
+        if (bind(listenfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            ::listen(listenfd, 64) < 0) {
+            perror("bind/listen");
+            return false;
+        }
+        return loop.addFd(listenfd, EPOLLIN, [this](uint32_t) { onAccept(); });
+    }
+
+    void run() {
+        lastTickNs = EventLoop::nowNs();
+        loop.addPeriodicTimer(10, [this]() { onTick(); });
+        if (config.statsMs > 0) {
+            loop.addPeriodicTimer(config.statsMs, [this]() { printStats(); });
+        }
+        if (config.batteryMs > 0) {
+            loop.addPeriodicTimer(config.batteryMs, [this]() { drainBatteries(); });
+        }
+        EventLoop::SignalCallback onSignal = [this](const struct signalfd_siginfo&) {
+            loop.stop();
+        };
+        loop.addSignal(SIGINT, onSignal);
+        loop.addSignal(SIGTERM, onSignal);
+
+        std::cerr << "flicd_sim listening on port " << config.port << " with "
+                  << config.buttons << " virtual buttons" << std::endl;
+        loop.run();
+
+        totals.events += interval.events;
+        totals.bytes += interval.bytes;
+        totals.pings += interval.pings;
+        totals.stalls += interval.stalls;
+        totals.modeChanges += interval.modeChanges;
+        std::cerr << "Totals: " << totals.events << " events, " << totals.bytes
+                  << " bytes, " << totals.pings << " pings, " << totals.stalls
+                  << " stalled ticks, " << totals.modeChanges << " mode changes" << std::endl;
+    }
+
+private:
+    static const size_t kMaxBacklog = 1024 * 1024;
+
+    struct Channel {
+        uint32_t button;
+        bool ready;
+        uint8_t latencyMode;
+    };
+
+    struct Session {
+        int fd;
+        uint64_t id;                      // unique for the run; fds are reused
+        FrameDecoder decoder;
+        CommandWriter writer;
+        std::unordered_map<uint32_t, Channel> channels;
+        std::vector<uint32_t> readyChannels;
+        std::vector<uint32_t> waiting;    // would be ready, but no space
+        std::vector<uint32_t> scanners;
+        std::unordered_map<uint32_t, uint32_t> batteryListeners;  // listener_id -> button
+        uint32_t pending;
+        bool noSpace;
+        size_t clickCursor;
+        uint32_t advCursor;
+        double clickCredit;
+        double advCredit;
+
+        Session()
+            : fd(-1), id(0), pending(0), noSpace(false), clickCursor(0), advCursor(0),
+              clickCredit(0), advCredit(0) {}
+    };
+
+    struct Counters {
+        uint64_t events;
+        uint64_t bytes;
+        uint64_t pings;
+        uint64_t stalls;
+        uint64_t modeChanges;
+    };
+
+    SimConfig config;
+    EventLoop loop;
+    int listenfd;
+    std::unordered_map<int, std::unique_ptr<Session> > sessions;
+    uint64_t nextSessionId;
+    uint64_t lastTickNs;
+    uint32_t rngState;
+    Counters totals;
+    Counters interval;
+    std::vector<int8_t> batteryLevels;  // per virtual button
+    std::vector<bool> batteryChanged;   // in the current drain step
+
+    uint32_t random() {
+        rngState = rngState * 1103515245u + 12345u;
+        return rngState >> 8;
+    }
+
+    // Virtual button n has address 80:e4:da:nn:nn:nn
+    static void buttonAddr(uint32_t n, uint8_t* addr) {
+        addr[0] = static_cast<uint8_t>(n);
+        addr[1] = static_cast<uint8_t>(n >> 8);
+        addr[2] = static_cast<uint8_t>(n >> 16);
+        addr[3] = 0xda;
+        addr[4] = 0xe4;
+        addr[5] = 0x80;
+    }
+
+    static uint32_t buttonIndex(const uint8_t* addr) {
+        return addr[0] | (addr[1] << 8) | (addr[2] << 16);
+    }
+
+    void send(Session& session, const void* data, size_t len) {
+        session.writer.send(data, len);
+        interval.bytes += len + 2;
+    }
+
+    void onAccept() {
+        for (;;) {
+            int fd = accept4(listenfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            std::unique_ptr<Session> session(new Session());
+            session->fd = fd;
+            session->id = nextSessionId++;
+            session->writer.attach(fd);
+            Session* s = session.get();
+            sessions[fd] = std::move(session);
+            loop.addFd(fd, EPOLLIN, [this, s](uint32_t events) { onSessionEvent(*s, events); });
+
+            for (uint32_t i = 0; i < config.autoConnect; i++) {
+                Channel channel = { i % config.buttons, true, NormalLatency };
+                s->channels[i + 1] = channel;
+                s->readyChannels.push_back(i + 1);
+            }
+            std::cerr << "Client connected (fd " << fd << ")" << std::endl;
+        }
+    }
+
+    void closeSession(Session& session) {
+        int fd = session.fd;
+        loop.removeFd(fd);
+        close(fd);
+        sessions.erase(fd);
+        std::cerr << "Client disconnected (fd " << fd << ")" << std::endl;
+    }
+
+    void onSessionEvent(Session& session, uint32_t events) {
+        if (events & EPOLLOUT) {
+            if (!session.writer.flush()) {
+                closeSession(session);
+                return;
+            }
+        }
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            ssize_t n = session.decoder.fill(session.fd);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                closeSession(session);
+                return;
+            }
+            session.writer.beginBatch();
+            const uint8_t* frame;
+            size_t len;
+            while (session.decoder.next(frame, len)) {
+                handleCommand(session, frame, len);
+            }
+            session.writer.commit();
+        }
+        updateInterest(session);
+    }
+
+    void updateInterest(Session& session) {
+        loop.modifyFd(session.fd,
+                      session.writer.pending() ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+    }
+
+    void handleCommand(Session& session, const uint8_t* data, size_t len) {
+        if (len < 1) return;
+
+        switch (data[0]) {
+            case CMD_GET_INFO_OPCODE:
+                sendGetInfo(session);
+                break;
+
+            case CMD_PING_OPCODE:
+                if (const CmdPing* cmd = packetAs<CmdPing>(data, len)) {
+                    EvtPingResponse evt;
+                    evt.opcode = EVT_PING_RESPONSE_OPCODE;
+                    evt.ping_id = cmd->ping_id;
+                    send(session, &evt, sizeof(evt));
+                    interval.pings++;
+                }
+                break;
+
+            case CMD_CREATE_CONNECTION_CHANNEL_OPCODE:
+                if (const CmdCreateConnectionChannel* cmd = packetAs<CmdCreateConnectionChannel>(data, len)) {
+                    createChannel(session, *cmd);
+                }
+                break;
+
+            case CMD_CHANGE_MODE_PARAMETERS_OPCODE:
+                if (const CmdChangeModeParameters* cmd = packetAs<CmdChangeModeParameters>(data, len)) {
+                    std::unordered_map<uint32_t, Channel>::iterator it =
+                        session.channels.find(cmd->conn_id);
+                    if (it != session.channels.end()) {
+                        it->second.latencyMode = cmd->latency_mode;
+                        interval.modeChanges++;
+                    }
+                }
+                break;
+
+            case CMD_GET_BUTTON_INFO_OPCODE:
+                if (const CmdGetButtonInfo* cmd = packetAs<CmdGetButtonInfo>(data, len)) {
+                    sendButtonInfo(session, cmd->bd_addr);
+                }
+                break;
+
+            case CMD_CREATE_BATTERY_STATUS_LISTENER_OPCODE:
+                if (const CmdCreateBatteryStatusListener* cmd =
+                        packetAs<CmdCreateBatteryStatusListener>(data, len)) {
+                    uint32_t button = buttonIndex(cmd->bd_addr) % config.buttons;
+                    session.batteryListeners[cmd->listener_id] = button;
+                    sendBatteryStatus(session, cmd->listener_id, button);
+                }
+                break;
+
+            case CMD_REMOVE_BATTERY_STATUS_LISTENER_OPCODE:
+                if (const CmdRemoveBatteryStatusListener* cmd =
+                        packetAs<CmdRemoveBatteryStatusListener>(data, len)) {
+                    session.batteryListeners.erase(cmd->listener_id);
+                }
+                break;
+
+            case CMD_REMOVE_CONNECTION_CHANNEL_OPCODE:
+                if (const CmdRemoveConnectionChannel* cmd = packetAs<CmdRemoveConnectionChannel>(data, len)) {
+                    removeChannel(session, cmd->conn_id, RemovedByThisClient);
+                }
+                break;
+
+            case CMD_CREATE_SCANNER_OPCODE:
+                if (const CmdCreateScanner* cmd = packetAs<CmdCreateScanner>(data, len)) {
+                    session.scanners.push_back(cmd->scan_id);
+                }
+                break;
+
+            case CMD_REMOVE_SCANNER_OPCODE:
+                if (const CmdRemoveScanner* cmd = packetAs<CmdRemoveScanner>(data, len)) {
+                    uint32_t scan_id = cmd->scan_id;
+                    session.scanners.erase(
+                        std::remove(session.scanners.begin(), session.scanners.end(), scan_id),
+                        session.scanners.end());
+                }
+                break;
+
+            default:
+                // Accepted and ignored, like unsupported features on a real daemon
+                break;
+        }
+    }
+
+    void sendGetInfo(Session& session) {
+        // Verified button list is capped by the 16-bit frame length
+        uint32_t count = std::min<uint32_t>(
+            config.buttons, (FrameDecoder::kMaxFrameLen - sizeof(EvtGetInfoResponse) - 2) / 6);
+        std::vector<uint8_t> buf(sizeof(EvtGetInfoResponse) + 2 + count * 6);
+
+        EvtGetInfoResponse* evt = reinterpret_cast<EvtGetInfoResponse*>(&buf[0]);
+        evt->opcode = EVT_GET_INFO_RESPONSE_OPCODE;
+        evt->bluetooth_controller_state = Attached;
+        buttonAddr(0xffffff, evt->my_bd_addr);
+        evt->my_bd_addr_type = PublicBdAddrType;
+        evt->max_pending_connections = static_cast<uint8_t>(std::min<uint32_t>(config.maxPending, 255));
+        uint32_t maxConnected = config.maxConnected > 0 ? config.maxConnected : config.buttons;
+        evt->max_concurrently_connected_buttons = static_cast<int16_t>(std::min<uint32_t>(maxConnected, 32767));
+        evt->current_pending_connection_count = static_cast<uint8_t>(std::min<uint32_t>(session.pending, 255));
+        evt->currently_no_space_for_new_connection = session.noSpace ? 1 : 0;
+
+        uint16_t nb = static_cast<uint16_t>(count);
+        std::memcpy(&buf[sizeof(EvtGetInfoResponse)], &nb, 2);
+        for (uint32_t i = 0; i < count; i++) {
+            buttonAddr(i, &buf[sizeof(EvtGetInfoResponse) + 2 + i * 6]);
+        }
+        send(session, &buf[0], buf.size());
+    }
+
+    // Fields after EvtGetButtonInfoResponse are derived from the button index:
+    // a 16-byte uuid, "Flic <index>", a color, a serial and firmware version
+    void sendButtonInfo(Session& session, const uint8_t* addr) {
+        uint32_t button = buttonIndex(addr);
+        EvtGetButtonInfoResponse evt;
+        evt.opcode = EVT_GET_BUTTON_INFO_RESPONSE_OPCODE;
+        std::memcpy(evt.bd_addr, addr, 6);
+        std::vector<uint8_t> buf(reinterpret_cast<uint8_t*>(&evt), reinterpret_cast<uint8_t*>(&evt) + sizeof(evt));
+
+        buf.push_back(16);
+        for (int i = 0; i < 16; i++) buf.push_back(static_cast<uint8_t>((button >> (8 * (i % 3))) ^ (i * 37)));
+        char text[24];
+        int n = std::snprintf(text, sizeof(text), "Flic %u", button);
+        buf.push_back(static_cast<uint8_t>(n));
+        buf.insert(buf.end(), text, text + n);
+        int32_t color = static_cast<int32_t>(0xff000000u | (button * 2654435761u >> 8));
+        buf.insert(buf.end(), reinterpret_cast<uint8_t*>(&color), reinterpret_cast<uint8_t*>(&color) + 4);
+        n = std::snprintf(text, sizeof(text), "BA%08u", button);
+        buf.push_back(static_cast<uint8_t>(n));
+        buf.insert(buf.end(), text, text + n);
+        buf.push_back(2);
+        uint32_t firmware = 10;
+        buf.insert(buf.end(), reinterpret_cast<uint8_t*>(&firmware), reinterpret_cast<uint8_t*>(&firmware) + 4);
+        send(session, &buf[0], buf.size());
+        interval.events++;
+    }
+
+    void createChannel(Session& session, const CmdCreateConnectionChannel& cmd) {
+        EvtCreateConnectionChannelResponse rsp;
+        rsp.opcode = EVT_CREATE_CONNECTION_CHANNEL_RESPONSE_OPCODE;
+        rsp.conn_id = cmd.conn_id;
+        rsp.connection_status = Disconnected;
+
+        if (session.channels.count(cmd.conn_id)) {
+            return;
+        }
+        if (session.pending >= config.maxPending) {
+            rsp.error = MaxPendingConnectionsReached;
+            send(session, &rsp, sizeof(rsp));
+            return;
+        }
+        rsp.error = NoError;
+        send(session, &rsp, sizeof(rsp));
+
+        Channel channel = { buttonIndex(cmd.bd_addr), false, cmd.latency_mode };
+        session.channels[cmd.conn_id] = channel;
+        session.pending++;
+
+        int fd = session.fd;
+        uint32_t conn_id = cmd.conn_id;
+        loop.addTimer(config.connectDelayMs, [this, fd, conn_id]() { channelReady(fd, conn_id); });
+    }
+
+    void channelReady(int fd, uint32_t conn_id) {
+        std::unordered_map<int, std::unique_ptr<Session> >::iterator sit = sessions.find(fd);
+        if (sit == sessions.end()) return;
+        Session& session = *sit->second;
+        std::unordered_map<uint32_t, Channel>::iterator it = session.channels.find(conn_id);
+        if (it == session.channels.end() || it->second.ready) return;
+
+        if (config.maxConnected > 0 && session.readyChannels.size() >= config.maxConnected) {
+            if (!session.noSpace) {
+                session.noSpace = true;
+                sendSpaceEvent(session, EVT_NO_SPACE_FOR_NEW_CONNECTION_OPCODE);
+            }
+            session.waiting.push_back(conn_id);
+            updateInterest(session);
+            return;
+        }
+
+        it->second.ready = true;
+        session.pending--;
+        session.readyChannels.push_back(conn_id);
+
+        EvtConnectionStatusChanged evt;
+        evt.opcode = EVT_CONNECTION_STATUS_CHANGED_OPCODE;
+        evt.conn_id = conn_id;
+        evt.disconnect_reason = Unspecified;
+        buttonAddr(it->second.button, evt.bd_addr);
+        evt.connection_status = Connected;
+        send(session, &evt, sizeof(evt));
+        evt.connection_status = Ready;
+        send(session, &evt, sizeof(evt));
+        updateInterest(session);
+    }
+
+    void removeChannel(Session& session, uint32_t conn_id, RemovedReason reason) {
+        std::unordered_map<uint32_t, Channel>::iterator it = session.channels.find(conn_id);
+        if (it == session.channels.end()) return;
+
+        if (it->second.ready) {
+            session.readyChannels.erase(
+                std::remove(session.readyChannels.begin(), session.readyChannels.end(), conn_id),
+                session.readyChannels.end());
+        } else {
+            session.pending--;
+        }
+        session.channels.erase(it);
+
+        EvtConnectionChannelRemoved evt;
+        evt.opcode = EVT_CONNECTION_CHANNEL_REMOVED_OPCODE;
+        evt.conn_id = conn_id;
+        evt.removed_reason = static_cast<uint8_t>(reason);
+        send(session, &evt, sizeof(evt));
+
+        if (session.noSpace && session.readyChannels.size() < config.maxConnected) {
+            session.noSpace = false;
+            sendSpaceEvent(session, EVT_GOT_SPACE_FOR_NEW_CONNECTION_OPCODE);
+            std::vector<uint32_t> waiting;
+            waiting.swap(session.waiting);
+            for (size_t i = 0; i < waiting.size(); i++) {
+                channelReady(session.fd, waiting[i]);
+            }
+        }
+    }
+
+    // NoSpace and GotSpace share one layout
+    void sendSpaceEvent(Session& session, uint8_t opcode) {
+        EvtNoSpaceForNewConnection evt;
+        evt.opcode = opcode;
+        evt.max_concurrently_connected_buttons =
+            static_cast<uint8_t>(std::min<uint32_t>(config.maxConnected, 255));
+        send(session, &evt, sizeof(evt));
+    }
+
+    void emitClick(Session& session, uint32_t conn_id) {
+        EvtButtonUpOrDown updown;
+        updown.opcode = EVT_BUTTON_UP_OR_DOWN_OPCODE;
+        updown.conn_id = conn_id;
+        updown.was_queued = config.ageMs > 0;
+        updown.time_diff = config.ageMs;
+        bool isDouble = config.doubleClickPct > 0 && random() % 100 < config.doubleClickPct;
+        for (int press = 0; press < (isDouble ? 2 : 1); press++) {
+            updown.click_type = ClickTypeButtonDown;
+            send(session, &updown, sizeof(updown));
+            updown.click_type = ClickTypeButtonUp;
+            send(session, &updown, sizeof(updown));
+            interval.events += 2;
+        }
+
+        EvtButtonSingleOrDoubleClickOrHold click;
+        click.opcode = EVT_BUTTON_SINGLE_OR_DOUBLE_CLICK_OR_HOLD_OPCODE;
+        click.conn_id = conn_id;
+        click.click_type = isDouble ? ClickTypeButtonDoubleClick : ClickTypeButtonSingleClick;
+        click.was_queued = updown.was_queued;
+        click.time_diff = config.ageMs;
+        if (config.doubleClickMs == 0) {
+            send(session, &click, sizeof(click));
+            interval.events++;
+            return;
+        }
+        // The fd may belong to a new client by the time the timer fires
+        int fd = session.fd;
+        uint64_t id = session.id;
+        loop.addTimer(config.doubleClickMs, [this, fd, id, click]() {
+            std::unordered_map<int, std::unique_ptr<Session> >::iterator it = sessions.find(fd);
+            if (it == sessions.end() || it->second->id != id) return;
+            send(*it->second, &click, sizeof(click));
+            interval.events++;
+            updateInterest(*it->second);
+        });
+    }
+
+    void sendBatteryStatus(Session& session, uint32_t listener_id, uint32_t button) {
+        EvtBatteryStatus evt;
+        evt.opcode = EVT_BATTERY_STATUS_OPCODE;
+        evt.listener_id = listener_id;
+        evt.battery_percentage = batteryLevels[button];
+        evt.timestamp = static_cast<uint64_t>(std::time(nullptr));
+        send(session, &evt, sizeof(evt));
+        interval.events++;
+    }
+
+    void drainBatteries() {
+        for (uint32_t i = 0; i < config.buttons; i++) {
+            batteryChanged[i] = random() % 4 == 0;
+            if (!batteryChanged[i]) continue;
+            batteryLevels[i] = batteryLevels[i] > 0 ? batteryLevels[i] - 1 : 100;
+        }
+        for (std::unordered_map<int, std::unique_ptr<Session> >::iterator it = sessions.begin();
+             it != sessions.end(); ++it) {
+            Session& session = *it->second;
+            if (session.batteryListeners.empty()) continue;
+            session.writer.beginBatch();
+            for (std::unordered_map<uint32_t, uint32_t>::const_iterator l = session.batteryListeners.begin();
+                 l != session.batteryListeners.end(); ++l) {
+                if (batteryChanged[l->second]) sendBatteryStatus(session, l->first, l->second);
+            }
+            session.writer.commit();
+            updateInterest(session);
+        }
+    }
+
+    void emitAdvertisement(Session& session, uint32_t scan_id) {
+        EvtAdvertisementPacket evt;
+        std::memset(&evt, 0, sizeof(evt));
+        evt.opcode = EVT_ADVERTISEMENT_PACKET_OPCODE;
+        evt.scan_id = scan_id;
+        uint32_t button = session.advCursor++ % config.buttons;
+        buttonAddr(button, evt.bd_addr);
+        int nameLen = std::snprintf(evt.name, sizeof(evt.name), "F%u", button);
+        evt.name_length = static_cast<uint8_t>(std::min<int>(nameLen, sizeof(evt.name)));
+        evt.rssi = static_cast<int8_t>(-40 - static_cast<int>(random() % 50));
+        evt.already_verified = 1;
+        send(session, &evt, sizeof(evt));
+        interval.events++;
+    }
+
+    void onTick() {
+        uint64_t now = EventLoop::nowNs();
+        double dt = (now - lastTickNs) / 1e9;
+        lastTickNs = now;
+
+        for (std::unordered_map<int, std::unique_ptr<Session> >::iterator it = sessions.begin();
+             it != sessions.end(); ++it) {
+            Session& session = *it->second;
+            session.clickCredit += session.readyChannels.size() * config.clickRate * dt;
+            session.advCredit += session.scanners.size() * config.advRate * dt;
+
+            if (session.writer.queuedBytes() > kMaxBacklog) {
+                // Client is not keeping up; drop this tick's events
+                session.clickCredit = 0;
+                session.advCredit = 0;
+                interval.stalls++;
+                continue;
+            }
+
+            session.writer.beginBatch();
+            while (session.clickCredit >= 1.0 && !session.readyChannels.empty()) {
+                session.clickCredit -= 1.0;
+                session.clickCursor %= session.readyChannels.size();
+                emitClick(session, session.readyChannels[session.clickCursor++]);
+            }
+            size_t scanner = 0;
+            while (session.advCredit >= 1.0 && !session.scanners.empty()) {
+                session.advCredit -= 1.0;
+                emitAdvertisement(session, session.scanners[scanner++ % session.scanners.size()]);
+            }
+            if (!session.writer.commit()) {
+                closeSession(session);
+                return;
+            }
+            updateInterest(session);
+        }
+    }
+
+    void printStats() {
+        double secs = config.statsMs / 1000.0;
+        size_t channels = 0;
+        size_t lowLatency = 0;
+        for (std::unordered_map<int, std::unique_ptr<Session> >::iterator it = sessions.begin();
+             it != sessions.end(); ++it) {
+            channels += it->second->readyChannels.size();
+            for (std::unordered_map<uint32_t, Channel>::const_iterator c = it->second->channels.begin();
+                 c != it->second->channels.end(); ++c) {
+                if (c->second.latencyMode == LowLatency) lowLatency++;
+            }
+        }
+        std::cerr << std::fixed << std::setprecision(0)
+                  << "sessions " << sessions.size()
+                  << "  ready channels " << channels
+                  << "  events/s " << interval.events / secs
+                  << "  KiB/s " << interval.bytes / secs / 1024
+                  << "  pings " << interval.pings
+                  << "  stalled ticks " << interval.stalls
+                  << "  low latency " << lowLatency
+                  << "  mode changes " << interval.modeChanges << std::endl;
+
+        totals.events += interval.events;
+        totals.bytes += interval.bytes;
+        totals.pings += interval.pings;
+        totals.stalls += interval.stalls;
+        totals.modeChanges += interval.modeChanges;
+        std::memset(&interval, 0, sizeof(interval));
+    }
+};
+
+static void printUsage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " [options]" << std::endl;
+    std::cerr << "  --port N              TCP port to listen on (default 5551)" << std::endl;
+    std::cerr << "  --buttons N           Number of virtual buttons (default 1000)" << std::endl;
+    std::cerr << "  --click-rate HZ       Clicks per second per ready channel (default 1)" << std::endl;
+    std::cerr << "  --adv-rate HZ         Advertisements per second per scanner (default 100)" << std::endl;
+    std::cerr << "  --age-ms MS           time_diff reported in button events (default 0)" << std::endl;
+    std::cerr << "  --connect-delay-ms MS Delay before a new channel becomes Ready (default 20)" << std::endl;
+    std::cerr << "  --max-pending N       Pending connection limit (default 128)" << std::endl;
+    std::cerr << "  --max-connected N     Connected channel limit, 0 for none (default 0)" << std::endl;
+    std::cerr << "  --auto-connect N      Give every client N ready channels (conn_id 1..N)" << std::endl;
+    std::cerr << "  --stats-ms MS         Statistics interval, 0 to disable (default 1000)" << std::endl;
+    std::cerr << "  --battery-ms MS       Battery drain step interval, 0 to disable (default 60000)" << std::endl;
+    std::cerr << "  --double-click-ms MS  Delay the click classification like flicd's double click wait (default 0)" << std::endl;
+    std::cerr << "  --double-clicks PCT   Share of clicks that are double clicks (default 0)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    SimConfig config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+        if (arg == "--port") {
+            config.port = std::atoi(value);
+        } else if (arg == "--buttons") {
+            config.buttons = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--click-rate") {
+            config.clickRate = std::atof(value);
+        } else if (arg == "--adv-rate") {
+            config.advRate = std::atof(value);
+        } else if (arg == "--age-ms") {
+            config.ageMs = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--connect-delay-ms") {
+            config.connectDelayMs = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--max-pending") {
+            config.maxPending = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--max-connected") {
+            config.maxConnected = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--auto-connect") {
+            config.autoConnect = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--stats-ms") {
+            config.statsMs = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--battery-ms") {
+            config.batteryMs = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--double-click-ms") {
+            config.doubleClickMs = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--double-clicks") {
+            config.doubleClickPct = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.buttons == 0 || config.buttons > 0xffffff) {
+        std::cerr << "--buttons must be between 1 and 16777215" << std::endl;
+        return 1;
+    }
+
+    FlicdSim sim(config);
+    if (!sim.listen()) {
+        return 1;
+    }
+    sim.run();
+    return 0;
+}
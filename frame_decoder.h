@@ -0,0 +1,102 @@
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// Buffered decoder for the length-prefixed flicd stream.
+//
+// fill() drains whatever the kernel has queued with a single recv() into the
+// free tail of the buffer; next() then hands out every complete frame in place.
+// A trailing partial frame stays buffered and is completed by a later fill().
+// Before each fill() the unconsumed bytes (at most one partial frame plus any
+// frames the caller did not pop) are moved to the front so that every frame is
+// contiguous and can be cast to its packet struct without copying.
+class FrameDecoder {
+public:
+    // Largest frame body the 16-bit length header can describe
+    static const size_t kMaxFrameLen = 0xffff;
+
+    explicit FrameDecoder(size_t capacity = 2 * (kMaxFrameLen + 2))
+        : buffer(capacity < kMaxFrameLen + 2 ? kMaxFrameLen + 2 : capacity),
+          head(0), tail(0), recvCalls(0), framesDecoded(0), bytesReceived(0) {}
+
+    // Reads everything available on fd with one recv(). Returns the number of
+    // bytes read, 0 on orderly shutdown, or -1 with errno set (EAGAIN/EINTR
+    // included, so non-blocking sockets can be drained until empty).
+    ssize_t fill(int fd) {
+        compact();
+        ssize_t n = recv(fd, &buffer[tail], buffer.size() - tail, 0);
+        recvCalls++;
+        if (n > 0) {
+            tail += static_cast<size_t>(n);
+            bytesReceived += static_cast<uint64_t>(n);
+        }
+        return n;
+    }
+
+    // Appends raw stream bytes that were obtained elsewhere (replay, benchmarks).
+    // Returns the number of bytes accepted.
+    size_t append(const uint8_t* data, size_t len) {
+        compact();
+        size_t room = buffer.size() - tail;
+        if (len > room) len = room;
+        std::memcpy(&buffer[tail], data, len);
+        tail += len;
+        bytesReceived += len;
+        return len;
+    }
+
+    // Pops the next complete frame. The pointer stays valid until the next
+    // fill()/append() call.
+    bool next(const uint8_t*& data, size_t& len) {
+        size_t avail = tail - head;
+        if (avail < 2) return false;
+
+        // Length header is little endian
+        size_t frameLen = buffer[head] | (static_cast<size_t>(buffer[head + 1]) << 8);
+        if (avail < 2 + frameLen) return false;
+
+        data = &buffer[head + 2];
+        len = frameLen;
+        head += 2 + frameLen;
+        framesDecoded++;
+        if (head == tail) {
+            head = tail = 0;
+        }
+        return true;
+    }
+
+    size_t buffered() const { return tail - head; }
+    void reset() { head = tail = 0; }
+
+    uint64_t recvCount() const { return recvCalls; }
+    uint64_t frameCount() const { return framesDecoded; }
+    uint64_t byteCount() const { return bytesReceived; }
+
+private:
+    std::vector<uint8_t> buffer;
+    size_t head;
+    size_t tail;
+
+    uint64_t recvCalls;
+    uint64_t framesDecoded;
+    uint64_t bytesReceived;
+
+    void compact() {
+        if (head == 0) return;
+        size_t remaining = tail - head;
+        if (remaining > 0) {
+            std::memmove(&buffer[0], &buffer[head], remaining);
+        }
+        head = 0;
+        tail = remaining;
+    }
+};
+
+#endif // FRAME_DECODER_H
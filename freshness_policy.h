@@ -0,0 +1,113 @@
+#ifndef FRESHNESS_POLICY_H
+#define FRESHNESS_POLICY_H
+
+#include <cstdlib>
+#include <string>
+#include <stdint.h>
+
+#include "bd_addr.h"
+#include "latency_histogram.h"
+#include "profile_table.h"
+
+// Per-button deadlines for button events.
+//
+// flicd queues button events while a button is out of range or the client
+// is away and reports how long ago each happened in time_diff. An event's
+// deadline is the moment it happened plus its button's maxAgeMs; an event
+// dispatched after its deadline is stale and is dropped, delivered flagged,
+// or collapsed: of the stale events of one kind (opcode and click type)
+// from one button that arrive together, only the newest is delivered,
+// flagged with how many it stands for. FlicClient holds, orders, sheds and
+// reports the events.
+class FreshnessPolicy {
+public:
+    enum StaleAction {
+        Drop,
+        Flag,
+        Collapse
+    };
+
+    struct Profile {
+        uint32_t maxAgeMs;  // 0 = never stale
+        uint8_t stale;      // StaleAction
+
+        Profile() : maxAgeMs(0), stale(Drop) {}
+    };
+
+    struct Stats {
+        uint64_t stale;             // dispatched after their deadline
+        uint64_t dropped;
+        uint64_t flagged;           // delivered through onStaleEvent, collapsed or not
+        uint64_t collapsed;         // replaced by a newer stale event of the same kind
+        uint64_t backlogs;          // dispatches of more than one button event at once
+        uint64_t reordered;         // events dispatched ahead of one that arrived earlier
+        LatencyHistogram lateMs;    // how far past its deadline a stale event was
+
+        Stats()
+            : stale(0), dropped(0), flagged(0), collapsed(0), backlogs(0), reordered(0),
+              lateMs(3600000) {}
+    };
+
+    static const uint64_t kNoDeadline = UINT64_MAX;
+
+    // Profile 0, used for buttons without their own
+    Profile& defaultProfile() { return profiles.defaultProfile(); }
+
+    void setProfile(const BdAddr& addr, const Profile& profile) { profiles.set(addr, profile); }
+    uint16_t profileFor(const uint8_t* addr) const { return profiles.indexOf(addr); }
+    const Profile& profile(uint16_t index) const { return profiles.at(index); }
+    size_t profileCount() const { return profiles.size(); }
+
+    // The deadline of an event received at recvNs that happened timeDiffMs
+    // earlier, or kNoDeadline
+    static uint64_t deadlineNs(const Profile& p, uint64_t recvNs, uint32_t timeDiffMs) {
+        if (p.maxAgeMs == 0) return kNoDeadline;
+        uint64_t ageNs = timeDiffMs * 1000000ull;
+        uint64_t happenedNs = recvNs > ageNs ? recvNs - ageNs : 0;
+        return happenedNs + p.maxAgeMs * 1000000ull;
+    }
+
+    // Reads a policy file (see ProfileTable::load) of key=value settings:
+    //   default max_age_ms=3000 stale=drop
+    //   80:e4:da:71:3b:ff max_age_ms=500 stale=collapse
+    // Keys: max_age_ms (0 = never stale), stale (drop|flag|collapse).
+    bool load(const std::string& path, std::string* error) {
+        return profiles.load(path, error, apply);
+    }
+
+    static const char* staleActionName(uint8_t action) {
+        switch (action) {
+            case Drop: return "drop";
+            case Flag: return "flag";
+            case Collapse: return "collapse";
+            default: return "?";
+        }
+    }
+
+private:
+    ProfileTable<Profile> profiles;
+
+    static bool apply(Profile& p, const std::string& setting) {
+        size_t eq = setting.find('=');
+        if (eq == std::string::npos || eq + 1 == setting.size()) return false;
+        std::string key = setting.substr(0, eq);
+        std::string value = setting.substr(eq + 1);
+        if (key == "stale") {
+            for (uint8_t a = Drop; a <= Collapse; a++) {
+                if (value == staleActionName(a)) {
+                    p.stale = a;
+                    return true;
+                }
+            }
+            return false;
+        }
+        char* end;
+        unsigned long long number = std::strtoull(value.c_str(), &end, 10);
+        if (*end != '\0' || number > 86400000) return false;
+        if (key == "max_age_ms") p.maxAgeMs = static_cast<uint32_t>(number);
+        else return false;
+        return true;
+    }
+};
+
+#endif // FRESHNESS_POLICY_H
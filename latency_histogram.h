@@ -0,0 +1,102 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <vector>
+#include <stdint.h>
+
+// Log-linear histogram in the style of HdrHistogram.
+//
+// Values below 2^kSubBucketBits are counted exactly; above that every power
+// of two is split into 2^(kSubBucketBits-1) linear sub-buckets, so any
+// recorded value is reproduced within 1/32 (about 3%) of its true value.
+// The bucket array is sized once from maxValue and recording is two shifts
+// and an increment; values above maxValue are clamped into the top bucket.
+class LatencyHistogram {
+public:
+    static const int kSubBucketBits = 6;
+
+    explicit LatencyHistogram(uint64_t maxValue = 0xffffffffull)
+        : counts(bucketIndex(maxValue) + 1, 0), maxTrackable(maxValue),
+          total(0), sum(0), minValue(0), maxValue_(0) {}
+
+    void record(uint64_t value) {
+        if (value > maxTrackable) value = maxTrackable;
+        counts[bucketIndex(value)]++;
+        if (total == 0 || value < minValue) minValue = value;
+        if (value > maxValue_) maxValue_ = value;
+        total++;
+        sum += value;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        if (other.total == 0) return;
+        for (size_t i = 0; i < other.counts.size(); i++) {
+            if (other.counts[i] == 0) continue;
+            uint64_t value = bucketUpperBound(i);
+            if (value > maxTrackable) value = maxTrackable;
+            counts[bucketIndex(value)] += other.counts[i];
+        }
+        if (total == 0 || other.minValue < minValue) minValue = other.minValue;
+        if (other.maxValue_ > maxValue_) maxValue_ = other.maxValue_;
+        total += other.total;
+        sum += other.sum;
+    }
+
+    void reset() {
+        for (size_t i = 0; i < counts.size(); i++) counts[i] = 0;
+        total = sum = minValue = maxValue_ = 0;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return minValue; }
+    uint64_t max() const { return maxValue_; }
+    double mean() const { return total ? static_cast<double>(sum) / total : 0.0; }
+
+    // Highest value equivalent to the given percentile (0..100), i.e. the
+    // upper bound of the bucket the percentile falls into, capped at max()
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > total) rank = total;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                uint64_t upper = bucketUpperBound(i);
+                return upper < maxValue_ ? upper : maxValue_;
+            }
+        }
+        return maxValue_;
+    }
+
+private:
+    std::vector<uint32_t> counts;
+    uint64_t maxTrackable;
+    uint64_t total;
+    uint64_t sum;
+    uint64_t minValue;
+    uint64_t maxValue_;
+
+    static int highestBit(uint64_t v) {
+        return 63 - __builtin_clzll(v);
+    }
+
+    static size_t bucketIndex(uint64_t v) {
+        const uint64_t subBuckets = 1ull << kSubBucketBits;
+        if (v < subBuckets) return static_cast<size_t>(v);
+        int shift = highestBit(v) - (kSubBucketBits - 1);
+        return static_cast<size_t>(shift) * (subBuckets / 2) + static_cast<size_t>(v >> shift);
+    }
+
+    static uint64_t bucketUpperBound(size_t index) {
+        const uint64_t subBuckets = 1ull << kSubBucketBits;
+        if (index < subBuckets) return index;
+        size_t shift = index / (subBuckets / 2) - 1;
+        uint64_t sub = index - shift * (subBuckets / 2);
+        return ((sub + 1) << shift) - 1;
+    }
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,141 @@
+#ifndef LATENCY_POLICY_H
+#define LATENCY_POLICY_H
+
+#include <cstdlib>
+#include <string>
+#include <stdint.h>
+
+#include "client_protocol_packets.h"
+#include "bd_addr.h"
+#include "channel_table.h"
+#include "profile_table.h"
+
+// Per-button latency mode policy.
+//
+// A button runs in its profile's idle mode (HighLatency by default) and is
+// moved to the active mode (LowLatency) when it is pressed often enough:
+// activatePresses presses within activateWindowMs. It goes back to the idle
+// mode after holdMs without a press, but never sooner than minDwellMs after
+// its last mode change. Promotion is immediate and demotion is slow, so a
+// button in use keeps low latency and a stray press does not make modes
+// flap. The policy only decides; FlicClient sends CmdChangeModeParameters.
+class LatencyPolicy {
+public:
+    struct Profile {
+        uint8_t activeMode;
+        uint8_t idleMode;
+        uint32_t activatePresses;
+        uint64_t activateWindowMs;
+        uint64_t holdMs;
+        uint64_t minDwellMs;
+        int16_t autoDisconnectTime;  // seconds, 511 = never
+
+        Profile()
+            : activeMode(FlicClientProtocol::LowLatency),
+              idleMode(FlicClientProtocol::HighLatency),
+              activatePresses(1), activateWindowMs(0), holdMs(30000), minDwellMs(5000),
+              autoDisconnectTime(511) {}
+    };
+
+    // Returned by onPress()/onTick() when the mode should stay as it is
+    static const int kKeepMode = -1;
+
+    // Profile 0, used for buttons without their own
+    Profile& defaultProfile() { return profiles.defaultProfile(); }
+
+    void setProfile(const BdAddr& addr, const Profile& profile) { profiles.set(addr, profile); }
+    uint16_t profileFor(const uint8_t* addr) const { return profiles.indexOf(addr); }
+    const Profile& profile(uint16_t index) const { return profiles.at(index); }
+    size_t profileCount() const { return profiles.size(); }
+
+    // Called for every button press (ButtonUpOrDown, down). Returns the mode
+    // to switch to, or kKeepMode.
+    int onPress(ChannelTable::Channel& channel, uint64_t nowNs) const {
+        const Profile& p = profile(channel.profile);
+        if (channel.latencyMode == p.activeMode) return kKeepMode;
+        if (channel.burstPresses == 0 || nowNs - channel.burstStartNs > p.activateWindowMs * 1000000ull) {
+            channel.burstStartNs = nowNs;
+            channel.burstPresses = 0;
+        }
+        if (channel.burstPresses < 0xffff) channel.burstPresses++;
+        if (channel.burstPresses < p.activatePresses) return kKeepMode;
+        channel.burstPresses = 0;
+        return p.activeMode;
+    }
+
+    // Called periodically for every channel. Returns the idle mode once the
+    // channel has been quiet long enough, or kKeepMode.
+    int onTick(const ChannelTable::Channel& channel, uint64_t nowNs) const {
+        const Profile& p = profile(channel.profile);
+        if (channel.latencyMode == p.idleMode) return kKeepMode;
+        uint64_t quietSince = channel.lastEventNs > channel.modeChangedNs ?
+                              channel.lastEventNs : channel.modeChangedNs;
+        if (nowNs - quietSince < p.holdMs * 1000000ull) return kKeepMode;
+        if (nowNs - channel.modeChangedNs < p.minDwellMs * 1000000ull) return kKeepMode;
+        return p.idleMode;
+    }
+
+    // How often onTick() needs to run for the shortest hold time to be
+    // honoured within about a quarter of it
+    uint64_t tickMs() const {
+        uint64_t shortest = profiles.at(0).holdMs;
+        for (uint16_t i = 1; i < profiles.size(); i++) {
+            if (profiles.at(i).holdMs < shortest) shortest = profiles.at(i).holdMs;
+        }
+        uint64_t tick = shortest / 4;
+        return tick < 100 ? 100 : tick > 1000 ? 1000 : tick;
+    }
+
+    // Reads a policy file (see ProfileTable::load) of key=value settings:
+    //   default active=low idle=high hold_ms=30000
+    //   80:e4:da:71:3b:ff presses=2 window_ms=1500 idle=normal
+    // Keys: active, idle (low|normal|high), presses, window_ms, hold_ms,
+    // dwell_ms, auto_disconnect (seconds, 511 = never).
+    bool load(const std::string& path, std::string* error) {
+        return profiles.load(path, error, apply, [](const Profile& p) -> const char* {
+            return p.idleMode == p.activeMode ? "active and idle mode are the same" : nullptr;
+        });
+    }
+
+    static bool parseMode(const std::string& name, uint8_t& mode) {
+        if (name == "low") mode = FlicClientProtocol::LowLatency;
+        else if (name == "normal") mode = FlicClientProtocol::NormalLatency;
+        else if (name == "high") mode = FlicClientProtocol::HighLatency;
+        else return false;
+        return true;
+    }
+
+    static const char* modeName(uint8_t mode) {
+        switch (mode) {
+            case FlicClientProtocol::LowLatency: return "low";
+            case FlicClientProtocol::NormalLatency: return "normal";
+            case FlicClientProtocol::HighLatency: return "high";
+            default: return "?";
+        }
+    }
+
+private:
+    ProfileTable<Profile> profiles;
+
+    static bool apply(Profile& p, const std::string& setting) {
+        size_t eq = setting.find('=');
+        if (eq == std::string::npos || eq + 1 == setting.size()) return false;
+        std::string key = setting.substr(0, eq);
+        std::string value = setting.substr(eq + 1);
+        if (key == "active") return parseMode(value, p.activeMode);
+        if (key == "idle") return parseMode(value, p.idleMode);
+
+        char* end;
+        unsigned long long number = std::strtoull(value.c_str(), &end, 10);
+        if (*end != '\0') return false;
+        if (key == "presses" && number > 0) p.activatePresses = static_cast<uint32_t>(number);
+        else if (key == "window_ms") p.activateWindowMs = number;
+        else if (key == "hold_ms" && number > 0) p.holdMs = number;
+        else if (key == "dwell_ms") p.minDwellMs = number;
+        else if (key == "auto_disconnect" && number <= 511) p.autoDisconnectTime = static_cast<int16_t>(number);
+        else return false;
+        return true;
+    }
+};
+
+#endif // LATENCY_POLICY_H
@@ -0,0 +1,147 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <cerrno>
+#include <cstring>
+#include <streambuf>
+#include <vector>
+#include <stdint.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "bd_addr.h"
+
+// Reusable output buffer for console output.
+//
+// Text is appended into one growable byte vector and written with a single
+// write() per flush, normally once per event loop iteration. clear() keeps
+// the capacity, so once the buffer has grown to its working size appending
+// never allocates. The append*() helpers format numbers and addresses
+// without iostreams; for the rare paths that still want operator<<, the
+// buffer is also a std::streambuf whose sync() is a no-op, so std::endl on
+// an ostream over it no longer costs a syscall.
+class OutputBuffer : public std::streambuf {
+public:
+    explicit OutputBuffer(size_t reserveBytes = 64 * 1024) {
+        data.reserve(reserveBytes);
+    }
+
+    void append(const char* text, size_t len) {
+        data.insert(data.end(), text, text + len);
+    }
+
+    void append(const char* text) {
+        append(text, std::strlen(text));
+    }
+
+    void append(char c) {
+        data.push_back(c);
+    }
+
+    void appendBytes(const void* bytes, size_t len) {
+        append(static_cast<const char*>(bytes), len);
+    }
+
+    void appendUInt(uint64_t value) {
+        char digits[20];
+        size_t n = 0;
+        do {
+            digits[n++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (n > 0) data.push_back(digits[--n]);
+    }
+
+    void appendInt(int64_t value) {
+        if (value < 0) {
+            data.push_back('-');
+            appendUInt(static_cast<uint64_t>(-(value + 1)) + 1);
+        } else {
+            appendUInt(static_cast<uint64_t>(value));
+        }
+    }
+
+    // "xx:xx:xx:xx:xx:xx" from the 6 little-endian protocol bytes
+    void appendBdAddr(const uint8_t* addr) {
+        size_t at = data.size();
+        data.resize(at + BdAddr::kStringLength);
+        BdAddr::format(addr, &data[at]);
+    }
+
+    // Lowercase hex digits, two per byte
+    void appendHex(const uint8_t* bytes, size_t len) {
+        static const char kHex[] = "0123456789abcdef";
+        size_t at = data.size();
+        data.resize(at + 2 * len);
+        for (size_t i = 0; i < len; i++) {
+            data[at + 2 * i] = kHex[bytes[i] >> 4];
+            data[at + 2 * i + 1] = kHex[bytes[i] & 15];
+        }
+    }
+
+    // JSON string body (without quotes); escapes quotes, backslashes and
+    // control characters
+    void appendJsonEscaped(const char* text, size_t len) {
+        static const char kHex[] = "0123456789abcdef";
+        for (size_t i = 0; i < len; i++) {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            if (c == '"' || c == '\\') {
+                data.push_back('\\');
+                data.push_back(static_cast<char>(c));
+            } else if (c < 0x20) {
+                const char escape[6] = { '\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 15] };
+                append(escape, sizeof(escape));
+            } else {
+                data.push_back(static_cast<char>(c));
+            }
+        }
+    }
+
+    bool empty() const { return data.empty(); }
+    size_t size() const { return data.size(); }
+    const char* bytes() const { return data.empty() ? nullptr : &data[0]; }
+    void clear() { data.clear(); }
+
+    // Writes everything to fd (waiting if it is non-blocking and full) and
+    // clears the buffer. Returns false on a write error.
+    bool writeTo(int fd) {
+        size_t offset = 0;
+        bool ok = true;
+        while (offset < data.size()) {
+            ssize_t n = write(fd, &data[offset], data.size() - offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    struct pollfd pfd = { fd, POLLOUT, 0 };
+                    poll(&pfd, 1, -1);
+                    continue;
+                }
+                ok = false;
+                break;
+            }
+            offset += static_cast<size_t>(n);
+        }
+        data.clear();
+        return ok;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (c != traits_type::eof()) data.push_back(static_cast<char>(c));
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        append(s, static_cast<size_t>(n));
+        return n;
+    }
+
+    // Flushing is explicit through writeTo()
+    int sync() override { return 0; }
+
+private:
+    std::vector<char> data;
+};
+
+#endif // OUTPUT_BUFFER_H
@@ -0,0 +1,167 @@
+#ifndef PACKET_VIEWS_H
+#define PACKET_VIEWS_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+#include "client_protocol_packets.h"
+
+// Bounds-checked, zero-copy access to received packets.
+//
+// Fixed-size packets are read in place through the packed structs of
+// client_protocol_packets.h once packetAs() has checked the length; packed
+// members are accessed with unaligned-safe loads, and the protocol's
+// little-endian fields match the host (checked below). Variable-length
+// payloads get views that validate every length once in parse() and then
+// decode fields on demand straight from the frame, so nothing is copied and
+// no accessor can read past the frame.
+//
+// Views point into the frame and are only valid while it is, i.e. for the
+// duration of the observer callback.
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "packets are read in place as little-endian structs");
+
+namespace PacketViews {
+
+// Little-endian loads from unaligned memory
+inline uint16_t loadLE16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t loadLE32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+}  // namespace PacketViews
+
+// Casts a frame to its packet struct, or returns null if it is too short
+template <typename T>
+inline const T* packetAs(const uint8_t* data, size_t len) {
+    return len >= sizeof(T) ? reinterpret_cast<const T*>(data) : nullptr;
+}
+
+// The verified button list that follows EvtGetInfoResponse: a 16-bit count
+// and that many 6-byte addresses. Iterating yields pointers to the protocol
+// (little-endian) address bytes, as taken by BdAddr(const uint8_t*) and
+// OutputBuffer::appendBdAddr().
+class VerifiedButtonList {
+public:
+    class const_iterator {
+    public:
+        explicit const_iterator(const uint8_t* at) : p(at) {}
+        const uint8_t* operator*() const { return p; }
+        const_iterator& operator++() {
+            p += 6;
+            return *this;
+        }
+        bool operator==(const const_iterator& other) const { return p == other.p; }
+        bool operator!=(const const_iterator& other) const { return p != other.p; }
+
+    private:
+        const uint8_t* p;
+    };
+
+    VerifiedButtonList() : first(nullptr), count(0) {}
+
+    // tail is what follows the EvtGetInfoResponse struct. Returns false if
+    // the count or the addresses do not fit.
+    bool parse(const uint8_t* tail, size_t len) {
+        if (len < 2) return false;
+        size_t n = PacketViews::loadLE16(tail);
+        if (2 + 6 * n > len) return false;
+        first = tail + 2;
+        count = n;
+        return true;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const uint8_t* operator[](size_t i) const { return first + 6 * i; }
+    const_iterator begin() const { return const_iterator(first); }
+    const_iterator end() const { return const_iterator(first + 6 * count); }
+
+    // The 6 * size() address bytes as received
+    const uint8_t* data() const { return first; }
+
+private:
+    const uint8_t* first;
+    size_t count;
+};
+
+// The fields that follow EvtGetButtonInfoResponse:
+//   uint8_t uuid_length, uuid[uuid_length], uint8_t name_length,
+//   name[name_length], int32_t color, uint8_t serial_number_length,
+//   serial_number[serial_number_length], uint8_t flic_version,
+//   uint32_t firmware_version
+// parse() walks the three length prefixes once; the accessors then read
+// from the recorded offsets.
+class ButtonInfoView {
+public:
+    // A length-prefixed field, pointing into the frame
+    struct Field {
+        const uint8_t* data;
+        size_t size;
+
+        std::string str() const { return std::string(reinterpret_cast<const char*>(data), size); }
+        const char* chars() const { return reinterpret_cast<const char*>(data); }
+    };
+
+    ButtonInfoView() : base(nullptr), length(0), nameAt(0), serialAt(0), versionAt(0) {}
+
+    // tail is what follows the EvtGetButtonInfoResponse struct. Returns
+    // false if any field runs past len.
+    bool parse(const uint8_t* tail, size_t len) {
+        size_t at = 0;
+        if (!skipField(tail, len, at)) return false;     // uuid
+        size_t name = at;
+        if (!skipField(tail, len, at)) return false;
+        if (len - at < 4) return false;                   // color
+        at += 4;
+        size_t serial = at;
+        if (!skipField(tail, len, at)) return false;
+        if (len - at < 5) return false;                   // flic_version, firmware_version
+        base = tail;
+        length = len;
+        nameAt = name;
+        serialAt = serial;
+        versionAt = at;
+        return true;
+    }
+
+    Field uuid() const { return field(0); }
+    Field name() const { return field(nameAt); }
+    int32_t color() const {
+        return static_cast<int32_t>(PacketViews::loadLE32(base + nameAt + 1 + base[nameAt]));
+    }
+    Field serialNumber() const { return field(serialAt); }
+    uint8_t flicVersion() const { return base[versionAt]; }
+    uint32_t firmwareVersion() const { return PacketViews::loadLE32(base + versionAt + 1); }
+
+    // The fields as received, including any trailing bytes
+    const uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const uint8_t* base;
+    size_t length;
+    size_t nameAt;      // offsets of the length prefixes and the version byte
+    size_t serialAt;
+    size_t versionAt;
+
+    Field field(size_t at) const {
+        Field f = { base + at + 1, base[at] };
+        return f;
+    }
+
+    static bool skipField(const uint8_t* tail, size_t len, size_t& at) {
+        if (at >= len || len - at - 1 < tail[at]) return false;
+        at += 1 + tail[at];
+        return true;
+    }
+};
+
+#endif // PACKET_VIEWS_H
@@ -0,0 +1,122 @@
+#ifndef PROFILE_TABLE_H
+#define PROFILE_TABLE_H
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "bd_addr.h"
+
+// Sets *error to "path:line: what" and returns false, for the line-based
+// config file loaders
+inline bool configError(std::string* error, const std::string& path, size_t lineNo,
+                        const std::string& what) {
+    if (error) *error = path + ":" + std::to_string(lineNo) + ": " + what;
+    return false;
+}
+
+// Per-button profiles of a policy class (LatencyPolicy, ClickRecognizer,
+// FreshnessPolicy). Profile 0 is the default, used for buttons without
+// their own; the others are looked up by packed address. Indexes are
+// stable, so a channel can cache the one its button uses.
+template <typename Profile>
+class ProfileTable {
+public:
+    ProfileTable() : profiles(1) {}
+
+    Profile& defaultProfile() { return profiles[0]; }
+
+    void set(const BdAddr& addr, const Profile& profile) {
+        uint64_t key = packAddress(addr.data());
+        std::unordered_map<uint64_t, uint16_t>::iterator it = byAddr.find(key);
+        if (it != byAddr.end()) {
+            profiles[it->second] = profile;
+            return;
+        }
+        byAddr[key] = static_cast<uint16_t>(profiles.size());
+        profiles.push_back(profile);
+    }
+
+    // Index of addr's profile, 0 if it has none
+    uint16_t indexOf(const uint8_t* addr) const {
+        std::unordered_map<uint64_t, uint16_t>::const_iterator it =
+            byAddr.find(packAddress(addr));
+        return it != byAddr.end() ? it->second : 0;
+    }
+
+    const Profile& at(uint16_t index) const {
+        return profiles[index < profiles.size() ? index : 0];
+    }
+
+    size_t size() const { return profiles.size(); }
+
+    // Reads a profile file. Each line is "default" or a button address
+    // followed by settings; '#' starts a comment. An address line starts
+    // from the button's profile if an earlier line set one, otherwise from
+    // the default as defined above it, passed through startAddress.
+    // apply(Profile&, setting) takes one setting and returns false if it is
+    // bad; check(const Profile&) returns what is wrong with the profile a
+    // line ends with, or null.
+    template <typename Apply, typename Check, typename Start>
+    bool load(const std::string& path, std::string* error, Apply apply, Check check,
+              Start startAddress) {
+        std::ifstream file(path.c_str());
+        if (!file) {
+            if (error) *error = "cannot open " + path;
+            return false;
+        }
+        std::string line;
+        size_t lineNo = 0;
+        while (std::getline(file, line)) {
+            lineNo++;
+            std::istringstream iss(line);
+            std::string target;
+            if (!(iss >> target) || target[0] == '#') continue;
+
+            BdAddr addr;
+            bool isDefault = target == "default";
+            if (!isDefault && !addr.fromString(target)) {
+                return configError(error, path, lineNo, "expected 'default' or a button address");
+            }
+            Profile p = profiles[0];
+            if (!isDefault) {
+                uint16_t existing = indexOf(addr.data());
+                if (existing != 0) p = profiles[existing];
+                else startAddress(p);
+            }
+            std::string setting;
+            while (iss >> setting) {
+                if (setting[0] == '#') break;
+                if (!apply(p, setting)) {
+                    return configError(error, path, lineNo, "bad setting '" + setting + "'");
+                }
+            }
+            if (const char* what = check(p)) return configError(error, path, lineNo, what);
+            if (isDefault) {
+                profiles[0] = p;
+            } else {
+                set(addr, p);
+            }
+        }
+        return true;
+    }
+
+    template <typename Apply, typename Check>
+    bool load(const std::string& path, std::string* error, Apply apply, Check check) {
+        return load(path, error, apply, check, [](Profile&) {});
+    }
+
+    template <typename Apply>
+    bool load(const std::string& path, std::string* error, Apply apply) {
+        return load(path, error, apply, [](const Profile&) -> const char* { return nullptr; });
+    }
+
+private:
+    std::vector<Profile> profiles;
+    std::unordered_map<uint64_t, uint16_t> byAddr;  // packed address -> profile index
+};
+
+#endif // PROFILE_TABLE_H
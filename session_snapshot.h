@@ -0,0 +1,119 @@
+#ifndef SESSION_SNAPSHOT_H
+#define SESSION_SNAPSHOT_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "snapshot_file.h"
+
+// What a FlicClient has asked the server for: its connection channels with
+// their mode parameters, its scanners, and whether every channel also has a
+// battery status listener. FlicClient::snapshotSession() takes one and
+// restoreSession() queues it all again, so a restarted client is back to
+// receiving clicks as soon as the server admits the channels.
+//
+// File layout (see snapshot_file.h): Header, then channelCount Channel
+// records, then scannerCount uint32_t scan ids.
+class SessionSnapshot {
+public:
+    struct Channel {
+        uint8_t address[6];         // protocol (little-endian) byte order
+        int16_t autoDisconnectTime;
+        uint32_t connId;
+        uint8_t latencyMode;        // FlicClientProtocol::LatencyMode
+        uint8_t reserved[3];
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t channelCount;
+        uint32_t scannerCount;
+    };
+
+    enum Flag {
+        BatteryMonitoring = 1
+    };
+
+    std::vector<Channel> channels;
+    std::vector<uint32_t> scanners;
+    bool batteryMonitoring;
+
+    SessionSnapshot() : batteryMonitoring(false) {}
+
+    bool empty() const { return channels.empty() && scanners.empty() && !batteryMonitoring; }
+
+    void addChannel(const uint8_t* address, uint32_t connId, uint8_t latencyMode,
+                    int16_t autoDisconnectTime) {
+        Channel c;
+        std::memset(&c, 0, sizeof(c));
+        std::memcpy(c.address, address, sizeof(c.address));
+        c.autoDisconnectTime = autoDisconnectTime;
+        c.connId = connId;
+        c.latencyMode = latencyMode;
+        channels.push_back(c);
+    }
+
+    // A missing file is an empty snapshot
+    bool load(const std::string& path, std::string* error) {
+        channels.clear();
+        scanners.clear();
+        batteryMonitoring = false;
+
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            if (errno == ENOENT) return true;
+            return snapshotError(error, "open " + path + ": " + std::strerror(errno));
+        }
+        Header header;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                  std::memcmp(header.magic, magic(), sizeof(header.magic)) == 0 &&
+                  header.version == kVersion && header.channelCount <= kMaxRecords &&
+                  header.scannerCount <= kMaxRecords;
+        if (ok) {
+            channels.resize(header.channelCount);
+            scanners.resize(header.scannerCount);
+            ok = (channels.empty() ||
+                  std::fread(&channels[0], sizeof(Channel), channels.size(), file) == channels.size()) &&
+                 (scanners.empty() ||
+                  std::fread(&scanners[0], sizeof(uint32_t), scanners.size(), file) == scanners.size());
+        }
+        std::fclose(file);
+        if (!ok) {
+            channels.clear();
+            scanners.clear();
+            return snapshotError(error, path + ": not a session snapshot or truncated");
+        }
+        batteryMonitoring = (header.flags & BatteryMonitoring) != 0;
+        return true;
+    }
+
+    bool save(const std::string& path, std::string* error) const {
+        SnapshotWriter file(path);
+        if (!file.open(error)) return false;
+
+        Header header;
+        std::memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = kVersion;
+        header.flags = batteryMonitoring ? BatteryMonitoring : 0;
+        header.channelCount = static_cast<uint32_t>(channels.size());
+        header.scannerCount = static_cast<uint32_t>(scanners.size());
+        file.write(&header, sizeof(header));
+        if (!channels.empty()) file.write(&channels[0], sizeof(Channel), channels.size());
+        if (!scanners.empty()) file.write(&scanners[0], sizeof(uint32_t), scanners.size());
+        return file.commit(error);
+    }
+
+private:
+    static const uint32_t kVersion = 1;
+    static const uint32_t kMaxRecords = 1 << 20;  // sanity bound for load()
+
+    static const char* magic() { return "FLICSES1"; }
+};
+
+#endif // SESSION_SNAPSHOT_H
@@ -0,0 +1,94 @@
+#ifndef SNAPSHOT_FILE_H
+#define SNAPSHOT_FILE_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// On-disk snapshots (ButtonInfoCache, SessionSnapshot) are a header with
+// an 8-byte magic and a version, then fixed-size records, all in host byte
+// order like the journal. SnapshotWriter writes them to a temporary file,
+// syncs it, renames it over the old snapshot and syncs the directory, so a
+// crash leaves either snapshot intact.
+
+// Sets *error to what and returns false
+inline bool snapshotError(std::string* error, const std::string& what) {
+    if (error) *error = what;
+    return false;
+}
+
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path)
+        : path(path), tmp(path + ".tmp"), file(nullptr), ok(true), err(0) {}
+
+    ~SnapshotWriter() {
+        if (!file) return;
+        std::fclose(file);
+        std::remove(tmp.c_str());
+    }
+
+    bool open(std::string* error) {
+        file = std::fopen(tmp.c_str(), "wb");
+        if (!file) return snapshotError(error, "open " + tmp + ": " + std::strerror(errno));
+        return true;
+    }
+
+    // Appends count records of size bytes; a failure is reported by commit()
+    void write(const void* data, size_t size, size_t count = 1) {
+        if (!ok || count == 0) return;
+        ok = std::fwrite(data, size, count, file) == count;
+        if (!ok) err = errno;
+    }
+
+    // Replaces the snapshot with what was written
+    bool commit(std::string* error) {
+        if (ok && (std::fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+            ok = false;
+            err = errno;
+        }
+        std::fclose(file);
+        file = nullptr;
+        if (ok && std::rename(tmp.c_str(), path.c_str()) < 0) {
+            ok = false;
+            err = errno;
+        }
+        if (!ok) {
+            std::remove(tmp.c_str());
+            return snapshotError(error, "write " + path + ": " + std::strerror(err));
+        }
+        if (!syncDirectory()) {
+            return snapshotError(error, "sync directory of " + path + ": " + std::strerror(errno));
+        }
+        return true;
+    }
+
+private:
+    std::string path;
+    std::string tmp;
+    FILE* file;
+    bool ok;
+    int err;
+
+    SnapshotWriter(const SnapshotWriter&);
+    SnapshotWriter& operator=(const SnapshotWriter&);
+
+    // Makes the rename itself durable
+    bool syncDirectory() const {
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return false;
+        bool synced = fsync(fd) == 0;
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return synced;
+    }
+};
+
+#endif // SNAPSHOT_FILE_H
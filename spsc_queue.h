@@ -0,0 +1,136 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+// Lock-free single-producer/single-consumer ring of variable-length frames.
+//
+// Each record is a 16-byte header (length, receive timestamp) followed by
+// the frame bytes, padded to 16 bytes so a header always fits before the end
+// of the ring. A record never wraps: if it does not fit before the end, a
+// wrap marker is written and the record starts again at offset 0, so the
+// consumer always sees contiguous frames.
+// head and tail are free-running byte counters; only the producer writes
+// tail and only the consumer writes head.
+class FrameQueue {
+public:
+    // capacity is rounded up to a power of two large enough for two
+    // maximum-size frames
+    explicit FrameQueue(size_t capacity)
+        : ring(roundUp(capacity)), mask(ring.size() - 1),
+          head(0), tail(0), pushed(0), highWater(0) {}
+
+    // Producer side. Returns false if the frame does not fit right now.
+    bool push(const uint8_t* data, size_t len, uint64_t recvNs) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        size_t need = recordSize(len);
+        size_t pos = static_cast<size_t>(t & mask);
+        size_t contiguous = ring.size() - pos;
+        size_t skip = need > contiguous ? contiguous : 0;
+
+        uint64_t used = t - h;
+        if (used + skip + need > ring.size()) {
+            return false;
+        }
+
+        if (skip > 0) {
+            Header marker = { kWrapMarker, 0, 0 };
+            std::memcpy(&ring[pos], &marker, sizeof(marker));
+            t += skip;
+            pos = 0;
+        }
+        Header header = { static_cast<uint32_t>(len), 0, recvNs };
+        std::memcpy(&ring[pos], &header, sizeof(header));
+        std::memcpy(&ring[pos + sizeof(header)], data, len);
+        t += need;
+        tail.store(t, std::memory_order_release);
+
+        pushed.fetch_add(1, std::memory_order_relaxed);
+        uint64_t depth = t - h;
+        if (depth > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(depth, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Consumer side. The frame stays valid until pop().
+    bool front(const uint8_t*& data, size_t& len, uint64_t& recvNs) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t t = tail.load(std::memory_order_acquire);
+        if (h == t) return false;
+
+        size_t pos = static_cast<size_t>(h & mask);
+        Header header;
+        std::memcpy(&header, &ring[pos], sizeof(header));
+        if (header.len == kWrapMarker) {
+            h += ring.size() - pos;
+            head.store(h, std::memory_order_release);
+            if (h == t) return false;
+            pos = 0;
+            std::memcpy(&header, &ring[pos], sizeof(header));
+        }
+        data = &ring[pos + sizeof(header)];
+        len = header.len;
+        recvNs = header.recvNs;
+        return true;
+    }
+
+    void pop() {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        Header header;
+        std::memcpy(&header, &ring[static_cast<size_t>(h & mask)], sizeof(header));
+        head.store(h + recordSize(header.len), std::memory_order_release);
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return ring.size(); }
+    size_t usedBytes() const {
+        return static_cast<size_t>(tail.load(std::memory_order_acquire) -
+                                   head.load(std::memory_order_acquire));
+    }
+
+    uint64_t pushCount() const { return pushed.load(std::memory_order_relaxed); }
+    uint64_t highWaterBytes() const { return highWater.load(std::memory_order_relaxed); }
+
+private:
+    struct Header {
+        uint32_t len;
+        uint32_t reserved;
+        uint64_t recvNs;
+    };
+
+    static const uint32_t kWrapMarker = 0xffffffffu;
+
+    std::vector<uint8_t> ring;
+    size_t mask;
+
+    // Producer and consumer indices on separate cache lines. Padding rather
+    // than alignas, which operator new ignores before C++17.
+    char padHead[64];
+    std::atomic<uint64_t> head;
+    char padTail[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> tail;
+    char padStats[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> pushed;
+    std::atomic<uint64_t> highWater;
+
+    static size_t recordSize(size_t len) {
+        return sizeof(Header) + ((len + 15) & ~static_cast<size_t>(15));
+    }
+
+    static size_t roundUp(size_t capacity) {
+        size_t minimum = 2 * recordSize(0xffff);
+        size_t size = 1;
+        while (size < capacity || size < minimum) size <<= 1;
+        return size;
+    }
+};
+
+#endif // SPSC_QUEUE_H
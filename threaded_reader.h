@@ -0,0 +1,162 @@
+#ifndef THREADED_READER_H
+#define THREADED_READER_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <thread>
+#include <stdint.h>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "frame_decoder.h"
+#include "spsc_queue.h"
+#include "event_loop.h"
+
+// Dedicated I/O thread that drains a socket into a FrameQueue.
+//
+// The reader thread only does recv(), framing and push(); handlers run on
+// whichever thread consumes the queue (the client's event loop). After each
+// recv() that queued frames the consumer is woken through notifyFd(). When
+// the queue is full, DropNewest discards incoming frames and counts them so
+// the socket keeps draining at full speed; Block stops reading until the
+// consumer catches up, pushing the backlog into the kernel and flicd.
+class ThreadedReader {
+public:
+    enum OverflowPolicy {
+        DropNewest,
+        Block
+    };
+
+    ThreadedReader(size_t queueBytes, OverflowPolicy policy)
+        : queue(queueBytes), policy(policy), sockfd(-1),
+          notifyfd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+          stopfd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+          finished(false), dropped(0), blockedWaits(0), recvCalls(0) {}
+
+    ~ThreadedReader() {
+        stop();
+        if (notifyfd >= 0) close(notifyfd);
+        if (stopfd >= 0) close(stopfd);
+    }
+
+    bool start(int fd) {
+        if (notifyfd < 0 || stopfd < 0) {
+            perror("eventfd");
+            return false;
+        }
+        sockfd = fd;
+        finished.store(false);
+        thread = std::thread(&ThreadedReader::readerMain, this);
+        return true;
+    }
+
+    // Stops and joins the reader thread; frames already queued stay queued
+    void stop() {
+        if (!thread.joinable()) return;
+        uint64_t one = 1;
+        ssize_t n = write(stopfd, &one, sizeof(one));
+        (void)n;
+        thread.join();
+        uint64_t count;
+        n = read(stopfd, &count, sizeof(count));
+    }
+
+    // Readable whenever frames were queued or the reader finished
+    int notifyFd() const { return notifyfd; }
+
+    void clearNotify() {
+        uint64_t count;
+        ssize_t n = read(notifyfd, &count, sizeof(count));
+        (void)n;
+    }
+
+    FrameQueue& frames() { return queue; }
+    const FrameQueue& frames() const { return queue; }
+
+    // True once the socket hit EOF or an error; drain frames() before acting
+    bool isFinished() const { return finished.load(std::memory_order_acquire); }
+
+    OverflowPolicy overflowPolicy() const { return policy; }
+    uint64_t dropCount() const { return dropped.load(std::memory_order_relaxed); }
+    uint64_t blockedCount() const { return blockedWaits.load(std::memory_order_relaxed); }
+    uint64_t recvCount() const { return recvCalls.load(std::memory_order_relaxed); }
+
+private:
+    FrameQueue queue;
+    OverflowPolicy policy;
+    int sockfd;
+    int notifyfd;
+    int stopfd;
+    std::thread thread;
+    std::atomic<bool> finished;
+
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> blockedWaits;
+    std::atomic<uint64_t> recvCalls;
+
+    void notify() {
+        uint64_t one = 1;
+        ssize_t n = write(notifyfd, &one, sizeof(one));
+        (void)n;
+    }
+
+    // Waits for the consumer to free space; false if asked to stop meanwhile
+    bool waitForSpace(const uint8_t* frame, size_t len, uint64_t recvNs) {
+        blockedWaits.fetch_add(1, std::memory_order_relaxed);
+        notify();
+        struct pollfd pfd;
+        pfd.fd = stopfd;
+        pfd.events = POLLIN;
+        while (!queue.push(frame, len, recvNs)) {
+            if (poll(&pfd, 1, 1) > 0) return false;
+        }
+        return true;
+    }
+
+    void readerMain() {
+        FrameDecoder decoder;
+        struct pollfd fds[2];
+        fds[0].fd = sockfd;
+        fds[0].events = POLLIN;
+        fds[1].fd = stopfd;
+        fds[1].events = POLLIN;
+
+        for (;;) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents & POLLIN) return;
+
+            ssize_t n = decoder.fill(sockfd);
+            recvCalls.store(decoder.recvCount(), std::memory_order_relaxed);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                break;
+            }
+
+            uint64_t recvNs = EventLoop::nowNs();
+            bool queued = false;
+            const uint8_t* frame;
+            size_t len;
+            while (decoder.next(frame, len)) {
+                if (queue.push(frame, len, recvNs)) {
+                    queued = true;
+                } else if (policy == Block) {
+                    if (!waitForSpace(frame, len, recvNs)) return;
+                    queued = true;
+                } else {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (queued) notify();
+        }
+
+        finished.store(true, std::memory_order_release);
+        notify();
+    }
+};
+
+#endif // THREADED_READER_H